@@ -0,0 +1,64 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "commit_scheduler.h"
+#include "metrics.h"
+
+// never commit closer to the vsync than this
+#define MIN_MARGIN_NS 1000000LL
+// a miss costs a whole frame, so back off fast and creep back slowly
+#define MISS_STEP_DIVISOR 8
+#define HIT_STEP_NS 20000LL
+
+int64_t commit_scheduler_t::get_margin()
+{
+    int64_t period = vsync.get_period();
+
+    if(margin_ns == 0) margin_ns = period / 3;
+    if(margin_ns < MIN_MARGIN_NS) margin_ns = MIN_MARGIN_NS;
+    if(period > 0 && margin_ns > period) margin_ns = period;
+
+    return margin_ns;
+}
+
+int64_t commit_scheduler_t::target_vsync(int64_t now_ns)
+{
+    int64_t target = vsync.next_vsync(now_ns);
+
+    if(target - get_margin() <= now_ns) target += vsync.get_period();
+
+    return target;
+}
+
+void commit_scheduler_t::add_result(int64_t target_ns, int64_t presented_ns, bool latched)
+{
+    int64_t period = vsync.get_period();
+    bool hit = presented_ns <= target_ns + period / 2;
+
+    metrics_t::count(hit ? COUNTER_DEADLINE_HITS : COUNTER_DEADLINE_MISSES);
+
+    // frames committed whenever they came don't say anything about the deadline
+    if(!latched || period <= 0) return;
+
+    get_margin();
+    if(hit) margin_ns -= HIT_STEP_NS;
+    else margin_ns += period / MISS_STEP_DIVISOR;
+    metrics_t::set(GAUGE_COMMIT_MARGIN_US, get_margin() / 1000);
+}
@@ -0,0 +1,31 @@
+#ifndef __COMMIT_SCHEDULER_H__
+#define __COMMIT_SCHEDULER_H__
+
+#include <cstdint>
+
+#include "vsync_estimator.h"
+
+// decides when held frames get committed. learns how long before a vsync
+// the compositor stops taking commits for it from presentation feedback:
+// a miss moves the deadline earlier by a lot, every hit later by a little.
+class commit_scheduler_t {
+    public:
+        commit_scheduler_t(vsync_estimator_t &v) : vsync(v), enabled(false), margin_ns(0) {}
+        void set_enabled(bool e) { enabled = e; }
+        // false if frames should be committed right away
+        bool is_active() { return enabled && vsync.is_valid(); }
+        // the first vsync whose deadline is still ahead
+        int64_t target_vsync(int64_t now_ns);
+        int64_t deadline(int64_t target_ns) { return target_ns - get_margin(); }
+        // latched is true if the commit was timed by the scheduler
+        void add_result(int64_t target_ns, int64_t presented_ns, bool latched);
+
+        int64_t get_margin();
+
+    private:
+        vsync_estimator_t &vsync;
+        bool enabled;
+        int64_t margin_ns;
+};
+
+#endif
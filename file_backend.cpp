@@ -0,0 +1,117 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "file_backend.h"
+#include "renderer.h"
+#include "sfconnection.h"
+#include "utility.h"
+#include "metrics.h"
+
+using namespace std;
+
+bool file_backend_t::truncated(false);
+
+int file_backend_t::init(renderer_t &r)
+{
+    int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+
+    null_backend_t::init(r);
+
+    if(!truncated) flags |= O_TRUNC;
+    fd = open(path.c_str(), flags, 0644);
+    if(fd < 0)
+    {
+        cerr << "failed to open " << path << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    truncated = true;
+
+    return 0;
+}
+
+void file_backend_t::deinit()
+{
+    if(fd >= 0) close(fd);
+    fd = -1;
+    null_backend_t::deinit();
+}
+
+int file_backend_t::present(ANativeWindowBuffer *buffer, buffer_info_t &info, int acquire_fence, int64_t target_ns, bool latched, int32_t frame_id)
+{
+    struct frame_record_t record;
+    struct iovec io_vector[2];
+    void *pixels = nullptr;
+    int num_vectors = 1;
+
+    memset(&record, 0, sizeof(record));
+    record.magic = FRAME_RECORD_MAGIC;
+    record.present_ns = monotonic_ns();
+    record.target_ns = target_ns;
+    record.frame_id = frame_id;
+    record.width = info.width;
+    record.height = info.height;
+    record.stride = info.stride;
+    record.pixel_format = info.pixel_format;
+    strncpy(record.package, renderer->get_package().c_str(), sizeof(record.package) - 1);
+
+    if(with_pixels && bytes_per_pixel(info.pixel_format) != 0)
+    {
+        // reading is only safe once the producer is done writing
+        if(acquire_fence >= 0) wait_fence(acquire_fence, FENCE_WAIT_TIMEOUT_MS);
+
+        metrics_t::count(COUNTER_BUFFER_LOCKS);
+        if(gralloc_module->lock(gralloc_module, buffer->handle, GRALLOC_USAGE_SW_READ_OFTEN, 0, 0, info.width, info.height, &pixels) != 0)
+        {
+            cerr << "gralloc lock failed" << endl;
+            pixels = nullptr;
+        }
+        else
+        {
+            record.pixel_size = info.stride * info.height * bytes_per_pixel(info.pixel_format);
+            io_vector[1].iov_base = pixels;
+            io_vector[1].iov_len = record.pixel_size;
+            num_vectors = 2;
+        }
+    }
+
+    record.size = sizeof(record) + record.pixel_size;
+    io_vector[0].iov_base = &record;
+    io_vector[0].iov_len = sizeof(record);
+
+    // one write per record, windows share the file
+    if(writev(fd, io_vector, num_vectors) != (ssize_t)record.size)
+    {
+        cerr << "failed to write " << path << ": " << strerror(errno) << endl;
+    }
+
+    if(pixels) gralloc_module->unlock(gralloc_module, buffer->handle);
+
+    return null_backend_t::present(buffer, info, acquire_fence, target_ns, latched, frame_id);
+}
@@ -0,0 +1,44 @@
+#ifndef __FILE_BACKEND_H__
+#define __FILE_BACKEND_H__
+
+#include "null_backend.h"
+
+#include <string>
+
+#define FRAME_RECORD_MAGIC 0x5346524d
+
+// one per presented frame, the pixels follow if there are any
+struct frame_record_t
+{
+    uint32_t magic;
+    uint32_t size; // including the pixels
+    int64_t present_ns; // CLOCK_MONOTONIC
+    int64_t target_ns; // the vsync it was meant for, 0 if unknown
+    int32_t frame_id;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    int32_t pixel_format;
+    uint32_t pixel_size; // stride * height * bytes per pixel, 0 without pixels
+    char package[64];
+};
+
+// like null_backend_t, but appends a frame_record_t for every frame to a
+// file, all windows share it. it is truncated when the first window opens it.
+class file_backend_t : public null_backend_t {
+    public:
+        file_backend_t(const std::string &file, bool pixels) : path(file), with_pixels(pixels), fd(-1) {}
+        const char *name() { return "file"; }
+        int init(renderer_t &renderer);
+        void deinit();
+        int present(ANativeWindowBuffer *buffer, buffer_info_t &info, int acquire_fence, int64_t target_ns, bool latched, int32_t frame_id);
+
+    private:
+        std::string path;
+        bool with_pixels;
+        int fd;
+        static bool truncated;
+};
+
+#endif
+
@@ -0,0 +1,418 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "iio_backend.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+using namespace std;
+
+static bool read_attr(const string &path, string &value)
+{
+    ifstream f(path.c_str());
+    if(!f.is_open()) return false;
+    getline(f, value);
+    return true;
+}
+
+static bool write_attr(const string &path, const string &value)
+{
+    ofstream f(path.c_str());
+    if(!f.is_open()) return false;
+    f << value;
+    f.flush();
+    return f.good();
+}
+
+static bool read_attr_double(const string &path, double &value)
+{
+    string s;
+    if(!read_attr(path, s)) return false;
+    return sscanf(s.c_str(), "%lf", &value) == 1;
+}
+
+static bool file_exists(const string &path)
+{
+    return access(path.c_str(), F_OK) == 0;
+}
+
+int iio_backend_t::find_device()
+{
+    DIR *dir = opendir(sysfs_root.c_str());
+    struct dirent *entry;
+
+    if(!dir)
+    {
+        cerr << "iio: failed to open " << sysfs_root << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    device = "";
+    while((entry = readdir(dir)) != NULL)
+    {
+        string dname = entry->d_name;
+        if(dname.find("iio:device") != 0) continue;
+
+        if(file_exists(sysfs_root + "/" + dname + "/scan_elements/in_accel_x_en"))
+        {
+            device = dname;
+            device_dir = sysfs_root + "/" + dname;
+            break;
+        }
+    }
+    closedir(dir);
+
+    if(device == "")
+    {
+        cerr << "iio: no accelerometer with a buffer found in " << sysfs_root << endl;
+        return 2;
+    }
+
+#if DEBUG
+    cout << "iio: using accelerometer " << device_dir << endl;
+#endif
+    return 0;
+}
+
+int iio_backend_t::setup_channels()
+{
+    string scan_dir = device_dir + "/scan_elements";
+    const char *axes[] = { "x", "y", "z" };
+    DIR *dir;
+    struct dirent *entry;
+    unsigned int max_storage = 1;
+    string value;
+
+    // scan elements can only be changed while the buffer is off
+    write_attr(device_dir + "/buffer/enable", "0");
+
+    for(int i = 0;i < 3;i++)
+    {
+        if(!write_attr(scan_dir + "/in_accel_" + axes[i] + "_en", "1"))
+        {
+            cerr << "iio: failed to enable in_accel_" << axes[i] << endl;
+            return 1;
+        }
+    }
+
+    // whatever else is enabled (e.g. a timestamp) is part of the sample too
+    channels.clear();
+    dir = opendir(scan_dir.c_str());
+    if(!dir)
+    {
+        cerr << "iio: failed to open " << scan_dir << ": " << strerror(errno) << endl;
+        return 2;
+    }
+
+    while((entry = readdir(dir)) != NULL)
+    {
+        string ename = entry->d_name;
+        if(ename.size() < 4 || ename.compare(ename.size() - 3, 3, "_en") != 0) continue;
+        if(!read_attr(scan_dir + "/" + ename, value) || value != "1") continue;
+
+        channel_t channel;
+        char endian, sign;
+        channel.name = ename.substr(0, ename.size() - 3);
+        channel.shift = 0;
+
+        if(!read_attr(scan_dir + "/" + channel.name + "_index", value) || sscanf(value.c_str(), "%d", &channel.index) != 1)
+        {
+            cerr << "iio: no index for " << channel.name << endl;
+            closedir(dir);
+            return 3;
+        }
+
+        if(!read_attr(scan_dir + "/" + channel.name + "_type", value) ||
+            sscanf(value.c_str(), "%ce:%c%u/%u>>%u", &endian, &sign, &channel.bits, &channel.storage_bytes, &channel.shift) < 4)
+        {
+            cerr << "iio: can't parse type of " << channel.name << ": " << value << endl;
+            closedir(dir);
+            return 4;
+        }
+
+        channel.big_endian = (endian == 'b');
+        channel.is_signed = (sign == 's');
+        channel.storage_bytes /= 8;
+        if(channel.storage_bytes == 0 || channel.storage_bytes > 8)
+        {
+            cerr << "iio: unsupported storage size for " << channel.name << endl;
+            closedir(dir);
+            return 5;
+        }
+        // decode() masks and sign extends with bits, shifts with shift
+        if(channel.bits == 0 || channel.bits > channel.storage_bytes * 8 || channel.shift >= channel.storage_bytes * 8)
+        {
+            cerr << "iio: unsupported bits for " << channel.name << ": " << value << endl;
+            closedir(dir);
+            return 5;
+        }
+        channels.push_back(channel);
+    }
+    closedir(dir);
+
+    sort(channels.begin(), channels.end(), [](const channel_t &a, const channel_t &b) { return a.index < b.index; });
+
+    // every element is aligned to its own size, the sample to the biggest one
+    sample_size = 0;
+    for(vector<channel_t>::size_type i = 0;i < channels.size();i++)
+    {
+        unsigned int storage = channels[i].storage_bytes;
+        sample_size = (sample_size + storage - 1) / storage * storage;
+        channels[i].offset = sample_size;
+        sample_size += storage;
+        max_storage = std::max(max_storage, storage);
+
+        for(int a = 0;a < 3;a++)
+        {
+            if(channels[i].name == string("in_accel_") + axes[a]) axis[a] = i;
+        }
+    }
+    sample_size = (sample_size + max_storage - 1) / max_storage * max_storage;
+
+    if(!read_attr_double(device_dir + "/in_accel_scale", scale) && !read_attr_double(device_dir + "/in_accel_x_scale", scale))
+    {
+        scale = 1.0;
+    }
+
+    if(!read_attr_double(device_dir + "/in_accel_offset", offset))
+    {
+        offset = 0.0;
+    }
+
+    for(int i = 0;i < 9;i++) mount_matrix[i] = (i % 4 == 0) ? 1.0 : 0.0;
+    if(read_attr(device_dir + "/in_accel_mount_matrix", value) || read_attr(device_dir + "/mount_matrix", value))
+    {
+        double m[9];
+        if(sscanf(value.c_str(), "%lf, %lf, %lf; %lf, %lf, %lf; %lf, %lf, %lf", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5], &m[6], &m[7], &m[8]) == 9)
+        {
+            memcpy(mount_matrix, m, sizeof(m));
+        }
+    }
+
+#if DEBUG
+    cout << "iio: " << channels.size() << " channels, sample size " << sample_size << " scale " << scale << endl;
+#endif
+    return 0;
+}
+
+int iio_backend_t::find_trigger()
+{
+    string current;
+    string devname;
+    DIR *dir;
+    struct dirent *entry;
+
+    // devices without a trigger directory don't need one
+    if(!read_attr(device_dir + "/trigger/current_trigger", current)) return 0;
+    if(current != "") return 0;
+
+    read_attr(device_dir + "/name", devname);
+
+    dir = opendir(sysfs_root.c_str());
+    if(!dir) return 1;
+
+    while((entry = readdir(dir)) != NULL)
+    {
+        string tname;
+        string dname = entry->d_name;
+        if(dname.find("trigger") != 0) continue;
+        if(!read_attr(sysfs_root + "/" + dname + "/name", tname)) continue;
+
+        // drivers name their data ready trigger after the device
+        if(devname != "" && tname.find(devname) == 0)
+        {
+            current = tname;
+            break;
+        }
+    }
+    closedir(dir);
+
+    if(current == "")
+    {
+        cerr << "iio: no trigger found for " << device << endl;
+        return 2;
+    }
+
+    if(!write_attr(device_dir + "/trigger/current_trigger", current))
+    {
+        cerr << "iio: failed to set trigger " << current << endl;
+        return 3;
+    }
+
+    return 0;
+}
+
+void iio_backend_t::apply_interval()
+{
+    char hz[32];
+
+    if(interval_ms <= 0 || device == "") return;
+
+    snprintf(hz, sizeof(hz), "%g", 1000.0 / interval_ms);
+    if(!write_attr(device_dir + "/in_accel_sampling_frequency", hz))
+    {
+        write_attr(device_dir + "/sampling_frequency", hz);
+    }
+}
+
+int iio_backend_t::start()
+{
+    int err = 0;
+    string dev_path;
+
+    if(fd_buffer >= 0) return 0;
+
+    if(device == "" && find_device() != 0)
+    {
+        err = 1;
+        goto quit;
+    }
+
+    if(setup_channels() != 0)
+    {
+        err = 2;
+        goto quit;
+    }
+
+    if(find_trigger() != 0)
+    {
+        err = 3;
+        goto quit;
+    }
+
+    apply_interval();
+
+    write_attr(device_dir + "/buffer/length", "32");
+    if(!write_attr(device_dir + "/buffer/enable", "1"))
+    {
+        cerr << "iio: failed to enable the buffer of " << device << endl;
+        err = 4;
+        goto quit;
+    }
+
+    dev_path = dev_root + "/" + device;
+    fd_buffer = open(dev_path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if(fd_buffer < 0)
+    {
+        cerr << "iio: failed to open " << dev_path << ": " << strerror(errno) << endl;
+        write_attr(device_dir + "/buffer/enable", "0");
+        err = 5;
+        goto quit;
+    }
+
+    read_buffer.resize(sample_size * 32);
+    // like sensorfw report zeros until the first sample arrives
+    last[0] = last[1] = last[2] = 0.0;
+
+quit:
+    return err;
+}
+
+void iio_backend_t::stop()
+{
+    if(fd_buffer < 0) return;
+
+    write_attr(device_dir + "/buffer/enable", "0");
+    close(fd_buffer);
+    fd_buffer = -1;
+}
+
+void iio_backend_t::shutdown()
+{
+    stop();
+}
+
+void iio_backend_t::set_interval(int ms)
+{
+    interval_ms = ms;
+    apply_interval();
+}
+
+double iio_backend_t::decode(const channel_t &channel, const unsigned char *sample)
+{
+    uint64_t raw = 0;
+    int64_t value;
+    const unsigned char *p = sample + channel.offset;
+
+    for(unsigned int i = 0;i < channel.storage_bytes;i++)
+    {
+        unsigned int b = channel.big_endian ? i : channel.storage_bytes - 1 - i;
+        raw = (raw << 8) | p[b];
+    }
+
+    raw >>= channel.shift;
+    if(channel.bits < 64) raw &= ((uint64_t)1 << channel.bits) - 1;
+
+    if(channel.is_signed && channel.bits < 64 && (raw & ((uint64_t)1 << (channel.bits - 1))))
+    {
+        value = (int64_t)(raw | ~(((uint64_t)1 << channel.bits) - 1));
+    }
+    else value = (int64_t)raw;
+
+    return ((double)value + offset) * scale;
+}
+
+int iio_backend_t::read_accelerometer(double &x, double &y, double &z)
+{
+    ssize_t r;
+    ssize_t last_read = 0;
+    double v[3];
+
+    if(fd_buffer < 0) return 1;
+
+    // only the newest sample is interesting, drain whatever is queued
+    while((r = read(fd_buffer, &read_buffer[0], read_buffer.size())) > 0)
+    {
+        last_read = r;
+    }
+
+    if(r < 0 && errno != EAGAIN && errno != EINTR)
+    {
+        cerr << "iio: failed to read " << device << ": " << strerror(errno) << endl;
+        return 2;
+    }
+
+    if(last_read >= (ssize_t)sample_size)
+    {
+        const unsigned char *sample = &read_buffer[(last_read / sample_size - 1) * sample_size];
+
+        for(int i = 0;i < 3;i++) v[i] = decode(channels[axis[i]], sample);
+        for(int i = 0;i < 3;i++)
+        {
+            last[i] = mount_matrix[i * 3] * v[0] + mount_matrix[i * 3 + 1] * v[1] + mount_matrix[i * 3 + 2] * v[2];
+        }
+    }
+
+    x = last[0];
+    y = last[1];
+    z = last[2];
+
+    return 0;
+}
+
@@ -0,0 +1,59 @@
+#ifndef __IIO_BACKEND_H__
+#define __IIO_BACKEND_H__
+
+#include "sensorbackend.h"
+
+#include <string>
+#include <vector>
+
+// reads an accelerometer through the linux iio triggered buffer,
+// sysfs_root is normally /sys/bus/iio/devices and dev_root /dev
+class iio_backend_t : public sensorbackend_t {
+    public:
+        iio_backend_t(const std::string &sysfs, const std::string &dev) : sysfs_root(sysfs), dev_root(dev), fd_buffer(-1), sample_size(0), interval_ms(0) {}
+        const char *name() { return "iio"; }
+        int start();
+        void stop();
+        void shutdown();
+        void set_interval(int interval_ms);
+        int read_accelerometer(double &x, double &y, double &z);
+
+    private:
+        struct channel_t
+        {
+            std::string name;
+            int index;
+            bool is_signed;
+            bool big_endian;
+            unsigned int bits;
+            unsigned int storage_bytes;
+            unsigned int shift;
+            unsigned int offset; // in the sample
+        };
+
+        int find_device();
+        int setup_channels();
+        int find_trigger();
+        void apply_interval();
+        double decode(const channel_t &channel, const unsigned char *sample);
+
+        std::string sysfs_root;
+        std::string dev_root;
+        std::string device; // e.g. iio:device0
+        std::string device_dir;
+
+        int fd_buffer;
+        std::vector<channel_t> channels;
+        int axis[3]; // index into channels for x, y and z
+        unsigned int sample_size;
+        double scale;
+        double offset;
+        double mount_matrix[9];
+        int interval_ms;
+
+        std::vector<unsigned char> read_buffer;
+        double last[3];
+};
+
+#endif
+
@@ -0,0 +1,85 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#include "input_trace.h"
+#include "utility.h"
+
+using namespace std;
+
+int input_trace_t::init(const char *p, int32_t width, int32_t height)
+{
+    struct input_trace_header_t header;
+
+    path = p;
+    file = fopen(path.c_str(), "we");
+    if(!file)
+    {
+        cerr << "failed to open " << path << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = INPUT_TRACE_MAGIC;
+    header.version = INPUT_TRACE_VERSION;
+    header.width = width;
+    header.height = height;
+    if(fwrite(&header, sizeof(header), 1, file) != 1)
+    {
+        cerr << "failed to write " << path << ": " << strerror(errno) << endl;
+        deinit();
+        return 2;
+    }
+
+#if DEBUG
+    cout << "tracing input to " << path << endl;
+#endif
+    return 0;
+}
+
+void input_trace_t::deinit()
+{
+    if(file) fclose(file);
+    file = nullptr;
+}
+
+void input_trace_t::record(uint32_t type, uint32_t time, int32_t id, int32_t x, int32_t y)
+{
+    struct input_trace_record_t record;
+
+    if(!file) return;
+
+    record.type = type;
+    record.time = time;
+    record.received_ns = monotonic_ns();
+    record.id = id;
+    record.x = x;
+    record.y = y;
+    record.reserved = 0;
+
+    if(fwrite(&record, sizeof(record), 1, file) != 1)
+    {
+        cerr << "failed to write " << path << ", stopping the trace: " << strerror(errno) << endl;
+        deinit();
+    }
+}
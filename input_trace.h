@@ -0,0 +1,61 @@
+#ifndef __INPUT_TRACE_H__
+#define __INPUT_TRACE_H__
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// SFDROID_INPUT_TRACE=<file>, the wayland input events the window manager
+// got, for tools/sfdroid_input_replay. an input_trace_header_t followed by
+// input_trace_record_t. focus events don't say which window they were for.
+
+#define INPUT_TRACE_MAGIC 0x53464954
+#define INPUT_TRACE_VERSION 1
+
+enum input_trace_type
+{
+    INPUT_TOUCH_DOWN = 1,
+    INPUT_TOUCH_UP = 2,
+    INPUT_TOUCH_MOTION = 3,
+    INPUT_TOUCH_FRAME = 4,
+    INPUT_TOUCH_CANCEL = 5,
+    INPUT_KEYBOARD_ENTER = 6,
+    INPUT_KEYBOARD_LEAVE = 7,
+};
+
+struct input_trace_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t width; // of the output, touches are relative to it
+    int32_t height;
+};
+
+struct input_trace_record_t
+{
+    uint32_t type;
+    uint32_t time; // the compositor's timestamp in ms, 0 for events without one
+    int64_t received_ns; // CLOCK_MONOTONIC
+    int32_t id;
+    int32_t x; // wl_fixed_t
+    int32_t y;
+    uint32_t reserved;
+};
+
+// only used from the main thread
+class input_trace_t {
+    public:
+        input_trace_t() : file(nullptr) {}
+        int init(const char *path, int32_t width, int32_t height);
+        void deinit();
+        void record(uint32_t type, uint32_t time, int32_t id, int32_t x, int32_t y);
+        // buffered records hit the file, at focus changes and when done
+        void flush() { if(file) fflush(file); }
+
+    private:
+        FILE *file;
+        std::string path;
+};
+
+#endif
+
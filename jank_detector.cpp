@@ -0,0 +1,139 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+
+#include "jank_detector.h"
+#include "sfdroid_defs.h"
+#include "metrics.h"
+#include "logger.h"
+
+using namespace std;
+
+#define JANK_IDLE_GAP_NS (JANK_IDLE_GAP_MS * 1000000LL)
+// weight of a new interval in the post cadence
+#define CADENCE_DIVISOR 8
+
+static const char *cause_names[JANK_CAUSE_COUNT] = { "producer", "queue", "frame_callback", "to_front", "no_buffer" };
+
+void jank_detector_t::add_post(int64_t post_ns)
+{
+    int64_t interval = post_ns - last_post_ns;
+
+    // after an idle phase the app might animate at a different rate
+    if(interval >= JANK_IDLE_GAP_NS) cadence_ns = 0;
+    else if(last_post_ns != 0 && interval > 0)
+    {
+        if(cadence_ns == 0) cadence_ns = interval;
+        else cadence_ns += (interval - cadence_ns) / CADENCE_DIVISOR;
+    }
+    last_post_ns = post_ns;
+
+    if(first_post_ns == 0) first_post_ns = post_ns;
+}
+
+jank_cause jank_detector_t::classify(int64_t expected_ns, int64_t callback_wait_ns)
+{
+    if(suppressed) return JANK_TO_FRONT;
+    if(no_buffer) return JANK_NO_BUFFER;
+    if(callback_wait_ns > vsync.get_period() / 2) return JANK_FRAME_CALLBACK;
+    // android delivered before the refresh it was meant for
+    if(first_post_ns != 0 && first_post_ns <= last_commit_ns + expected_ns) return JANK_QUEUE;
+    return JANK_PRODUCER;
+}
+
+void jank_detector_t::add_commit(const string &package, int64_t commit_ns, int64_t callback_wait_ns)
+{
+    jank_summary_t &summary = summaries[package];
+    int64_t period = vsync.get_period();
+    int64_t gap = commit_ns - last_commit_ns;
+
+    summary.frames++;
+
+    // the app before might have animated at a different rate
+    if(package != last_package) cadence_ns = 0;
+
+    // the first frame after a focus change or an idle phase has nothing to be late for
+    if(last_commit_ns != 0 && package == last_package && period > 0 && gap < JANK_IDLE_GAP_NS)
+    {
+        int64_t expected = (cadence_ns + period / 2) / period;
+        int64_t missed;
+
+        if(expected < 1) expected = 1;
+        missed = (gap + period / 2) / period - expected;
+
+        if(missed > 0)
+        {
+            jank_cause cause = classify(expected * period, callback_wait_ns);
+
+            summary.missed += missed;
+            summary.causes[cause] += missed;
+            if(gap > summary.worst_gap_ns) summary.worst_gap_ns = gap;
+            metrics_t::count((metric_counter)(COUNTER_JANK_PRODUCER + cause), missed);
+
+            LOG_D(LOG_RENDERER, "%s missed %lld refreshes (%s), %lldus since the last frame", package.c_str(), (long long)missed, cause_names[cause], (long long)(gap / 1000));
+        }
+    }
+
+    last_commit_ns = commit_ns;
+    last_package = package;
+    first_post_ns = 0;
+    suppressed = false;
+    no_buffer = false;
+}
+
+int jank_detector_t::write_summaries(const char *path)
+{
+    string tmp = string(path) + ".tmp";
+    FILE *f;
+
+    f = fopen(tmp.c_str(), "w");
+    if(!f)
+    {
+        cerr << "failed to open " << tmp << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    fprintf(f, "# package frames missed worst_gap_us");
+    for(int i=0;i<JANK_CAUSE_COUNT;i++) fprintf(f, " %s", cause_names[i]);
+    fprintf(f, "\n");
+
+    for(map<string, jank_summary_t>::iterator it = summaries.begin();it != summaries.end();it++)
+    {
+        fprintf(f, "%s %llu %llu %lld", it->first.c_str(), (unsigned long long)it->second.frames, (unsigned long long)it->second.missed, (long long)(it->second.worst_gap_ns / 1000));
+        for(int i=0;i<JANK_CAUSE_COUNT;i++) fprintf(f, " %llu", (unsigned long long)it->second.causes[i]);
+        fprintf(f, "\n");
+    }
+
+    // readers never see a half written file
+    if(fclose(f) != 0 || rename(tmp.c_str(), path) != 0)
+    {
+        cerr << "failed to write " << path << ": " << strerror(errno) << endl;
+        unlink(tmp.c_str());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef __JANK_DETECTOR_H__
+#define __JANK_DETECTOR_H__
+
+#include <map>
+#include <string>
+#include <cstdint>
+
+#include "vsync_estimator.h"
+
+// in the order of the COUNTER_JANK_* metrics
+enum jank_cause
+{
+    JANK_PRODUCER = 0,   // android didn't post in time
+    JANK_QUEUE,          // the post was in time, committing it wasn't
+    JANK_FRAME_CALLBACK, // the commit waited for the previous frame callback
+    JANK_TO_FRONT,       // buffers were dropped while an app was brought to front
+    JANK_NO_BUFFER,      // android timed out and the last buffer was shown again
+    JANK_CAUSE_COUNT
+};
+
+struct jank_summary_t
+{
+    jank_summary_t() : frames(0), missed(0), worst_gap_ns(0) { for(int i=0;i<JANK_CAUSE_COUNT;i++) causes[i] = 0; }
+    uint64_t frames;
+    uint64_t missed; // refreshes
+    uint64_t causes[JANK_CAUSE_COUNT];
+    int64_t worst_gap_ns;
+};
+
+// counts refreshes an app should have had a new frame for but didn't.
+// the refreshes an app is expected to take per frame follow its post
+// cadence, so apps rendering at half rate aren't janky. every gap between
+// two commits that is longer than that gets one cause, whatever happened
+// in it that explains it best. only used from the main thread.
+class jank_detector_t {
+    public:
+        jank_detector_t(vsync_estimator_t &v) : vsync(v), cadence_ns(0), last_post_ns(0), first_post_ns(0), last_commit_ns(0), suppressed(false), no_buffer(false) {}
+        // a post reached the main thread, post_ns is when sfconnection got it
+        void add_post(int64_t post_ns);
+        // to_front_still_processing() swallowed a buffer
+        void add_suppressed() { suppressed = true; }
+        void add_no_buffer() { no_buffer = true; }
+        // a new frame of package was committed, callback_wait_ns is how long it
+        // waited for the frame callback of the one before
+        void add_commit(const std::string &package, int64_t commit_ns, int64_t callback_wait_ns);
+
+        const jank_summary_t &get_summary(const std::string &package) { return summaries[package]; }
+        // one line per app, replaces path
+        int write_summaries(const char *path);
+
+    private:
+        jank_cause classify(int64_t expected_ns, int64_t callback_wait_ns);
+
+        vsync_estimator_t &vsync;
+        std::map<std::string, jank_summary_t> summaries;
+
+        int64_t cadence_ns; // average time between posts
+        int64_t last_post_ns;
+        int64_t first_post_ns; // the first post since the last commit
+        int64_t last_commit_ns;
+        std::string last_package;
+        // since the last commit
+        bool suppressed;
+        bool no_buffer;
+};
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <cerrno>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+#include "logger.h"
+#include "utility.h"
+#include "thread_stats.h"
+
+using namespace std;
+
+static const char *category_names[LOG_CATEGORY_COUNT] = { "sfconnection", "renderer", "windowmanager", "uinput", "sensors" };
+static const char *level_names[] = { "none", "error", "warning", "info", "debug" };
+static const char level_letters[] = { '-', 'E', 'W', 'I', 'D' };
+
+int logger_t::levels[LOG_CATEGORY_COUNT];
+logger_t::entry_t logger_t::ring[LOG_RING_SIZE];
+atomic<uint32_t> logger_t::head(0);
+uint32_t logger_t::tail(0);
+atomic<uint32_t> logger_t::dropped(0);
+atomic<int> logger_t::sleeping(0);
+atomic<bool> logger_t::stopping(false);
+int64_t logger_t::start_ns(0);
+int logger_t::fd_wake(-1);
+thread logger_t::my_thread;
+
+static int parse_level(const char *name, size_t length)
+{
+    for(int i=0;i<(int)(sizeof(level_names) / sizeof(level_names[0]));i++)
+    {
+        if(strlen(level_names[i]) == length && strncmp(level_names[i], name, length) == 0) return i;
+    }
+    return -1;
+}
+
+// "level" or "category=level,category=level"
+int logger_t::parse_levels(const char *spec)
+{
+    while(*spec)
+    {
+        const char *end = strchr(spec, ',');
+        if(!end) end = spec + strlen(spec);
+
+        const char *equals = (const char*)memchr(spec, '=', end - spec);
+        if(!equals)
+        {
+            int level = parse_level(spec, end - spec);
+            if(level < 0) return -1;
+            for(int i=0;i<LOG_CATEGORY_COUNT;i++) levels[i] = level;
+        }
+        else
+        {
+            int level = parse_level(equals + 1, end - equals - 1);
+            int category = -1;
+            for(int i=0;i<LOG_CATEGORY_COUNT;i++)
+            {
+                if(strlen(category_names[i]) == (size_t)(equals - spec) && strncmp(category_names[i], spec, equals - spec) == 0) category = i;
+            }
+            if(level < 0 || category < 0) return -1;
+            levels[category] = level;
+        }
+
+        spec = *end ? end + 1 : end;
+    }
+
+    return 0;
+}
+
+int logger_t::init()
+{
+    int err = 0;
+    const char *env = getenv("SFDROID_LOG");
+
+    for(uint32_t i=0;i<LOG_RING_SIZE;i++) ring[i].sequence.store(i, memory_order_relaxed);
+    head.store(0);
+    tail = 0;
+    dropped.store(0);
+    sleeping.store(0);
+    stopping.store(false);
+    start_ns = monotonic_ns();
+
+#if DEBUG
+    for(int i=0;i<LOG_CATEGORY_COUNT;i++) levels[i] = LOG_LEVEL_DEBUG;
+#else
+    for(int i=0;i<LOG_CATEGORY_COUNT;i++) levels[i] = LOG_LEVEL_WARNING;
+#endif
+
+    if(env && parse_levels(env) != 0)
+    {
+        cerr << "invalid SFDROID_LOG: " << env << endl;
+    }
+
+    fd_wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(fd_wake < 0)
+    {
+        cerr << "failed to create eventfd: " << strerror(errno) << endl;
+        err = 1;
+        goto quit;
+    }
+
+    my_thread = thread(thread_loop);
+
+quit:
+    if(err != 0)
+    {
+        for(int i=0;i<LOG_CATEGORY_COUNT;i++) levels[i] = LOG_LEVEL_NONE;
+    }
+    return err;
+}
+
+void logger_t::deinit()
+{
+    uint64_t one = 1;
+
+    if(fd_wake < 0) return;
+
+    for(int i=0;i<LOG_CATEGORY_COUNT;i++) levels[i] = LOG_LEVEL_NONE;
+
+    stopping.store(true);
+    if(::write(fd_wake, &one, sizeof(one)) < 0) {}
+    my_thread.join();
+
+    close(fd_wake);
+    fd_wake = -1;
+}
+
+void logger_t::write(log_category category, log_level level, const char *format, ...)
+{
+    static thread_local int32_t tid = syscall(SYS_gettid);
+    uint32_t position = head.load(memory_order_relaxed);
+    entry_t *entry;
+    va_list args;
+
+    // claim a slot, several threads log at the same time
+    for(;;)
+    {
+        entry = &ring[position % LOG_RING_SIZE];
+        int32_t diff = (int32_t)(entry->sequence.load(memory_order_acquire) - position);
+
+        if(diff == 0)
+        {
+            if(head.compare_exchange_weak(position, position + 1, memory_order_relaxed)) break;
+        }
+        else if(diff < 0)
+        {
+            // the logger thread didn't get to this slot yet
+            dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            position = head.load(memory_order_relaxed);
+        }
+    }
+
+    entry->category = category;
+    entry->level = level;
+    entry->tid = tid;
+    entry->timestamp_ns = monotonic_ns();
+
+    va_start(args, format);
+    vsnprintf(entry->message, sizeof(entry->message), format, args);
+    va_end(args);
+
+    entry->sequence.store(position + 1, memory_order_release);
+
+    // pairs with the store to sleeping and the ring check in thread_loop
+    atomic_thread_fence(memory_order_seq_cst);
+    if(sleeping.load(memory_order_relaxed) && sleeping.exchange(0))
+    {
+        uint64_t one = 1;
+        if(::write(fd_wake, &one, sizeof(one)) < 0) {}
+    }
+}
+
+void logger_t::drain()
+{
+    char buffer[16384];
+    int length = 0;
+    uint32_t lost;
+
+    for(;;)
+    {
+        entry_t &entry = ring[tail % LOG_RING_SIZE];
+        if(entry.sequence.load(memory_order_acquire) != tail + 1) break;
+
+        // worst case prefix is about 60 characters
+        if(length + LOG_MAX_MESSAGE_LENGTH + 64 > (int)sizeof(buffer))
+        {
+            if(::write(STDOUT_FILENO, buffer, length) < 0) {}
+            length = 0;
+        }
+
+        int64_t ms = (entry.timestamp_ns - start_ns) / 1000000LL;
+        length += snprintf(buffer + length, sizeof(buffer) - length, "%6lld.%03lld %c %s[%d]: %s\n",
+            (long long)(ms / 1000), (long long)(ms % 1000), level_letters[entry.level],
+            category_names[entry.category], entry.tid, entry.message);
+
+        // hand the slot back to the writers
+        entry.sequence.store(tail + LOG_RING_SIZE, memory_order_release);
+        tail++;
+    }
+
+    lost = dropped.exchange(0, memory_order_relaxed);
+    if(lost > 0)
+    {
+        length += snprintf(buffer + length, sizeof(buffer) - length, "%u log messages dropped\n", lost);
+    }
+
+    if(length > 0 && ::write(STDOUT_FILENO, buffer, length) < 0) {}
+}
+
+void logger_t::thread_loop()
+{
+    struct pollfd pfd;
+    uint64_t count;
+
+    thread_stats_t::register_thread(THREAD_LOGGER, "sfd-logger");
+
+    pfd.fd = fd_wake;
+    pfd.events = POLLIN;
+
+    while(!stopping.load())
+    {
+        drain();
+
+        sleeping.store(1);
+        if(ring[tail % LOG_RING_SIZE].sequence.load() != tail + 1)
+        {
+            // idle, the next message wakes us
+            while(sleeping.load() && !stopping.load())
+            {
+                if(poll(&pfd, 1, -1) < 0 && errno != EINTR) break;
+                if(read(fd_wake, &count, sizeof(count)) < 0) {}
+            }
+        }
+        sleeping.store(0);
+
+        // let the rest of the burst gather, deinit interrupts this
+        if(!stopping.load() && poll(&pfd, 1, LOG_FLUSH_INTERVAL_MS) > 0 && !stopping.load())
+        {
+            // a writer that raced with the ring check above
+            if(read(fd_wake, &count, sizeof(count)) < 0) {}
+        }
+    }
+
+    drain();
+    thread_stats_t::unregister_thread(THREAD_LOGGER);
+}
@@ -0,0 +1,87 @@
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#include <atomic>
+#include <thread>
+#include <cstdint>
+
+#include "sfdroid_defs.h"
+
+enum log_category
+{
+    LOG_SFCONNECTION = 0,
+    LOG_RENDERER,
+    LOG_WINDOWMANAGER,
+    LOG_UINPUT,
+    LOG_SENSORS,
+    LOG_CATEGORY_COUNT
+};
+
+enum log_level
+{
+    LOG_LEVEL_NONE = 0,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+};
+
+// runtime levelled logging for the frame, input and sensor paths.
+// the calling thread only formats the message into a slot of a lock free
+// ring, a background thread adds the prefix and writes them out in batches
+// LOG_FLUSH_INTERVAL_MS after the first one arrived. nothing blocks, only the
+// first message of a batch wakes the thread, when the ring is full messages
+// are counted and dropped.
+//
+// SFDROID_LOG=debug sets every category, SFDROID_LOG=renderer=debug,sensors=info
+// single ones. levels are error, warning, info, debug and none.
+class logger_t
+{
+    public:
+        static int init();
+        static void deinit();
+
+        static bool enabled(log_category category, log_level level)
+        {
+            return level <= levels[category];
+        }
+
+        static void write(log_category category, log_level level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+    private:
+        struct entry_t
+        {
+            std::atomic<uint32_t> sequence; // == position + 1 once written
+            uint8_t category;
+            uint8_t level;
+            int32_t tid;
+            int64_t timestamp_ns;
+            char message[LOG_MAX_MESSAGE_LENGTH];
+        };
+
+        static int parse_levels(const char *spec);
+        static void thread_loop();
+        static void drain();
+
+        // only written by init/deinit, before and after the other threads run
+        static int levels[LOG_CATEGORY_COUNT];
+
+        static entry_t ring[LOG_RING_SIZE];
+        static std::atomic<uint32_t> head;
+        static uint32_t tail; // only touched by the logger thread
+        static std::atomic<uint32_t> dropped;
+        static std::atomic<int> sleeping; // the logger thread waits for fd_wake
+        static std::atomic<bool> stopping;
+
+        static int64_t start_ns;
+        static int fd_wake;
+        static std::thread my_thread;
+};
+
+#define LOG(category, level, ...) do { if(__builtin_expect(logger_t::enabled(category, level), 0)) logger_t::write(category, level, __VA_ARGS__); } while(0)
+#define LOG_E(category, ...) LOG(category, LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_W(category, ...) LOG(category, LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_I(category, ...) LOG(category, LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_D(category, ...) LOG(category, LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#endif
@@ -30,12 +30,17 @@
 #include <math.h>
 #include <stdio.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "sfconnection.h"
 #include "sensorconnection.h"
 #include "wayland_helper.h"
 #include "windowmanager.h"
 #include "utility.h"
+#include "metrics.h"
+#include "trace.h"
+#include "logger.h"
+#include "thread_stats.h"
 
 using namespace std;
 
@@ -49,6 +54,22 @@ void usage(const char *name)
 {
     cout << name << " [--multiwindow|-m]" << endl;
     cout << "\t--multiwindow|-m android apps get their own windows" << endl;
+    cout << "environment:" << endl;
+    cout << "\tSFDROID_SENSORS=sensorfw|iio where accelerometer samples come from (default sensorfw)" << endl;
+    cout << "\tSFDROID_IIO_SYSFS_ROOT, SFDROID_IIO_DEV_ROOT override " << IIO_SYSFS_ROOT << " and " << IIO_DEV_ROOT << endl;
+    cout << "\tSFDROID_EXPLICIT_SYNC=1 pass fences to the compositor instead of waiting for them here, it has to accept them for android_wlegl buffers" << endl;
+    cout << "\tSFDROID_LATE_LATCH=0 commit frames right away instead of right before the compositor's deadline" << endl;
+    cout << "\tSFDROID_PRESENT=wlegl|null|file where frames go: the compositor (default), nowhere, or metadata records in SFDROID_PRESENT_FILE (default " << FRAMES_FILE << ")" << endl;
+    cout << "\tSFDROID_PRESENT_PIXELS=1 with SFDROID_PRESENT=file, also record the pixels" << endl;
+    cout << "\tSFDROID_RECORD=<file> record what the sharebuffer module sends, replay it with sfdroid_replay" << endl;
+    cout << "\tSFDROID_RECORD_SNAPSHOTS=1 with SFDROID_RECORD, also record downscaled buffer contents" << endl;
+    cout << "\tSFDROID_GRALLOC=memfd use memfd buffers (sfdroid_producer) instead of the gralloc HAL" << endl;
+    cout << "\tSFDROID_INPUT_TRACE=<file> record wayland input events, replay them with sfdroid_input_replay" << endl;
+    cout << "\tSFDROID_UINPUT=<file> write input events to a file instead of /dev/uinput" << endl;
+    cout << "\tSFDROID_LOG=<level> or <category>=<level>,... log at runtime, levels: none error warning info debug, categories: sfconnection renderer windowmanager uinput sensors" << endl;
+    cout << "\tSFDROID_TRACE=1 write atrace markers to " << TRACE_MARKER_FILE << endl;
+    cout << "statistics are kept in " << METRICS_FILE << ", read them with sfdroid_stats" << endl;
+    cout << "missed refreshes per app are written to " << JANK_FILE << " when sfdroid exits" << endl;
 }
 
 bool running = true;
@@ -67,8 +88,7 @@ int main(int argc, char *argv[])
     windowmanager_t windowmanager;
     sensorconnection_t sensorconnection;
 
-    struct timeval current_time, old_time;
-    int frames = 0, failed_frames = 0, dummy_frames = 0, failed_dummy_frames = 0;
+    int64_t commit_deadline;
 
     signal(SIGINT, sigint_handler);
 
@@ -100,7 +120,19 @@ int main(int argc, char *argv[])
     mkdir(SFDROID_ROOT, 0770);
     unlink(AM_START_STILL_RUNNING_FILE);
 
-    if(wayland_helper::init(windowmanager) != 0)
+    // not fatal, the counters just aren't visible then
+    metrics_t::init();
+    trace_t::init();
+    logger_t::init();
+    thread_stats_t::register_thread(THREAD_MAIN, "sfdroid");
+
+    if(renderer_t::select_backend() != 0)
+    {
+        err = 9;
+        goto quit;
+    }
+
+    if(wayland_helper::init(windowmanager, !renderer_t::is_headless()) != 0)
     {
         err = 1;
         goto quit;
@@ -133,86 +165,30 @@ int main(int argc, char *argv[])
         windowmanager.handle_layer_name_event((char*)"com.android.systemui");
     }
 
-    gettimeofday(&old_time, NULL);
-
     while(running)
     {
         wayland_helper::dispatch();
 
         sfdroid_events_mutex.lock();
-        if(sfdroid_events.size() > 0)
+        if(windowmanager.handle_sfdroid_events(multiwindow))
         {
-            for(vector<sfdroid_event>::size_type i = 0;i < sfdroid_events.size();i++)
-            {
-                switch(sfdroid_events[i].type)
-                {
-                    case LAST_WINDOW_CLOSED:
-                        printf("last window closed\n");
-                        sfdroid_events_mutex.unlock();
-                        err = 0;
-                        goto quit;
-                        break;
-                    case LAYER_NAME:
-                        if(multiwindow) windowmanager.handle_layer_name_event(sfdroid_events[i].data.layer_name);
-                        break;
-                    case LAYER_CLOSE:
-                        if(multiwindow) windowmanager.handle_layer_close_event(sfdroid_events[i].data.layer_name);
-                        break;
-                    case BUFFER:
-                        if(!to_front_still_processing())
-                        {
-                            if(!windowmanager.handle_buffer_event(sfdroid_events[i].data.buffer.buffer, *sfdroid_events[i].data.buffer.info))
-                            {
-                                sfconnection.notify_buffer_done(0);
-                                failed_frames++;
-                                break;
-                            }
-                            frames++;
-                        }
-                        else failed_frames++;
-                        sfconnection.notify_buffer_done(0);
-                        break;
-                    case NO_BUFFER:
-                        if(!to_front_still_processing())
-                        {
-                            if(!windowmanager.handle_no_buffer_event(sfdroid_events[i].data.buffer.buffer, *sfdroid_events[i].data.buffer.info))
-                            {
-                                failed_dummy_frames++;
-                                sfconnection.notify_buffer_done(0);
-                                break;
-                            }
-                            dummy_frames++;
-                        }
-                        else
-                        {
-                            failed_dummy_frames++;
-                        }
-                        sfconnection.notify_buffer_done(0);
-                        break;
-                }
-            }
-
-            sfdroid_events.clear();
+            printf("last window closed\n");
+            sfdroid_events_mutex.unlock();
+            err = 0;
+            goto quit;
         }
+
+        // held frames go out right before the compositor's deadline. still
+        // under the events mutex, their buffers could be replaced otherwise
+        commit_deadline = windowmanager.commit_due_frames(monotonic_ns());
         sfdroid_events_mutex.unlock();
+        thread_stats_t::sample(monotonic_ns());
 
-#if DEBUG
-        cout << "waiting for event" << endl;
-#endif
+        LOG_D(LOG_WINDOWMANAGER, "waiting for event");
         if(sfconnection.have_focus())
         {
-            sfconnection.wait_for_event(DUMMY_RENDER_TIMEOUT_MS);
-            gettimeofday(&current_time, NULL);
-            if(current_time.tv_sec > old_time.tv_sec)
-            {
-                cout << "frames: " << frames << endl;
-                cout << "failed(ignored) frames: " << failed_frames << endl;
-                cout << "dummy frames: " << dummy_frames << endl;
-                cout << "failed(ignored) dummy frames: " << failed_dummy_frames << endl;
-                cout << endl;
-                old_time = current_time;
-                frames = failed_frames = dummy_frames = failed_dummy_frames = 0;
-            }
+            if(commit_deadline) sfconnection.wait_for_event_ns(commit_deadline - monotonic_ns());
+            else sfconnection.wait_for_event(DUMMY_RENDER_TIMEOUT_MS);
         }
         else
         {
@@ -228,6 +204,10 @@ quit:
     sfconnection.deinit();
     windowmanager.deinit();
     wayland_helper::deinit();
+    thread_stats_t::unregister_thread(THREAD_MAIN);
+    metrics_t::deinit();
+    trace_t::deinit();
+    logger_t::deinit();
     rmdir(SFDROID_ROOT);
     return err;
 }
@@ -0,0 +1,150 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memfd_gralloc.h"
+#include "memfd_handle.h"
+
+using namespace std;
+
+struct mapping_t
+{
+    void *addr;
+    size_t size;
+    int locks;
+};
+
+// registerBuffer runs on the sfconnection thread, lock on the main thread
+static mutex mappings_mutex;
+static map<buffer_handle_t, mapping_t> mappings;
+static gralloc_module_t module;
+
+static const struct memfd_handle_ints_t *handle_ints(buffer_handle_t handle)
+{
+    if(handle->numFds != MEMFD_HANDLE_NUM_FDS || handle->numInts < MEMFD_HANDLE_NUM_INTS) return NULL;
+
+    const struct memfd_handle_ints_t *ints = (const struct memfd_handle_ints_t*)(handle->data + handle->numFds);
+    if(ints->magic != MEMFD_HANDLE_MAGIC) return NULL;
+
+    return ints;
+}
+
+static int memfd_register_buffer(gralloc_module_t const *module, buffer_handle_t handle)
+{
+    unique_lock<mutex> lock(mappings_mutex);
+    const struct memfd_handle_ints_t *ints = handle_ints(handle);
+    struct stat st;
+    mapping_t mapping;
+
+    if(!ints)
+    {
+        cerr << "memfd gralloc: not a memfd handle" << endl;
+        return -EINVAL;
+    }
+
+    if(mappings.find(handle) != mappings.end()) return -EINVAL;
+
+    if(fstat(handle->data[0], &st) < 0 || (size_t)st.st_size < ints->size)
+    {
+        cerr << "memfd gralloc: memfd is smaller than " << ints->size << " bytes" << endl;
+        return -EINVAL;
+    }
+
+    mapping.size = ints->size;
+    mapping.locks = 0;
+    mapping.addr = mmap(NULL, mapping.size, PROT_READ | PROT_WRITE, MAP_SHARED, handle->data[0], 0);
+    if(mapping.addr == MAP_FAILED)
+    {
+        cerr << "memfd gralloc: failed to map buffer: " << strerror(errno) << endl;
+        return -errno;
+    }
+
+    mappings[handle] = mapping;
+    return 0;
+}
+
+static int memfd_unregister_buffer(gralloc_module_t const *module, buffer_handle_t handle)
+{
+    unique_lock<mutex> lock(mappings_mutex);
+    map<buffer_handle_t, mapping_t>::iterator it = mappings.find(handle);
+
+    if(it == mappings.end()) return -EINVAL;
+
+    if(it->second.locks != 0) cerr << "memfd gralloc: unregistering a locked buffer" << endl;
+
+    munmap(it->second.addr, it->second.size);
+    mappings.erase(it);
+    return 0;
+}
+
+static int memfd_lock(gralloc_module_t const *module, buffer_handle_t handle, int usage, int l, int t, int w, int h, void **vaddr)
+{
+    unique_lock<mutex> lock(mappings_mutex);
+    map<buffer_handle_t, mapping_t>::iterator it = mappings.find(handle);
+
+    if(it == mappings.end()) return -EINVAL;
+
+    // like gralloc the address is the start of the buffer, not of the rectangle
+    it->second.locks++;
+    *vaddr = it->second.addr;
+    return 0;
+}
+
+static int memfd_unlock(gralloc_module_t const *module, buffer_handle_t handle)
+{
+    unique_lock<mutex> lock(mappings_mutex);
+    map<buffer_handle_t, mapping_t>::iterator it = mappings.find(handle);
+
+    if(it == mappings.end() || it->second.locks == 0) return -EINVAL;
+
+    it->second.locks--;
+    return 0;
+}
+
+size_t memfd_gralloc_buffer_size(buffer_handle_t handle)
+{
+    const struct memfd_handle_ints_t *ints = handle_ints(handle);
+
+    return ints ? ints->size : 0;
+}
+
+gralloc_module_t *memfd_gralloc_open()
+{
+    memset(&module, 0, sizeof(module));
+    module.common.tag = HARDWARE_MODULE_TAG;
+    module.common.id = GRALLOC_HARDWARE_MODULE_ID;
+    module.common.name = "sfdroid memfd gralloc";
+    module.common.author = "sfdroid";
+    module.registerBuffer = memfd_register_buffer;
+    module.unregisterBuffer = memfd_unregister_buffer;
+    module.lock = memfd_lock;
+    module.unlock = memfd_unlock;
+
+    return &module;
+}
@@ -0,0 +1,14 @@
+#ifndef __MEMFD_GRALLOC_H__
+#define __MEMFD_GRALLOC_H__
+
+#include <hardware/gralloc.h>
+
+// software stand in for the gralloc HAL, chosen with SFDROID_GRALLOC=memfd.
+// it only knows memfd handles (see memfd_handle.h): registerBuffer maps the
+// memfd, lock hands out that mapping and unregisterBuffer unmaps it. lets
+// the buffer pipeline run with tools/sfdroid_producer on any linux machine.
+gralloc_module_t *memfd_gralloc_open();
+// the size a memfd handle declares, 0 if it isn't one
+size_t memfd_gralloc_buffer_size(buffer_handle_t handle);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __MEMFD_HANDLE_H__
+#define __MEMFD_HANDLE_H__
+
+// native handle layout of buffers that are plain memfds instead of
+// gralloc allocations: one fd and MEMFD_HANDLE_NUM_INTS ints. sent by
+// tools/sfdroid_producer, which has no android to allocate buffers, and
+// understood by the memfd gralloc (memfd_gralloc.h).
+
+#include <stdint.h>
+
+#define MEMFD_HANDLE_MAGIC 0x4d464442
+#define MEMFD_HANDLE_NUM_FDS 1
+#define MEMFD_HANDLE_NUM_INTS 4
+
+struct memfd_handle_ints_t
+{
+    int32_t magic;
+    uint32_t size; // of the memfd in bytes
+    uint32_t bytes_per_pixel;
+    uint32_t reserved;
+};
+
+#endif
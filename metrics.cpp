@@ -0,0 +1,167 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "sfdroid_defs.h"
+#include "utility.h"
+
+using namespace std;
+
+static const char *counter_names[NUM_COUNTERS] = {
+    "frames",
+    "failed_frames",
+    "dummy_frames",
+    "failed_dummy_frames",
+    "deadline_hits",
+    "deadline_misses",
+    "touch_events",
+    "sensor_requests",
+    "jank_producer",
+    "jank_queue",
+    "jank_frame_callback",
+    "jank_to_front",
+    "jank_no_buffer",
+    "cpu_us_main",
+    "cpu_us_sfconnection",
+    "cpu_us_sensors",
+    "cpu_us_logger",
+    "syscalls_socket",
+    "syscalls_ring",
+    "syscalls_uinput",
+    "syscalls_wayland",
+    "buffer_registrations",
+    "buffer_unregistrations",
+    "buffer_locks",
+};
+
+static const char *gauge_names[NUM_GAUGES] = {
+    "commit_margin_us",
+    "vsync_period_us",
+};
+
+static const char *histogram_names[NUM_HISTOGRAMS] = {
+    "post_to_dequeue",
+    "dequeue_to_commit",
+    "commit_to_frame_callback",
+    "ack_round_trip",
+    "touch_to_uinput",
+    "sensor_request",
+};
+
+// used until the file is mapped
+static uint64_t fallback_counters[NUM_COUNTERS];
+static int64_t fallback_gauges[NUM_GAUGES];
+static struct metrics_histogram_t fallback_histograms[NUM_HISTOGRAMS];
+
+uint64_t *metrics_t::counters(fallback_counters);
+int64_t *metrics_t::gauges(fallback_gauges);
+struct metrics_histogram_t *metrics_t::histograms(fallback_histograms);
+void *metrics_t::map(nullptr);
+size_t metrics_t::map_size(0);
+
+int metrics_t::init()
+{
+    int err = 0;
+    int fd = -1;
+    char *p;
+    struct metrics_header_t *header;
+
+    map_size = sizeof(struct metrics_header_t)
+        + (NUM_COUNTERS + NUM_GAUGES + NUM_HISTOGRAMS) * METRICS_NAME_LENGTH
+        + NUM_COUNTERS * sizeof(uint64_t)
+        + NUM_GAUGES * sizeof(int64_t)
+        + NUM_HISTOGRAMS * sizeof(struct metrics_histogram_t);
+
+    fd = open(METRICS_FILE, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        cerr << "failed to create " << METRICS_FILE << ": " << strerror(errno) << endl;
+        err = 1;
+        goto quit;
+    }
+
+    if(ftruncate(fd, map_size) < 0)
+    {
+        cerr << "failed to resize " << METRICS_FILE << ": " << strerror(errno) << endl;
+        err = 2;
+        goto quit;
+    }
+
+    map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        cerr << "failed to map " << METRICS_FILE << ": " << strerror(errno) << endl;
+        map = nullptr;
+        err = 3;
+        goto quit;
+    }
+
+    header = (struct metrics_header_t*)map;
+    header->version = METRICS_VERSION;
+    header->num_counters = NUM_COUNTERS;
+    header->num_gauges = NUM_GAUGES;
+    header->num_histograms = NUM_HISTOGRAMS;
+    header->start_ns = monotonic_ns();
+
+    p = (char*)map + sizeof(struct metrics_header_t);
+    for(int i = 0;i < NUM_COUNTERS;i++, p += METRICS_NAME_LENGTH) strncpy(p, counter_names[i], METRICS_NAME_LENGTH - 1);
+    for(int i = 0;i < NUM_GAUGES;i++, p += METRICS_NAME_LENGTH) strncpy(p, gauge_names[i], METRICS_NAME_LENGTH - 1);
+    for(int i = 0;i < NUM_HISTOGRAMS;i++, p += METRICS_NAME_LENGTH) strncpy(p, histogram_names[i], METRICS_NAME_LENGTH - 1);
+
+    // whatever was counted before the file existed is kept
+    memcpy(p, fallback_counters, sizeof(fallback_counters));
+    counters = (uint64_t*)p;
+    p += NUM_COUNTERS * sizeof(uint64_t);
+    memcpy(p, fallback_gauges, sizeof(fallback_gauges));
+    gauges = (int64_t*)p;
+    p += NUM_GAUGES * sizeof(int64_t);
+    memcpy(p, fallback_histograms, sizeof(fallback_histograms));
+    histograms = (struct metrics_histogram_t*)p;
+
+    // readers check the magic last
+    __atomic_store_n(&header->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+
+quit:
+    if(fd >= 0) close(fd);
+    return err;
+}
+
+void metrics_t::deinit()
+{
+    if(!map) return;
+
+    counters = fallback_counters;
+    gauges = fallback_gauges;
+    histograms = fallback_histograms;
+
+    munmap(map, map_size);
+    map = nullptr;
+    unlink(METRICS_FILE);
+}
@@ -0,0 +1,98 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <cstdint>
+#include <cstddef>
+
+#include "metrics_file.h"
+
+enum metric_counter
+{
+    COUNTER_FRAMES = 0,
+    COUNTER_FAILED_FRAMES,
+    COUNTER_DUMMY_FRAMES,
+    COUNTER_FAILED_DUMMY_FRAMES,
+    COUNTER_DEADLINE_HITS,
+    COUNTER_DEADLINE_MISSES,
+    COUNTER_TOUCH_EVENTS,
+    COUNTER_SENSOR_REQUESTS,
+    // missed refreshes by jank_cause
+    COUNTER_JANK_PRODUCER,
+    COUNTER_JANK_QUEUE,
+    COUNTER_JANK_FRAME_CALLBACK,
+    COUNTER_JANK_TO_FRONT,
+    COUNTER_JANK_NO_BUFFER,
+    // cpu time by sfdroid_thread
+    COUNTER_CPU_US_MAIN,
+    COUNTER_CPU_US_SFCONNECTION,
+    COUNTER_CPU_US_SENSORS,
+    COUNTER_CPU_US_LOGGER,
+    // calls that enter the kernel, ring is the doorbells and waiting for them
+    COUNTER_SYSCALLS_SOCKET,
+    COUNTER_SYSCALLS_RING,
+    COUNTER_SYSCALLS_UINPUT,
+    COUNTER_SYSCALLS_WAYLAND,
+    COUNTER_BUFFER_REGISTRATIONS,
+    COUNTER_BUFFER_UNREGISTRATIONS,
+    COUNTER_BUFFER_LOCKS,
+    NUM_COUNTERS
+};
+
+enum metric_gauge
+{
+    GAUGE_COMMIT_MARGIN_US = 0,
+    GAUGE_VSYNC_PERIOD_US,
+    NUM_GAUGES
+};
+
+enum metric_histogram
+{
+    HISTOGRAM_POST_TO_DEQUEUE = 0,
+    HISTOGRAM_DEQUEUE_TO_COMMIT,
+    HISTOGRAM_COMMIT_TO_FRAME_CALLBACK,
+    HISTOGRAM_ACK_ROUND_TRIP,
+    HISTOGRAM_TOUCH_TO_UINPUT,
+    HISTOGRAM_SENSOR_REQUEST,
+    NUM_HISTOGRAMS
+};
+
+// counters, gauges and latency histograms in a file other processes can
+// map (see metrics_file.h). safe to use from every thread, before init()
+// and if init() failed they go to memory nobody reads.
+class metrics_t {
+    public:
+        static int init();
+        static void deinit();
+
+        static void count(metric_counter counter, uint64_t n = 1)
+        {
+            __atomic_fetch_add(&counters[counter], n, __ATOMIC_RELAXED);
+        }
+
+        static void set(metric_gauge gauge, int64_t value)
+        {
+            __atomic_store_n(&gauges[gauge], value, __ATOMIC_RELAXED);
+        }
+
+        static void record(metric_histogram histogram, int64_t ns)
+        {
+            struct metrics_histogram_t *h = &histograms[histogram];
+            uint64_t us = (ns > 0) ? (uint64_t)ns / 1000 : 0;
+            uint64_t max = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+
+            __atomic_fetch_add(&h->buckets[metrics_bucket(us)], 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&h->sum_us, us, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+            while(us > max && !__atomic_compare_exchange_n(&h->max_us, &max, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        }
+
+    private:
+        static uint64_t *counters;
+        static int64_t *gauges;
+        static struct metrics_histogram_t *histograms;
+
+        static void *map;
+        static size_t map_size;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef __METRICS_FILE_H__
+#define __METRICS_FILE_H__
+
+// layout of the stats file sfdroid keeps at METRICS_FILE, shared with
+// tools/sfdroid_stats. everything is updated in place with atomics and
+// only ever grows, readers compute rates from two snapshots.
+//
+// histograms are log-linear over microseconds: exact below 16us, then 16
+// buckets per power of two (about 6% resolution) up to 2^32us.
+
+#include <stdint.h>
+
+#define METRICS_MAGIC 0x53464d53
+#define METRICS_VERSION 1
+
+#define METRICS_NAME_LENGTH 32
+#define METRICS_SUB_BUCKET_BITS 4
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+#define METRICS_HISTOGRAM_BUCKETS ((32 - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS)
+
+struct metrics_histogram_t
+{
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+    uint64_t buckets[METRICS_HISTOGRAM_BUCKETS];
+};
+
+struct metrics_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_counters;
+    uint32_t num_gauges;
+    uint32_t num_histograms;
+    uint32_t reserved;
+    int64_t start_ns; // CLOCK_MONOTONIC when sfdroid started
+};
+
+// the file is a metrics_header_t followed by
+//   char counter_names[num_counters][METRICS_NAME_LENGTH]
+//   char gauge_names[num_gauges][METRICS_NAME_LENGTH]
+//   char histogram_names[num_histograms][METRICS_NAME_LENGTH]
+//   uint64_t counters[num_counters]
+//   int64_t gauges[num_gauges]
+//   struct metrics_histogram_t histograms[num_histograms]
+// the name tables are multiples of 8 bytes, so everything stays aligned.
+
+static inline unsigned int metrics_bucket(uint64_t us)
+{
+    unsigned int msb;
+
+    if(us < METRICS_SUB_BUCKETS) return (unsigned int)us;
+    if(us > 0xffffffffULL) us = 0xffffffffULL;
+
+    msb = 63 - __builtin_clzll(us);
+    return (msb - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS + ((us >> (msb - METRICS_SUB_BUCKET_BITS)) & (METRICS_SUB_BUCKETS - 1));
+}
+
+// smallest value that lands in bucket
+static inline uint64_t metrics_bucket_start(unsigned int bucket)
+{
+    unsigned int msb;
+
+    if(bucket < METRICS_SUB_BUCKETS) return bucket;
+
+    msb = bucket / METRICS_SUB_BUCKETS + METRICS_SUB_BUCKET_BITS - 1;
+    return (uint64_t)(METRICS_SUB_BUCKETS + bucket % METRICS_SUB_BUCKETS) << (msb - METRICS_SUB_BUCKET_BITS);
+}
+
+#endif
@@ -0,0 +1,53 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "null_backend.h"
+#include "renderer.h"
+
+int null_backend_t::init(renderer_t &r)
+{
+    renderer = &r;
+    shown = nullptr;
+    return 0;
+}
+
+void null_backend_t::deinit()
+{
+    // like destroying the surface, nothing is released anymore
+    shown = nullptr;
+}
+
+int null_backend_t::present(ANativeWindowBuffer *buffer, buffer_info_t &info, int acquire_fence, int64_t target_ns, bool latched, int32_t frame_id)
+{
+    if(shown && shown != buffer) renderer->buffer_released(shown, -1);
+    shown = buffer;
+    return 0;
+}
+
+void null_backend_t::forget_buffers(ANativeWindowBuffer *s)
+{
+    // its slot is gone, there is nobody to release it to
+    shown = nullptr;
+}
+
+void null_backend_t::forget_buffer(ANativeWindowBuffer *buffer, bool is_shown)
+{
+    if(shown == buffer) shown = nullptr;
+}
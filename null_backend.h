@@ -0,0 +1,32 @@
+#ifndef __NULL_BACKEND_H__
+#define __NULL_BACKEND_H__
+
+#include "presentbackend.h"
+
+// shows nothing, every frame is done right away. keeps the last buffer like
+// a display would, so releases still come one frame late.
+class null_backend_t : public presentbackend_t {
+    public:
+        null_backend_t() : renderer(nullptr), shown(nullptr) {}
+        const char *name() { return "null"; }
+        int init(renderer_t &renderer);
+        void deinit();
+        int wait_frame() { return 0; }
+        int present(ANativeWindowBuffer *buffer, buffer_info_t &info, int acquire_fence, int64_t target_ns, bool latched, int32_t frame_id);
+        bool immediate() { return true; }
+        void forget_buffers(ANativeWindowBuffer *shown);
+        void forget_buffer(ANativeWindowBuffer *buffer, bool shown);
+        void gained_focus() {}
+        void lost_focus() {}
+        int draw_raw(void *data, int width, int height, int pixel_format) { return 0; }
+        // never dereferenced, it only tells windows apart for focus events
+        struct wl_surface *get_surface() { return (struct wl_surface*)this; }
+        size_t wayland_objects() { return 0; }
+
+    protected:
+        renderer_t *renderer;
+        ANativeWindowBuffer *shown;
+};
+
+#endif
+
@@ -0,0 +1,43 @@
+#ifndef __PRESENT_BACKEND_H__
+#define __PRESENT_BACKEND_H__
+
+#include <system/window.h>
+
+#include "sfdroid_defs.h"
+
+class renderer_t;
+struct wl_surface;
+
+// where renderer_t shows the frames of one window.
+// all methods are called from the main thread.
+class presentbackend_t {
+    public:
+        virtual ~presentbackend_t() {}
+        virtual const char *name() = 0;
+        // creates the window, may be called again after deinit()
+        virtual int init(renderer_t &renderer) = 0;
+        virtual void deinit() = 0;
+        // blocks until the previous frame may be replaced, non zero if the backend is gone
+        virtual int wait_frame() = 0;
+        // acquire_fence is not taken over. target_ns is the vsync the frame is
+        // meant for or 0, latched if it was held back for it
+        virtual int present(ANativeWindowBuffer *buffer, buffer_info_t &info, int acquire_fence, int64_t target_ns, bool latched, int32_t frame_id) = 0;
+        // true if frames are done as soon as present() returned, otherwise
+        // the backend calls renderer_t::frame_done() later
+        virtual bool immediate() = 0;
+        // the handles are about to go away, shown is still on screen (nullptr if none)
+        virtual void forget_buffers(ANativeWindowBuffer *shown) = 0;
+        // like forget_buffers() for one buffer, shown if it is still on screen
+        virtual void forget_buffer(ANativeWindowBuffer *buffer, bool shown) = 0;
+        virtual void gained_focus() = 0;
+        virtual void lost_focus() = 0;
+        // shows a copy of the last frame while android switches apps
+        virtual int draw_raw(void *data, int width, int height, int pixel_format) = 0;
+        // matches input and close events to windows, nullptr without a wayland surface
+        virtual struct wl_surface *get_surface() = 0;
+        // wayland objects the window holds right now, 0 without a compositor
+        virtual size_t wayland_objects() = 0;
+};
+
+#endif
+
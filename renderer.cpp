@@ -19,257 +19,79 @@
  */
 
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
 
-#include <GLES/gl.h>
-#include <wayland-egl.h>
-
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <sys/mman.h>
-
-#include "wayland-android-client-protocol.h"
+#include <unistd.h>
 
 #include "renderer.h"
-#include "wayland_helper.h"
+#include "wlegl_backend.h"
+#include "null_backend.h"
+#include "file_backend.h"
 #include "sfconnection.h"
+#include "utility.h"
+#include "metrics.h"
+#include "trace.h"
+#include "logger.h"
 
 using namespace std;
 
-#define QT_SURFACE_EXTENSION_GET_EXTENDED_SURFACE 0
-
 int renderer_t::instances(0);
+present_backend_type renderer_t::backend_type(PRESENT_WLEGL);
 
-int renderer_t::init(windowmanager_t &wm)
+int renderer_t::select_backend()
 {
-    int err = 0;
-
-    frame_callback_ptr = 0;
-
-    GLint configAttribs[] = {
-        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
-        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES_BIT,
-        EGL_NONE
-    };
-    EGLConfig egl_cfg;
-    EGLint contextParams[] = {EGL_CONTEXT_CLIENT_VERSION, 1, EGL_NONE};
-    EGLint numConfigs;
-
-    windowmanager = &wm;
-
-#if DEBUG
-    cout << "choosing egl config" << endl;
-#endif
-    if(eglChooseConfig(wayland_helper::egl_display, configAttribs, &egl_cfg, 1, &numConfigs) != EGL_TRUE || numConfigs != 1)
-    {
-        cerr << "unable to find an EGL Config" << endl;
-        err = 7;
-        goto quit;
-    }
-
-#if DEBUG
-    cout << "creating GLES context" << endl;
-#endif
-    eglBindAPI(EGL_OPENGL_ES_API);
-    egl_ctx = eglCreateContext(wayland_helper::egl_display, egl_cfg, NULL, contextParams);
-    if(egl_ctx == EGL_NO_CONTEXT)
-    {
-        cerr << "unable to create GLES context" << endl;
-        err = 9;
-        goto quit;
-    }
-
-#if DEBUG
-    cout << "creating surface" << endl;
-#endif
-    w_surface = wl_compositor_create_surface(wayland_helper::compositor);
-
-#if DEBUG
-    cout << "creating shell surface" << endl;
-#endif
-    w_shell_surface = wl_shell_get_shell_surface(wayland_helper::shell, w_surface);
-
-#if DEBUG
-    cout << "getting qt extended surface" << endl;
-#endif
+    const char *backend_name = getenv("SFDROID_PRESENT");
 
-    q_extended_surface = (struct qt_extended_surface*)wl_proxy_create((struct wl_proxy *)wayland_helper::q_surface_extension, &wayland_helper::qt_extended_surface_interface);
-    if(!q_extended_surface)
+    if(!backend_name || strcmp(backend_name, "wlegl") == 0) backend_type = PRESENT_WLEGL;
+    else if(strcmp(backend_name, "null") == 0) backend_type = PRESENT_NULL;
+    else if(strcmp(backend_name, "file") == 0) backend_type = PRESENT_FILE;
+    else
     {
-        err = 17;
-        goto quit;
+        cerr << "unknown presentation backend: " << backend_name << endl;
+        return 1;
     }
 
-    wl_proxy_marshal((struct wl_proxy*)wayland_helper::q_surface_extension, QT_SURFACE_EXTENSION_GET_EXTENDED_SURFACE, q_extended_surface, w_surface);
-
-    wl_proxy_add_listener((struct wl_proxy*)q_extended_surface, (void (**)(void))&extended_surface_listener, this);
-    wayland_helper::roundtrip();
-
-    wl_shell_surface_add_listener(w_shell_surface, &shell_surface_listener, NULL);
-
-    wl_shell_surface_set_toplevel(w_shell_surface);
-
-    struct wl_region *region;
-    region = wl_compositor_create_region(wayland_helper::compositor);
-    wl_region_add(region, 0, 0,
-                  wayland_helper::width,
-                  wayland_helper::height);
-    wl_surface_set_opaque_region(w_surface, region);
-    wl_region_destroy(region);
-
-#if DEBUG
-    cout << "creating wl egl window" << endl;
-#endif
-    w_egl_window = wl_egl_window_create(w_surface, wayland_helper::width, wayland_helper::height);
-    if(w_egl_window == NULL)
-    {
-        cerr << "unable to create an egl window" << endl;
-        err = 16;
-        goto quit;
-    }
+    return 0;
+}
 
-#if DEBUG
-    cout << "creating egl window surface" << endl;
-#endif
-    egl_surf = eglCreateWindowSurface(wayland_helper::egl_display, egl_cfg, (EGLNativeWindowType)w_egl_window, 0);
-    if(egl_surf == EGL_NO_SURFACE)
-    {
-        cerr << "unable to create an EGLSurface" << endl;
-        err = 8;
-        goto quit;
-    }
+int renderer_t::init(windowmanager_t &wm)
+{
+    windowmanager = &wm;
+    last_commit_ns = 0;
+    last_commit_frame_id = 0;
 
-#if DEBUG
-    cout << "making GLES context current" << endl;
-#endif
-    if(eglMakeCurrent(wayland_helper::egl_display, egl_surf, egl_surf, egl_ctx) == EGL_FALSE)
+    if(!backend)
     {
-        cerr << "unable to make GLES context current" << endl;
-        err = 10;
-        goto quit;
+        if(backend_type == PRESENT_NULL) backend = new null_backend_t();
+        else if(backend_type == PRESENT_FILE)
+        {
+            const char *file = getenv("SFDROID_PRESENT_FILE");
+            const char *pixels = getenv("SFDROID_PRESENT_PIXELS");
+            backend = new file_backend_t(file ? file : FRAMES_FILE, pixels && strcmp(pixels, "1") == 0);
+        }
+        else backend = new wlegl_backend_t();
     }
 
 #if DEBUG
-    cout << "setting up gl" << endl;
+    cout << "creating window (" << backend->name() << ")" << endl;
 #endif
-    glViewport(0, 0, wayland_helper::width, wayland_helper::height);
-
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glOrthof(0, wayland_helper::width, wayland_helper::height, 0, 0, 1);
-
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-
-    glEnable(GL_TEXTURE_2D);
-    glColor4f(1.f, 1.f, 1.f, 1.f);
-
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-
-    glGenTextures(1, &dummy_tex);
-    glBindTexture(GL_TEXTURE_2D, dummy_tex);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-#if DEBUG
-    // this might even crash if the patch is missing:
-    cout << "WARNING: if i crash now the patch is missing, look at " << __FILE__ << "@" << __LINE__ << endl;
-    if(glGetString(GL_VERSION) == 0)
-    {
-        cout << "oh no, gles v1 not working, do you have this patch: https://github.com/mer-hybris/android_frameworks_native/pull/3/files ?" << endl;
-        err = 3843;
-        goto quit;
-    }
-#endif
-
-quit:
-    return err;
+    return backend->init(*this);
 }
 
 void renderer_t::deinit()
 {
-    for(map<ANativeWindowBuffer*, struct wl_buffer*>::iterator it = buffer_map.begin();it != buffer_map.end();it++)
-    {
-        wl_buffer_destroy(it->second);
-    }
-    buffer_map.clear();
-
+    drop_pending(true);
     have_focus = false;
-    glDeleteTextures(1, &dummy_tex);
-    eglMakeCurrent(wayland_helper::egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
-    eglDestroySurface(wayland_helper::egl_display, egl_surf);
-    wl_egl_window_destroy(w_egl_window);
-    wl_proxy_destroy((struct wl_proxy *)q_extended_surface);
-    wl_shell_surface_destroy(w_shell_surface);
-    wl_surface_destroy(w_surface);
-    eglDestroyContext(wayland_helper::egl_display, egl_ctx);
+    backend->deinit();
 }
 
 renderer_t::~renderer_t()
 {
+    if(backend) delete backend;
     instances--;
 }
 
-int renderer_t::draw_raw(void *data, int width, int height, int pixel_format)
-{
-#if DEBUG
-    cout << "draw raw: " << width << " " << height << " " << pixel_format << endl;
-#endif
-    int err = 0;
-
-    GLuint gl_err = 0;
-
-    float xf = (float)wayland_helper::width / (float)width;
-    float yf = 1.f;
-    float texcoords[] = {
-        0.f, 0.f,
-        xf, 0.f,
-        0.f, yf,
-        xf, yf,
-    };
-
-    float vtxcoords[] = {
-        0.f, 0.f,
-        (float)wayland_helper::width, 0.f,
-        0.f, (float)wayland_helper::height,
-        (float)wayland_helper::width, (float)wayland_helper::height,
-    };
-
-    glVertexPointer(2, GL_FLOAT, 0, &vtxcoords);
-    glTexCoordPointer(2, GL_FLOAT, 0, &texcoords);
-
-    glBindTexture(GL_TEXTURE_2D, dummy_tex);
-
-    if(pixel_format == HAL_PIXEL_FORMAT_RGBA_8888 || pixel_format == HAL_PIXEL_FORMAT_RGBX_8888)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
-                GL_RGBA, GL_UNSIGNED_BYTE, data);
-    }
-    else if(pixel_format == HAL_PIXEL_FORMAT_RGB_565)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0,
-                GL_RGB, GL_UNSIGNED_SHORT_5_6_5, data);
-    }
-    else
-    {
-        cerr << "unhandled pixel format: " << pixel_format << endl;
-        err = 3;
-        goto quit;
-    }
-    gl_err = glGetError();
-    if(gl_err != GL_NO_ERROR) cerr << "glGetError(): " << gl_err << endl;
-
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-    eglSwapBuffers(wayland_helper::egl_display, egl_surf);
-
-quit:
-    return err;
-}
-
 int renderer_t::save_screen()
 {
     int err = 0;
@@ -286,6 +108,7 @@ int renderer_t::save_screen()
         GRALLOC_USAGE_SW_READ_RARELY,
         0, 0, buffer->width, buffer->height,
         &buffer_vaddr);
+    metrics_t::count(COUNTER_BUFFER_LOCKS);
 
     if(gerr)
     {
@@ -299,12 +122,12 @@ int renderer_t::save_screen()
 
     if(buffer->format == HAL_PIXEL_FORMAT_RGBA_8888 || buffer->format == HAL_PIXEL_FORMAT_RGBX_8888)
     {
-        last_screen = (GLubyte*)malloc(4 * buffer->stride * buffer->height);
+        last_screen = malloc(4 * buffer->stride * buffer->height);
         memcpy(last_screen, buffer_vaddr, 4 * buffer->stride * buffer->height);
     }
     else if(buffer->format == HAL_PIXEL_FORMAT_RGB_565)
     {
-        last_screen = (GLubyte*)malloc(4 * buffer->stride * buffer->height);
+        last_screen = malloc(4 * buffer->stride * buffer->height);
         memcpy(last_screen, buffer_vaddr, 4 * buffer->stride * buffer->height);
     }
     else
@@ -328,7 +151,7 @@ int renderer_t::dummy_draw(int stride, int height, int format)
 
     if(last_screen != nullptr)
     {
-        draw_raw(last_screen, stride, height, format);
+        backend->draw_raw(last_screen, stride, height, format);
         free(last_screen);
         last_screen = nullptr;
     }
@@ -338,22 +161,21 @@ int renderer_t::dummy_draw(int stride, int height, int format)
 
 void renderer_t::lost_focus()
 {
-#if DEBUG
-    cout << "losing focus: " << app << endl;
-#endif
-    if(save_screen() == 0)
+    LOG_D(LOG_RENDERER, "losing focus: %s", app.c_str());
+    drop_pending(true);
+
+    if(buffer && save_screen() == 0)
     {
         dummy_draw(buffer->stride, buffer->height, buffer->format);
     }
 
-    eglMakeCurrent(wayland_helper::egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    backend->lost_focus();
     have_focus = false;
 }
 
 void renderer_t::gained_focus()
 {
-    wl_shell_surface_set_toplevel(w_shell_surface);
-    eglMakeCurrent(wayland_helper::egl_display, egl_surf, egl_surf, egl_ctx);
+    backend->gained_focus();
     have_focus = true;
 }
 
@@ -371,127 +193,153 @@ bool renderer_t::is_active()
     return have_focus;
 }
 
-int renderer_t::render_buffer(ANativeWindowBuffer *the_buffer, buffer_info_t &info)
+int renderer_t::render_buffer(ANativeWindowBuffer *the_buffer, buffer_info_t &info, int acquire_fence, int32_t frame_id)
 {
-#if DEBUG
-    cout << "rendering buffer in: " << app << endl;
-#endif
-    buffer = the_buffer;
+    TRACE_SCOPE("render_buffer");
+    commit_scheduler_t &scheduler = windowmanager->get_scheduler();
+    int64_t now = monotonic_ns();
 
-    if(buffer_map.find(the_buffer) == buffer_map.end())
+    if(!have_focus || !scheduler.is_active())
     {
-        struct wl_buffer *w_buffer;
-        struct wl_array ints;
-        int *the_ints;
-        struct android_wlegl_handle *wlegl_handle;
-
-        wl_array_init(&ints);
-        the_ints = (int*)wl_array_add(&ints, buffer->handle->numInts * sizeof(int));
-        memcpy(the_ints, buffer->handle->data + buffer->handle->numFds, buffer->handle->numInts * sizeof(int));
-        wlegl_handle = android_wlegl_create_handle(wayland_helper::a_android_wlegl, buffer->handle->numFds, &ints);
-        wl_array_release(&ints);
-
-        for (int i = 0; i < buffer->handle->numFds; i++)
-        {
-            android_wlegl_handle_add_fd(wlegl_handle, buffer->handle->data[i]);
-        }
+        return commit_buffer(the_buffer, info, acquire_fence, 0, now, frame_id);
+    }
 
-        w_buffer = android_wlegl_create_buffer(wayland_helper::a_android_wlegl, info.width, info.height, info.stride, info.pixel_format, GRALLOC_USAGE_HW_RENDER, wlegl_handle);
-        android_wlegl_handle_destroy(wlegl_handle);
+    LOG_D(LOG_RENDERER, "holding buffer in: %s", app.c_str());
+    // late latching, only the newest frame before the deadline gets committed
+    if(have_pending) drop_pending(true);
+    else pending.target_ns = scheduler.target_vsync(now);
 
-        wl_buffer_add_listener(w_buffer, &w_buffer_listener, this);
+    pending.buffer = the_buffer;
+    pending.info = info;
+    pending.acquire_fence = (acquire_fence >= 0) ? dup(acquire_fence) : -1;
+    pending.dequeue_ns = now;
+    pending.frame_id = frame_id;
+    have_pending = true;
+    TRACE_ASYNC_BEGIN("latched", frame_id);
 
-        buffer_map[the_buffer] = w_buffer;
-    }
+    return 0;
+}
+
+int renderer_t::commit_pending()
+{
+    pending_frame_t frame = pending;
+    int ret;
+
+    if(!have_pending) return 0;
+    have_pending = false;
+    TRACE_ASYNC_END("latched", frame.frame_id);
+
+    ret = commit_buffer(frame.buffer, frame.info, frame.acquire_fence, frame.target_ns, frame.dequeue_ns, frame.frame_id);
+    if(frame.acquire_fence >= 0) close(frame.acquire_fence);
+
+    // never shown, android can have it back
+    if(ret != 0 && frame.buffer != buffer) windowmanager->handle_buffer_release(frame.buffer, -1);
+
+    return ret;
+}
+
+void renderer_t::drop_pending(bool release)
+{
+    if(!have_pending) return;
+    have_pending = false;
+    TRACE_ASYNC_END("latched", pending.frame_id);
+
+    if(pending.acquire_fence >= 0) close(pending.acquire_fence);
+    pending.acquire_fence = -1;
+
+    // dummy frames hold the buffer that is still shown
+    if(release && pending.buffer != buffer) windowmanager->handle_buffer_release(pending.buffer, -1);
+}
+
+int renderer_t::commit_buffer(ANativeWindowBuffer *the_buffer, buffer_info_t &info, int acquire_fence, int64_t target_ns, int64_t dequeue_ns, int32_t frame_id)
+{
+    TRACE_SCOPE("commit_buffer");
+    commit_scheduler_t &scheduler = windowmanager->get_scheduler();
+    bool latched = (target_ns != 0);
+
+    LOG_D(LOG_RENDERER, "rendering buffer in: %s", app.c_str());
 
     int ret = 0;
-    while(frame_callback_ptr && ret != -1)
-    {
-        ret = wl_display_dispatch(wayland_helper::display);
-    }
+    int64_t wait_start_ns = monotonic_ns();
+    TRACE_BEGIN("wait_frame_callback");
+    ret = backend->wait_frame();
+    TRACE_END();
+    int64_t callback_wait_ns = monotonic_ns() - wait_start_ns;
 
-    if(!have_focus)
+    if(ret != 0 || !have_focus)
     {
         // lost focus due to keyboard leave
-        return 0;
+        return 1;
     }
 
-    frame_callback_ptr = wl_surface_frame(w_surface);
-    wl_callback_add_listener(frame_callback_ptr, &w_frame_listener, this);
+    // NO_BUFFER shows the last buffer again, that's no new frame
+    bool new_frame = (the_buffer != buffer);
+
+    // frames committed right away are counted against the vsync they could have made
+    if(!latched && windowmanager->get_vsync().is_valid()) target_ns = scheduler.target_vsync(monotonic_ns());
+
+    if(backend->present(the_buffer, info, acquire_fence, target_ns, latched, frame_id) != 0)
+    {
+        return 1;
+    }
+    // only now, commit_pending() releases a failed frame unless it's still shown
+    buffer = the_buffer;
 
-    wl_surface_attach(w_surface, buffer_map[the_buffer], 0, 0);
-    wl_surface_damage(w_surface, 0, 0, info.width, info.height);
-    wl_surface_commit(w_surface);
+    last_commit_ns = monotonic_ns();
+    last_commit_frame_id = frame_id;
+    TRACE_ASYNC_BEGIN("display", frame_id);
+    metrics_t::record(HISTOGRAM_DEQUEUE_TO_COMMIT, last_commit_ns - dequeue_ns);
+    if(new_frame) windowmanager->get_jank().add_commit(app, last_commit_ns, callback_wait_ns);
 
     if(last_screen) free(last_screen);
     last_screen = nullptr;
 
+    if(backend->immediate()) frame_done();
+
     return 0;
 }
 
-void renderer_t::buffer_release(void *data, struct wl_buffer *buffer)
+void renderer_t::forget_buffers()
 {
-#if DEBUG
-    cout << "buffer release" << endl;
-#endif
+    LOG_D(LOG_RENDERER, "forgetting buffers in: %s", app.c_str());
+    // its slot is gone too
+    drop_pending(false);
 
-    // we're cleaning in deinit()
-}
+    backend->forget_buffers(buffer);
 
-void renderer_t::shell_surface_ping(void *data, struct wl_shell_surface *shell_surface, uint32_t serial)
-{
-#if DEBUG
-    cout << "shell surface ping " << endl;
-#endif
-    wl_shell_surface_pong(shell_surface, serial);
+    // its handle is gone
+    buffer = nullptr;
 }
 
-void renderer_t::shell_surface_configure(void *data, struct wl_shell_surface *shell_surface, uint32_t edges, int32_t width, int32_t height)
+void renderer_t::forget_buffer(ANativeWindowBuffer *the_buffer)
 {
-#if DEBUG
-    cout << "shell surface configure " << endl;
-#endif
-    renderer_t *self = (renderer_t*)data;
-    wl_egl_window_resize(self->w_egl_window, width, height, 0, 0);
-}
+    LOG_D(LOG_RENDERER, "forgetting a buffer in: %s", app.c_str());
+    // the producer gave it up, it is not released anymore
+    if(have_pending && pending.buffer == the_buffer) drop_pending(false);
 
-void renderer_t::shell_surface_popup_done(void *data, struct wl_shell_surface *shell_surface)
-{
-#if DEBUG
-    cout << "shell surface popup done" << endl;
-#endif
+    backend->forget_buffer(the_buffer, the_buffer == buffer);
+
+    if(the_buffer == buffer) buffer = nullptr;
 }
 
-void renderer_t::handle_onscreen_visibility(void *data, struct qt_extended_surface *qt_extended_surface, int32_t visible)
+void renderer_t::frame_done()
 {
-#if DEBUG
-    renderer_t *renderer = (renderer_t*)data;
-    cout << "qt_extended_surface handle onscreen visibility @ "<< renderer->app << endl;
-#endif
-    // handled in keyboard leave/enter
+    metrics_t::record(HISTOGRAM_COMMIT_TO_FRAME_CALLBACK, monotonic_ns() - last_commit_ns);
+    TRACE_ASYNC_END("display", last_commit_frame_id);
 }
 
-void renderer_t::handle_set_generic_property(void *data, struct qt_extended_surface *qt_extended_surface, const char *name, struct wl_array *value)
+void renderer_t::buffer_released(ANativeWindowBuffer *released, int release_fence)
 {
-#if DEBUG
-    cout << "qt_extended_surface handle set generic property" << endl;
-#endif
+    windowmanager->handle_buffer_release(released, release_fence);
 }
 
-void renderer_t::handle_close(void *data, struct qt_extended_surface *qt_extended_surface)
+void renderer_t::presented(int64_t timestamp_ns, int64_t refresh_ns, bool exact, int64_t target_ns, bool latched)
 {
-#if DEBUG
-    cout << "qt_extended_surface handle close" << endl;
-#endif
-
-    renderer_t *renderer = (renderer_t*)data;
-    renderer->windowmanager->handle_close(renderer->w_surface);
+    windowmanager->handle_vsync(timestamp_ns, refresh_ns, exact);
+    if(target_ns != 0) windowmanager->get_scheduler().add_result(target_ns, timestamp_ns, latched);
 }
 
-void renderer_t::frame_callback(void *data, struct wl_callback *callback, uint32_t time)
+void renderer_t::close_requested()
 {
-    renderer_t *renderer = (renderer_t*)data;
-    renderer->frame_callback_ptr = 0;
-    wl_callback_destroy(callback);
+    windowmanager->handle_close(get_surface());
 }
-
@@ -1,38 +1,46 @@
 #ifndef __RENDERER_H__
 #define __RENDERER_H__
 
-#include <GLES/gl.h>
-
 #include "sfdroid_defs.h"
 
 #include <hardware/hardware.h>
 #include <hardware/gralloc.h>
 #include <system/window.h>
 #include <string>
-#include <map>
-
-#include <EGL/egl.h>
-#include <EGL/eglext.h>
-#include <GLES/glext.h>
 
-#include <wayland-client.h>
+#include "presentbackend.h"
 
 class windowmanager_t;
 
-struct qt_extended_surface_listener {
-    void (*onscreen_visibility)(void *data, struct qt_extended_surface *qt_extended_surface, int32_t visible);
-    void (*set_generic_property)(void *data, struct qt_extended_surface *qt_extended_surface, const char *name, struct wl_array *value);
-    void (*close)(void *data, struct qt_extended_surface *qt_extended_surface);
+// SFDROID_PRESENT
+enum present_backend_type
+{
+    PRESENT_WLEGL,
+    PRESENT_NULL,
+    PRESENT_FILE,
 };
 
 class renderer_t {
     public:
-        renderer_t() : have_focus(0), last_screen(nullptr), egl_surf(EGL_NO_SURFACE), egl_ctx(EGL_NO_CONTEXT), w_shell_surface(nullptr), w_surface(nullptr), w_egl_window(nullptr), buffer(nullptr), windowmanager(nullptr) { }
+        renderer_t() : have_focus(0), last_screen(nullptr), have_pending(false), backend(nullptr), buffer(nullptr), windowmanager(nullptr) { }
+        // picks the backend for all windows, before the first one is created
+        static int select_backend();
+        // nothing is shown, there is no compositor to talk to
+        static bool is_headless() { return backend_type != PRESENT_WLEGL; }
         int init(windowmanager_t &wm);
         int recreate();
-        int render_buffer(ANativeWindowBuffer *the_buffer, buffer_info_t &info);
+        // acquire_fence is not taken over, -1 if the buffer is ready.
+        // the buffer is held back until commit_pending() if the commit scheduler is active
+        int render_buffer(ANativeWindowBuffer *the_buffer, buffer_info_t &info, int acquire_fence, int32_t frame_id);
+        int commit_pending();
+        bool has_pending() { return have_pending; }
+        int64_t get_pending_target() { return pending.target_ns; }
+        void forget_buffers();
+        // one buffer's handle is about to change
+        void forget_buffer(ANativeWindowBuffer *the_buffer);
         void gained_focus();
-        wl_surface *get_surface() { return w_surface; }
+        struct wl_surface *get_surface() { return backend ? backend->get_surface() : nullptr; }
+        size_t wayland_objects() { return backend ? backend->wayland_objects() : 0; }
         void lost_focus();
         bool is_active();
         void deinit();
@@ -42,26 +50,37 @@ class renderer_t {
         std::string get_package() { return app; }
         ~renderer_t();
 
+        // called by the backend
+        void frame_done();
+        // takes over release_fence
+        void buffer_released(ANativeWindowBuffer *buffer, int release_fence);
+        // exact if the timestamp is from presentation feedback of a vsynced refresh
+        void presented(int64_t timestamp_ns, int64_t refresh_ns, bool exact, int64_t target_ns, bool latched);
+        void close_requested();
+
     private:
-        static void shell_surface_ping(void *data, struct wl_shell_surface *shell_surface, uint32_t serial);
-        static void shell_surface_configure(void *data, struct wl_shell_surface *shell_surface, uint32_t edges, int32_t width, int32_t height);
-        static void shell_surface_popup_done(void *data, struct wl_shell_surface *shell_surface);
+        int commit_buffer(ANativeWindowBuffer *the_buffer, buffer_info_t &info, int acquire_fence, int64_t target_ns, int64_t dequeue_ns, int32_t frame_id);
+        void drop_pending(bool release);
 
-        GLuint dummy_tex;
         bool have_focus;
 
-        int draw_raw(void *data, int width, int height, int pixel_format);
         void *last_screen;
 
-        EGLSurface egl_surf;
-        EGLContext egl_ctx;
+        struct pending_frame_t
+        {
+            ANativeWindowBuffer *buffer;
+            buffer_info_t info;
+            int acquire_fence; // our own dup
+            int64_t target_ns; // the vsync it is meant for
+            int64_t dequeue_ns; // when the main loop got it
+            int32_t frame_id;
+        };
 
-        struct wl_shell_surface *w_shell_surface;
-        struct wl_surface *w_surface;
-        struct wl_egl_window *w_egl_window;
-        struct wl_shell_surface_listener shell_surface_listener = {&shell_surface_ping, &shell_surface_configure, &shell_surface_popup_done};
+        pending_frame_t pending;
+        bool have_pending;
 
-        struct qt_extended_surface *q_extended_surface;
+        static present_backend_type backend_type;
+        presentbackend_t *backend;
 
         static int instances;
 
@@ -69,31 +88,8 @@ class renderer_t {
 
         ANativeWindowBuffer *buffer;
 
-        static void handle_onscreen_visibility(void *data, struct qt_extended_surface *qt_extended_surface, int32_t visible);
-        static void handle_set_generic_property(void *data, struct qt_extended_surface *qt_extended_surface, const char *name, struct wl_array *value);
-        static void handle_close(void *data, struct qt_extended_surface *qt_extended_surface);
-
-        static void buffer_release(void *data, struct wl_buffer *buffer);
-
-        static void frame_callback(void *data, struct wl_callback *callback, uint32_t time);
-
-        const struct qt_extended_surface_listener extended_surface_listener = { 
-            &handle_onscreen_visibility,
-            &handle_set_generic_property,
-            &handle_close,
-        };
-
-        const struct wl_buffer_listener w_buffer_listener = {
-            buffer_release
-        };
-
-        const struct wl_callback_listener w_frame_listener = {
-            frame_callback
-        };
-
-        struct wl_callback *frame_callback_ptr;
-
-        std::map<ANativeWindowBuffer*, struct wl_buffer*> buffer_map;
+        int64_t last_commit_ns;
+        int32_t last_commit_frame_id;
         windowmanager_t *windowmanager;
 };
 
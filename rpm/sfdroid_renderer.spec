@@ -11,6 +11,7 @@ BuildRequires:  pkgconfig(glesv1_cm)
 BuildRequires:  pkgconfig(egl)
 BuildRequires:  pkgconfig(wayland-egl)
 BuildRequires:  pkgconfig(wayland-client)
+BuildRequires:  pkgconfig(wayland-server)
 BuildRequires:  pkgconfig(sensord-qt5)
 BuildRequires:  pkgconfig(Qt5DBus)
 BuildRequires:  pkgconfig(Qt5Network)
@@ -40,6 +41,16 @@ usermod -G net_bt_stack -a nemo
 %files
 %defattr(644,root,root,755)
 %attr(755,root,root) %{_bindir}/sfdroid
+%attr(755,root,root) %{_bindir}/sfdroid_stats
+%attr(755,root,root) %{_bindir}/sfdroid_producer
+%attr(755,root,root) %{_bindir}/sfdroid_compositor
+%attr(755,root,root) %{_bindir}/sfdroid_replay
+%attr(755,root,root) %{_bindir}/sfdroid_input_replay
+%attr(755,root,root) %{_bindir}/sfdroid_bench_appswitch
+%attr(755,root,root) %{_bindir}/sfdroid_bench_touch
+%attr(755,root,root) %{_bindir}/sfdroid_bench_sensors
+%attr(755,root,root) %{_bindir}/sfdroid_bench_windows
+%attr(755,root,root) %{_bindir}/sfdroid_microbench
 %attr(755,root,root) %{_bindir}/sfdroid_powerup*
 %attr(755,root,root) %{_bindir}/am
 %attr(755,root,root) %{_bindir}/sfdroid.sh
@@ -0,0 +1,207 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "sbring.h"
+#include "metrics.h"
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+static int create_shm_fd(size_t size)
+{
+    int fd = -1;
+
+#ifdef SYS_memfd_create
+    fd = syscall(SYS_memfd_create, "sfdroid-ring", 1 /* MFD_CLOEXEC */);
+#endif
+
+    // older kernels don't have memfd
+    if(fd < 0)
+    {
+        char path[] = "/dev/shm/sfdroid-ring-XXXXXX";
+        fd = mkostemp(path, O_CLOEXEC);
+        if(fd >= 0) unlink(path);
+    }
+
+    if(fd < 0) return -1;
+
+    if(ftruncate(fd, size) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int sbring_t::create()
+{
+    int err = 0;
+    void *mem;
+
+    fd_shm = create_shm_fd(sizeof(struct sb_shm_t));
+    if(fd_shm < 0)
+    {
+        cerr << "failed to create ring shared memory: " << strerror(errno) << endl;
+        err = 1;
+        goto quit;
+    }
+
+    fd_post_doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fd_ack_doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(fd_post_doorbell < 0 || fd_ack_doorbell < 0)
+    {
+        cerr << "failed to create ring doorbells: " << strerror(errno) << endl;
+        err = 2;
+        goto quit;
+    }
+
+    mem = mmap(NULL, sizeof(struct sb_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd_shm, 0);
+    if(mem == MAP_FAILED)
+    {
+        cerr << "failed to map ring shared memory: " << strerror(errno) << endl;
+        err = 3;
+        goto quit;
+    }
+
+    shm = (struct sb_shm_t*)mem;
+    memset(shm, 0, sizeof(struct sb_shm_t));
+    shm->magic = SB_RING_MAGIC;
+    shm->version = SB_PROTOCOL_VERSION;
+    post_tail = 0;
+
+quit:
+    if(err != 0) deinit();
+    return err;
+}
+
+int sbring_t::attach(int shm_fd, int post_doorbell, int ack_doorbell)
+{
+    void *mem;
+
+    fd_shm = shm_fd;
+    fd_post_doorbell = post_doorbell;
+    fd_ack_doorbell = ack_doorbell;
+
+    mem = mmap(NULL, sizeof(struct sb_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd_shm, 0);
+    if(mem == MAP_FAILED)
+    {
+        cerr << "failed to map ring shared memory: " << strerror(errno) << endl;
+        deinit();
+        return 1;
+    }
+
+    shm = (struct sb_shm_t*)mem;
+    if(shm->magic != SB_RING_MAGIC)
+    {
+        cerr << "invalid ring shared memory" << endl;
+        deinit();
+        return 2;
+    }
+
+    return 0;
+}
+
+void sbring_t::deinit()
+{
+    if(shm) munmap(shm, sizeof(struct sb_shm_t));
+    shm = nullptr;
+
+    if(fd_shm >= 0) close(fd_shm);
+    if(fd_post_doorbell >= 0) close(fd_post_doorbell);
+    if(fd_ack_doorbell >= 0) close(fd_ack_doorbell);
+    fd_shm = fd_post_doorbell = fd_ack_doorbell = -1;
+}
+
+bool sbring_t::push(struct sb_ring_t *ring, int doorbell, const struct sb_ring_entry_t &entry)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if(head - tail >= SB_RING_SIZE) return false;
+
+    ring->entries[head % SB_RING_SIZE] = entry;
+
+    // pairs with prepare_wait(), either the reader sees the entry or we see it waiting
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST))
+    {
+        uint64_t one = 1;
+        metrics_t::count(COUNTER_SYSCALLS_RING);
+        if(write(doorbell, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        {
+            cerr << "failed to ring doorbell: " << strerror(errno) << endl;
+        }
+    }
+
+    return true;
+}
+
+int sbring_t::pop(struct sb_ring_t *ring, uint32_t &tail, struct sb_ring_entry_t &entry)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if(head == tail) return 0;
+    if(head - tail > SB_RING_SIZE) return -1;
+
+    entry = ring->entries[tail % SB_RING_SIZE];
+    tail++;
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+bool sbring_t::prepare_wait(struct sb_ring_t *ring, uint32_t tail)
+{
+    __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+
+    if(__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != tail)
+    {
+        __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    return true;
+}
+
+void sbring_t::finish_wait(struct sb_ring_t *ring, int doorbell)
+{
+    uint64_t count;
+
+    __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+
+    // the doorbell is non blocking, this only clears a pending ring
+    do
+    {
+        metrics_t::count(COUNTER_SYSCALLS_RING);
+    } while(read(doorbell, &count, sizeof(count)) > 0);
+}
+
@@ -0,0 +1,44 @@
+#ifndef __SB_RING_H__
+#define __SB_RING_H__
+
+#include "sharebuffer_protocol.h"
+
+// the shared memory post/ack rings of SB_CAP_SHM_RING, used by both ends
+class sbring_t {
+    public:
+        sbring_t() : shm(nullptr), fd_shm(-1), fd_post_doorbell(-1), fd_ack_doorbell(-1), post_tail(0) {}
+        // renderer side, creates the shared memory and the doorbells
+        int create();
+        // producer side, takes ownership of the fds
+        int attach(int shm_fd, int post_doorbell, int ack_doorbell);
+        void deinit();
+        bool is_active() { return shm != nullptr; }
+
+        int get_shm_fd() { return fd_shm; }
+        int get_post_doorbell() { return fd_post_doorbell; }
+        int get_ack_doorbell() { return fd_ack_doorbell; }
+        struct sb_ring_t *posts() { return &shm->posts; }
+        struct sb_ring_t *acks() { return &shm->acks; }
+        // where the renderer reads the post ring
+        uint32_t &get_post_tail() { return post_tail; }
+
+        // false if the ring is full
+        static bool push(struct sb_ring_t *ring, int doorbell, const struct sb_ring_entry_t &entry);
+        // 1 for an entry, 0 if the ring is empty, -1 if the writer moved head
+        // out of range. tail is the reader's own, the shared one is only
+        // written, the other end could change it
+        static int pop(struct sb_ring_t *ring, uint32_t &tail, struct sb_ring_entry_t &entry);
+        // call before sleeping on the doorbell, false if entries arrived meanwhile
+        static bool prepare_wait(struct sb_ring_t *ring, uint32_t tail);
+        static void finish_wait(struct sb_ring_t *ring, int doorbell);
+
+    private:
+        struct sb_shm_t *shm;
+        int fd_shm;
+        int fd_post_doorbell;
+        int fd_ack_doorbell;
+        uint32_t post_tail;
+};
+
+#endif
+
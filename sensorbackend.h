@@ -0,0 +1,22 @@
+#ifndef __SENSOR_BACKEND_H__
+#define __SENSOR_BACKEND_H__
+
+// a source of sensor samples for sensorconnection_t.
+// all methods are called from the sensors thread.
+class sensorbackend_t {
+    public:
+        virtual ~sensorbackend_t() {}
+        virtual const char *name() = 0;
+        // called when the first client enables a sensor, may be called again after stop()
+        virtual int start() = 0;
+        // called when the last client is gone
+        virtual void stop() = 0;
+        // releases everything start() acquired, called before the sensors thread exits
+        virtual void shutdown() = 0;
+        virtual void set_interval(int interval_ms) = 0;
+        // latest sample in m/s^2
+        virtual int read_accelerometer(double &x, double &y, double &z) = 0;
+};
+
+#endif
+
@@ -19,10 +19,15 @@
  */
 
 #include "sensorconnection.h"
+#include "sensorfw_backend.h"
+#include "iio_backend.h"
+#include "metrics.h"
+#include "logger.h"
+#include "thread_stats.h"
+#include "utility.h"
 
 #include <iostream>
-
-#include <QCoreApplication>
+#include <cstdlib>
 
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -35,6 +40,24 @@ int sensorconnection_t::init()
 {
     int err = 0;
     struct sockaddr_un addr;
+    const char *backend_name = getenv("SFDROID_SENSORS");
+
+    if(backend_name && strcmp(backend_name, "iio") == 0)
+    {
+        const char *sysfs_root = getenv("SFDROID_IIO_SYSFS_ROOT");
+        const char *dev_root = getenv("SFDROID_IIO_DEV_ROOT");
+        backend = new iio_backend_t(sysfs_root ? sysfs_root : IIO_SYSFS_ROOT, dev_root ? dev_root : IIO_DEV_ROOT);
+    }
+    else if(!backend_name || strcmp(backend_name, "sensorfw") == 0)
+    {
+        backend = new sensorfw_backend_t();
+    }
+    else
+    {
+        cerr << "unknown sensors backend: " << backend_name << endl;
+        err = 4;
+        goto quit;
+    }
 
     fd_socket = socket(AF_UNIX, SOCK_STREAM, 0);
     if(fd_socket < 0)
@@ -115,35 +138,7 @@ void sensorconnection_t::update_timeout()
 
 void sensorconnection_t::thread_loop()
 {
-    int argc;
-    char *argv[0];
-    QCoreApplication app(argc, argv);
-    int err = 0;
-
-    remoteSensorManager = &SensorManagerInterface::instance();
-
-    if(!remoteSensorManager->isValid())
-    {
-        cerr << "remoteSensorManager is not valid" << endl;
-        err = 1;
-        goto quit;
-    }
-
-    remoteSensorManager->loadPlugin("accelerometersensor");
-    remoteSensorManager->registerSensorInterface<AccelerometerSensorChannelInterface>("accelerometersensor");
-
-    accel = AccelerometerSensorChannelInterface::interface("accelerometersensor");
-
-    if(!accel || !accel->isValid())
-    {
-        cerr << "could not get accelerometersensor" << endl;
-        err = 2;
-        goto quit;
-    }
-
-    accel->setInterval(100);
-
-    accel->start();
+    thread_stats_t::register_thread(THREAD_SENSORS, "sfd-sensors");
     running = true;
 
     while(running)
@@ -157,15 +152,17 @@ void sensorconnection_t::thread_loop()
 
         if(have_client())
         {
-            int type, timedout;
-            if(wait_for_request(type, timedout) == 0)
+            int type = -1, timedout;
+            int64_t request_ns = 0;
+            if(wait_for_request(type, timedout, request_ns) == 0)
             {
-                if(!timedout)
+                // setDelay: and set: only change the backend, no data is sent for them
+                if(!timedout && type == ACCELEROMETER)
                 {
-                    if(type == ACCELEROMETER)
-                    {
-                        send_accelerometer_data();
-                    }
+                    send_accelerometer_data();
+
+                    metrics_t::count(COUNTER_SENSOR_REQUESTS);
+                    metrics_t::record(HISTOGRAM_SENSOR_REQUEST, monotonic_ns() - request_ns);
                 }
             }
         }
@@ -173,31 +170,70 @@ void sensorconnection_t::thread_loop()
         std::this_thread::yield();
     }
 
-    if(accel) accel->stop();
+    drop_client();
 
-    close(fd_client);
-    fd_client = -1;
+    backend->shutdown();
+    thread_stats_t::unregister_thread(THREAD_SENSORS);
+}
 
-quit:
-    if(err != 0) cerr << "not starting the sensors thread" << endl;
-    return;
+int sensorconnection_t::start_accelerometer()
+{
+    if(accel_started) return 0;
+
+    // don't retry a backend that is not there on every request
+    if(backend_retry_ns && monotonic_ns() < backend_retry_ns) return 1;
+
+#if DEBUG
+    cout << "starting accelerometer (" << backend->name() << ")" << endl;
+#endif
+    if(backend->start() != 0)
+    {
+        cerr << "sensors are not available (" << backend->name() << "), trying again in " << SENSOR_BACKEND_RETRY_MS << " ms" << endl;
+        backend_retry_ns = monotonic_ns() + SENSOR_BACKEND_RETRY_MS * 1000000LL;
+        return 1;
+    }
+    backend_retry_ns = 0;
+    backend->set_interval(accel_interval_ms);
+    accel_started = true;
+
+    return 0;
+}
+
+void sensorconnection_t::stop_accelerometer()
+{
+    if(!accel_started) return;
+
+#if DEBUG
+    cout << "stopping accelerometer" << endl;
+#endif
+    backend->stop();
+    accel_started = false;
+}
+
+void sensorconnection_t::drop_client()
+{
+    // nobody left to read the sensors
+    stop_accelerometer();
+
+    if(fd_client >= 0) close(fd_client);
+    fd_client = -1;
 }
 
-int sensorconnection_t::wait_for_request(int &type, int &timedout)
+int sensorconnection_t::wait_for_request(int &type, int &timedout, int64_t &request_ns)
 {
     int err = 0;
     int64_t delay;
     int enable;
     char syncbuf[1];
 
+    type = -1;
     timedout = 0;
 
-#if DEBUG
-    cout << "waiting for sensor request" << endl;
-#endif
+    LOG_D(LOG_SENSORS, "waiting for sensor request");
     char buffer[256];
     int len;
 
+    metrics_t::count(COUNTER_SYSCALLS_SOCKET);
     len = recv(fd_client, syncbuf, 1, MSG_WAITALL);
     if(len < 0)
     {
@@ -212,7 +248,10 @@ int sensorconnection_t::wait_for_request(int &type, int &timedout)
         err = 1;
         goto quit;
     }
+    // the request starts with its sync byte, parsing it is part of answering
+    request_ns = monotonic_ns();
 
+    metrics_t::count(COUNTER_SYSCALLS_SOCKET);
     len = recv(fd_client, buffer, syncbuf[0], MSG_WAITALL);
     if(len < 0)
     {
@@ -232,30 +271,33 @@ int sensorconnection_t::wait_for_request(int &type, int &timedout)
 
     if(strcmp(buffer, "get:accelerometer") == 0)
     {
-#if DEBUG
-        cout << "received the get:accelerometer command" << endl;
-#endif
+        LOG_D(LOG_SENSORS, "received the get:accelerometer command");
+        // some clients poll without enabling the sensor first. without a
+        // backend the client stays connected and gets an answer that isn't
+        // a sample, dropping it would make the HAL reconnect in a loop
+        if(start_accelerometer() != 0)
+        {
+            err = send_answer(SENSOR_UNAVAILABLE_ANSWER);
+            goto quit;
+        }
         type = ACCELEROMETER;
     }
     else if(sscanf(buffer, "setDelay:acceleration:%lld", &delay) == 1)
     {
-#if DEBUG
-        cout << "setting accelerometer interval " << delay << endl;
-#endif
-        accel->setInterval(delay / 1000000);
+        LOG_D(LOG_SENSORS, "setting accelerometer interval %lld", (long long)delay);
+        accel_interval_ms = delay / 1000000;
+        if(accel_started) backend->set_interval(accel_interval_ms);
     }
     else if(sscanf(buffer, "set:acceleration:%d", &enable) == 1)
     {
-#if DEBUG
-        cout << "setting accelerometer enabled: " << enable << endl;
-#endif
-        if(enable) accel->start();
-        else accel->stop();
+        LOG_D(LOG_SENSORS, "setting accelerometer enabled: %d", enable);
+        // set: has no answer, get: tells the client when there is no backend
+        if(enable) start_accelerometer();
+        else stop_accelerometer();
     }
     else
     {
         cerr << "unknown request: " << buffer << endl;
-        type = -1;
         err = 1;
         goto quit;
     }
@@ -263,37 +305,42 @@ int sensorconnection_t::wait_for_request(int &type, int &timedout)
 quit:
     if(err != 0)
     {
-        close(fd_client);
-        fd_client = -1;
+        drop_client();
     }
     return err;
 }
 
-#define GRAVITY_RECIPROCAL_THOUSANDS 101.971621298
-
 int sensorconnection_t::send_accelerometer_data()
 {
-    int err = 0;
-    int r = 0;
     char buffer[512];
-    char syncbuf[1];
-    XYZ a = accel->get();
     int64_t timestamp;
     struct timespec  ts;
+    double x, y, z;
+
+    if(backend->read_accelerometer(x, y, z) != 0)
+    {
+        cerr << "failed to read accelerometer" << endl;
+        drop_client();
+        return 1;
+    }
 
     clock_gettime(CLOCK_MONOTONIC, &ts);
     timestamp = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 
-    double x = (double)a.x() / GRAVITY_RECIPROCAL_THOUSANDS;
-    double y = (double)a.y() / GRAVITY_RECIPROCAL_THOUSANDS;
-    double z = (double)a.z() / GRAVITY_RECIPROCAL_THOUSANDS;
-
-#if DEBUG
-    cout << "accelerometer info: x " << x << " y " << y << " z " << z << endl;
-#endif
+    LOG_D(LOG_SENSORS, "accelerometer info: x %g y %g z %g", x, y, z);
     sprintf(buffer, "acceleration:%g:%g:%g:%lld", x, y, z, timestamp);
 
-    syncbuf[0] = strlen(buffer) + 1;
+    return send_answer(buffer);
+}
+
+int sensorconnection_t::send_answer(const char *answer)
+{
+    int err = 0;
+    int r = 0;
+    char syncbuf[1];
+
+    syncbuf[0] = strlen(answer) + 1;
+    metrics_t::count(COUNTER_SYSCALLS_SOCKET);
     r = send(fd_client, syncbuf, 1, 0);
     if(r < 0)
     {
@@ -302,10 +349,11 @@ int sensorconnection_t::send_accelerometer_data()
         goto quit;
     }
 
-    r = send(fd_client, buffer, syncbuf[0], 0);
+    metrics_t::count(COUNTER_SYSCALLS_SOCKET);
+    r = send(fd_client, answer, syncbuf[0], 0);
     if(r < 0)
     {
-        cerr << "failed to send accelerometer data" << endl;
+        cerr << "failed to send sensor answer" << endl;
         err = 1;
         goto quit;
     }
@@ -313,8 +361,7 @@ int sensorconnection_t::send_accelerometer_data()
 quit:
     if(err != 0)
     {
-        close(fd_client);
-        fd_client = -1;
+        drop_client();
     }
     return err;
 }
@@ -329,6 +376,8 @@ void sensorconnection_t::deinit()
     if(fd_socket >= 0) close(fd_socket);
     if(fd_client >= 0) close(fd_client);
     unlink(SENSORS_HANDLE_FILE);
+    if(backend) delete backend;
+    backend = nullptr;
 }
 
 void sensorconnection_t::start_thread()
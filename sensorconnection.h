@@ -3,22 +3,23 @@
 
 #include "sfdroid_defs.h"
 
-#include <sensormanagerinterface.h>
-#include <accelerometersensor_i.h>
+#include "sensorbackend.h"
 
 #include <thread>
 #include <atomic>
 
 class sensorconnection_t {
     public:
-        sensorconnection_t() : fd_socket(-1), fd_client(-1), remoteSensorManager(nullptr), accel(nullptr), running(false), have_focus(true) {}
+        sensorconnection_t() : fd_socket(-1), fd_client(-1), backend(nullptr), backend_retry_ns(0), accel_started(false), accel_interval_ms(100), running(false), have_focus(true) {}
         int init();
         void deinit();
         int wait_for_client();
         bool have_client();
         void update_timeout();
-        int wait_for_request(int &type, int &timedout);
+        // request_ns is when the request's sync byte arrived, type stays -1 for requests without an answer
+        int wait_for_request(int &type, int &timedout, int64_t &request_ns);
         int send_accelerometer_data();
+        int send_answer(const char *answer);
         void start_thread();
         void thread_loop();
         void stop_thread();
@@ -26,11 +27,18 @@ class sensorconnection_t {
         void lost_focus();
         void gained_focus();
     private:
+        int start_accelerometer();
+        void stop_accelerometer();
+        void drop_client();
+
         int fd_socket; // listen for surfaceflinger
         int fd_client; // the client (sharebuffer module)
 
-        SensorManagerInterface *remoteSensorManager;
-        AccelerometerSensorChannelInterface *accel;
+        // only started once a client asks for a sensor
+        sensorbackend_t *backend;
+        int64_t backend_retry_ns; // a backend that failed isn't started again before this
+        bool accel_started;
+        int accel_interval_ms;
 
         std::thread my_thread;
 
@@ -0,0 +1,110 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "sensorfw_backend.h"
+
+#include <iostream>
+
+using namespace std;
+
+#define GRAVITY_RECIPROCAL_THOUSANDS 101.971621298
+
+int sensorfw_backend_t::connect()
+{
+    int err = 0;
+
+    // sensorconnection_t decides how often a failed connect is tried again
+    if(accel) return 0;
+
+#if DEBUG
+    cout << "connecting to sensorfw" << endl;
+#endif
+    // sensorfw talks d-bus through qt, the application object has to live on this thread
+    if(!QCoreApplication::instance())
+    {
+        app = new QCoreApplication(qt_argc, qt_argv);
+    }
+
+    remoteSensorManager = &SensorManagerInterface::instance();
+
+    if(!remoteSensorManager->isValid())
+    {
+        cerr << "remoteSensorManager is not valid" << endl;
+        err = 1;
+        goto quit;
+    }
+
+    remoteSensorManager->loadPlugin("accelerometersensor");
+    remoteSensorManager->registerSensorInterface<AccelerometerSensorChannelInterface>("accelerometersensor");
+
+    accel = AccelerometerSensorChannelInterface::interface("accelerometersensor");
+
+    if(!accel || !accel->isValid())
+    {
+        cerr << "could not get accelerometersensor" << endl;
+        accel = nullptr;
+        err = 2;
+        goto quit;
+    }
+
+quit:
+    return err;
+}
+
+int sensorfw_backend_t::start()
+{
+    if(connect() != 0) return 1;
+
+    accel->start();
+
+    return 0;
+}
+
+void sensorfw_backend_t::stop()
+{
+    if(accel) accel->stop();
+}
+
+void sensorfw_backend_t::shutdown()
+{
+    stop();
+
+    if(app) delete app;
+    app = nullptr;
+}
+
+void sensorfw_backend_t::set_interval(int interval_ms)
+{
+    if(accel) accel->setInterval(interval_ms);
+}
+
+int sensorfw_backend_t::read_accelerometer(double &x, double &y, double &z)
+{
+    if(!accel) return 1;
+
+    XYZ a = accel->get();
+
+    x = (double)a.x() / GRAVITY_RECIPROCAL_THOUSANDS;
+    y = (double)a.y() / GRAVITY_RECIPROCAL_THOUSANDS;
+    z = (double)a.z() / GRAVITY_RECIPROCAL_THOUSANDS;
+
+    return 0;
+}
+
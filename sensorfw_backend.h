@@ -0,0 +1,33 @@
+#ifndef __SENSORFW_BACKEND_H__
+#define __SENSORFW_BACKEND_H__
+
+#include "sensorbackend.h"
+
+#include <sensormanagerinterface.h>
+#include <accelerometersensor_i.h>
+
+#include <QCoreApplication>
+
+class sensorfw_backend_t : public sensorbackend_t {
+    public:
+        sensorfw_backend_t() : qt_argc(0), qt_argv(), app(nullptr), remoteSensorManager(nullptr), accel(nullptr) {}
+        const char *name() { return "sensorfw"; }
+        int start();
+        void stop();
+        void shutdown();
+        void set_interval(int interval_ms);
+        int read_accelerometer(double &x, double &y, double &z);
+
+    private:
+        int connect();
+
+        // sensorfw is only connected once a client asks for a sensor
+        int qt_argc;
+        char *qt_argv[1];
+        QCoreApplication *app;
+        SensorManagerInterface *remoteSensorManager;
+        AccelerometerSensorChannelInterface *accel;
+};
+
+#endif
+
@@ -0,0 +1,87 @@
+#ifndef __SESSION_RECORD_H__
+#define __SESSION_RECORD_H__
+
+// file format of SFDROID_RECORD, written by session_recorder_t and read by
+// tools/sfdroid_replay. a session_file_header_t followed by records, each
+// one starts with a session_record_t and its payload follows. timestamps are
+// CLOCK_MONOTONIC, for posts they are the time the post arrived (or the
+// producer's stamp for ring posts).
+
+#include <stdint.h>
+
+#define SESSION_MAGIC 0x53465353
+#define SESSION_VERSION 1
+
+enum session_record_type
+{
+    SESSION_CONNECT = 1,    // session_connect_t, a producer said hello
+    SESSION_LAYER_NAME = 2, // session_layer_t + name
+    SESSION_LAYER_CLOSE = 3, // session_layer_t + name
+    SESSION_NEW_BUFFER = 4, // session_new_buffer_t
+    SESSION_POST = 5,       // session_post_t
+    SESSION_SNAPSHOT = 6,   // session_snapshot_t + pixels
+    SESSION_DISCONNECT = 7, // no payload
+};
+
+struct session_file_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    int64_t start_ns;
+};
+
+struct session_record_t
+{
+    uint32_t type;
+    uint32_t size; // including this header
+    int64_t timestamp_ns;
+};
+
+struct session_connect_t
+{
+    uint32_t version;
+    uint32_t capabilities; // what the producer asked for
+};
+
+// the name follows, not terminated
+struct session_layer_t
+{
+    uint32_t length;
+    uint32_t reserved;
+};
+
+struct session_new_buffer_t
+{
+    uint32_t index;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    int32_t pixel_format;
+    uint32_t bytes_per_pixel; // 0 for formats sfdroid can't read
+};
+
+// session_post_t flags
+#define SESSION_POST_RING (1 << 0)
+#define SESSION_POST_FENCE (1 << 1)
+
+struct session_post_t
+{
+    uint32_t index;
+    uint32_t flags;
+};
+
+// the contents of the buffer of the post before it, every scale-th pixel of
+// every scale-th row in the buffer's own format, rows are width / scale
+// pixels without padding
+struct session_snapshot_t
+{
+    uint32_t index;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytes_per_pixel;
+    uint32_t scale;
+    uint32_t reserved;
+};
+
+#endif
+
@@ -0,0 +1,187 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+
+#include "session_recorder.h"
+#include "sfconnection.h"
+#include "utility.h"
+#include "metrics.h"
+
+using namespace std;
+
+int session_recorder_t::init(const char *p, bool with_snapshots)
+{
+    struct session_file_header_t header;
+
+    path = p;
+    file = fopen(path.c_str(), "we");
+    if(!file)
+    {
+        cerr << "failed to open " << path << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    snapshots = with_snapshots;
+    for(int i=0;i<MAX_NUM_BUFFERS;i++) last_snapshot_ns[i] = 0;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = SESSION_MAGIC;
+    header.version = SESSION_VERSION;
+    header.start_ns = monotonic_ns();
+    if(fwrite(&header, sizeof(header), 1, file) != 1)
+    {
+        cerr << "failed to write " << path << ": " << strerror(errno) << endl;
+        deinit();
+        return 2;
+    }
+
+#if DEBUG
+    cout << "recording session to " << path << endl;
+#endif
+    return 0;
+}
+
+void session_recorder_t::deinit()
+{
+    if(file) fclose(file);
+    file = nullptr;
+}
+
+void session_recorder_t::write_record(uint32_t type, int64_t timestamp_ns, const void *payload, size_t size, const void *extra, size_t extra_size)
+{
+    struct session_record_t record;
+
+    if(!file) return;
+
+    record.type = type;
+    record.size = sizeof(record) + size + extra_size;
+    record.timestamp_ns = timestamp_ns;
+
+    // buffered, a recording that fails half way stops rather than getting corrupted
+    if(fwrite(&record, sizeof(record), 1, file) != 1 ||
+        (size > 0 && fwrite(payload, size, 1, file) != 1) ||
+        (extra_size > 0 && fwrite(extra, extra_size, 1, file) != 1))
+    {
+        cerr << "failed to write " << path << ", stopping the recording: " << strerror(errno) << endl;
+        deinit();
+    }
+}
+
+void session_recorder_t::record_connect(uint32_t version, uint32_t capabilities)
+{
+    struct session_connect_t connect;
+
+    connect.version = version;
+    connect.capabilities = capabilities;
+    // snapshots are per connection, the buffers are new
+    for(int i=0;i<MAX_NUM_BUFFERS;i++) last_snapshot_ns[i] = 0;
+    write_record(SESSION_CONNECT, monotonic_ns(), &connect, sizeof(connect), nullptr, 0);
+}
+
+void session_recorder_t::record_layer(uint32_t type, const char *name, uint32_t length)
+{
+    struct session_layer_t layer;
+
+    layer.length = length;
+    layer.reserved = 0;
+    write_record(type == SB_LAYER_NAME ? SESSION_LAYER_NAME : SESSION_LAYER_CLOSE, monotonic_ns(), &layer, sizeof(layer), name, length);
+}
+
+void session_recorder_t::record_new_buffer(uint32_t index, const buffer_info_t &info)
+{
+    struct session_new_buffer_t new_buffer;
+
+    new_buffer.index = index;
+    new_buffer.width = info.width;
+    new_buffer.height = info.height;
+    new_buffer.stride = info.stride;
+    new_buffer.pixel_format = info.pixel_format;
+    new_buffer.bytes_per_pixel = bytes_per_pixel(info.pixel_format);
+    write_record(SESSION_NEW_BUFFER, monotonic_ns(), &new_buffer, sizeof(new_buffer), nullptr, 0);
+}
+
+void session_recorder_t::record_post(uint32_t index, uint32_t flags, int64_t post_ns)
+{
+    struct session_post_t post;
+
+    post.index = index;
+    post.flags = flags;
+    write_record(SESSION_POST, post_ns, &post, sizeof(post), nullptr, 0);
+}
+
+void session_recorder_t::record_snapshot(uint32_t index, ANativeWindowBuffer *buffer, int acquire_fence)
+{
+    struct session_snapshot_t snapshot;
+    int64_t now = monotonic_ns();
+    uint32_t bpp = bytes_per_pixel(buffer->format);
+    uint32_t row_size;
+    vector<char> pixels;
+    void *vaddr;
+
+    if(!file || !snapshots || bpp == 0 || index >= MAX_NUM_BUFFERS) return;
+    if(last_snapshot_ns[index] != 0 && now - last_snapshot_ns[index] < SESSION_SNAPSHOT_INTERVAL_MS * 1000000LL) return;
+
+    // reading is only safe once the producer is done writing. waiting here
+    // would delay the post being recorded, a later post gets the snapshot
+    if(acquire_fence >= 0 && !fence_signaled(acquire_fence)) return;
+    last_snapshot_ns[index] = now;
+
+    metrics_t::count(COUNTER_BUFFER_LOCKS);
+    if(gralloc_module->lock(gralloc_module, buffer->handle, GRALLOC_USAGE_SW_READ_OFTEN, 0, 0, buffer->width, buffer->height, &vaddr) != 0)
+    {
+        cerr << "gralloc lock failed" << endl;
+        return;
+    }
+
+    snapshot.index = index;
+    snapshot.width = buffer->width / SESSION_SNAPSHOT_SCALE;
+    snapshot.height = buffer->height / SESSION_SNAPSHOT_SCALE;
+    snapshot.bytes_per_pixel = bpp;
+    snapshot.scale = SESSION_SNAPSHOT_SCALE;
+    snapshot.reserved = 0;
+    row_size = snapshot.width * bpp;
+
+    pixels.resize((size_t)row_size * snapshot.height);
+    for(uint32_t y=0;y<snapshot.height;y++)
+    {
+        const char *src = (const char*)vaddr + (size_t)y * SESSION_SNAPSHOT_SCALE * buffer->stride * bpp;
+        char *dst = pixels.data() + (size_t)y * row_size;
+
+        for(uint32_t x=0;x<snapshot.width;x++)
+        {
+            memcpy(dst + x * bpp, src + (size_t)x * SESSION_SNAPSHOT_SCALE * bpp, bpp);
+        }
+    }
+
+    gralloc_module->unlock(gralloc_module, buffer->handle);
+
+    write_record(SESSION_SNAPSHOT, now, &snapshot, sizeof(snapshot), pixels.data(), pixels.size());
+}
+
+void session_recorder_t::record_disconnect()
+{
+    write_record(SESSION_DISCONNECT, monotonic_ns(), nullptr, 0, nullptr, 0);
+    // a crash shouldn't take the whole session with it
+    if(file) fflush(file);
+}
@@ -0,0 +1,41 @@
+#ifndef __SESSION_RECORDER_H__
+#define __SESSION_RECORDER_H__
+
+#include <cstdio>
+#include <string>
+
+#include <system/window.h>
+
+#include "sfdroid_defs.h"
+#include "session_record.h"
+
+// writes what the producer sends to SFDROID_RECORD in the format of
+// session_record.h, for tools/sfdroid_replay. only used from the
+// sfconnection thread. with SFDROID_RECORD_SNAPSHOTS=1 the contents of posted
+// buffers are sampled too, at most every SESSION_SNAPSHOT_INTERVAL_MS per buffer.
+class session_recorder_t {
+    public:
+        session_recorder_t() : file(nullptr), snapshots(false) {}
+        int init(const char *path, bool with_snapshots);
+        void deinit();
+        bool is_active() { return file != nullptr; }
+
+        void record_connect(uint32_t version, uint32_t capabilities);
+        void record_layer(uint32_t type, const char *name, uint32_t length);
+        void record_new_buffer(uint32_t index, const buffer_info_t &info);
+        void record_post(uint32_t index, uint32_t flags, int64_t post_ns);
+        // takes its time for fenced posts, only call it for buffers sfdroid is about to show
+        void record_snapshot(uint32_t index, ANativeWindowBuffer *buffer, int acquire_fence);
+        void record_disconnect();
+
+    private:
+        void write_record(uint32_t type, int64_t timestamp_ns, const void *payload, size_t size, const void *extra, size_t extra_size);
+
+        FILE *file;
+        std::string path;
+        bool snapshots;
+        int64_t last_snapshot_ns[MAX_NUM_BUFFERS];
+};
+
+#endif
+
@@ -20,13 +20,21 @@
 
 #include <iostream>
 #include <chrono>
+#include <algorithm>
 
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 
 #include "sfconnection.h"
 #include "utility.h"
+#include "metrics.h"
+#include "trace.h"
+#include "logger.h"
+#include "thread_stats.h"
+#include "memfd_gralloc.h"
 
 using namespace std;
 
@@ -36,8 +44,11 @@ int sfconnection_t::init()
 {
     int err = 0;
     struct sockaddr_un addr;
+    const char *gralloc_env;
+    const char *record_env;
+    const char *snapshots_env;
 
-    fd_pass_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    fd_pass_socket = socket(AF_UNIX, SOCK_SEQPACKET, 0);
     if(fd_pass_socket < 0)
     {
         cerr << "failed to create socket: " << strerror(errno) << endl;
@@ -71,7 +82,13 @@ int sfconnection_t::init()
 #if DEBUG
     cout << "loading gralloc module" << endl;
 #endif
-    if(hw_get_module(GRALLOC_HARDWARE_MODULE_ID, (const hw_module_t**)&gralloc_module) != 0)
+    gralloc_env = getenv("SFDROID_GRALLOC");
+    if(gralloc_env && strcmp(gralloc_env, "memfd") == 0)
+    {
+        gralloc_module = memfd_gralloc_open();
+        memfd_buffers = true;
+    }
+    else if(hw_get_module(GRALLOC_HARDWARE_MODULE_ID, (const hw_module_t**)&gralloc_module) != 0)
     {
         cerr << "failed to open " << GRALLOC_HARDWARE_MODULE_ID << " module" << endl;
         err = 4;
@@ -80,6 +97,19 @@ int sfconnection_t::init()
 
     chmod(SHAREBUFFER_HANDLE_FILE, 0770);
 
+    release_doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(release_doorbell < 0)
+    {
+        cerr << "failed to create release doorbell: " << strerror(errno) << endl;
+        err = 5;
+        goto quit;
+    }
+
+    // sfdroid works fine without the recording
+    record_env = getenv("SFDROID_RECORD");
+    snapshots_env = getenv("SFDROID_RECORD_SNAPSHOTS");
+    if(record_env) recorder.init(record_env, snapshots_env && strcmp(snapshots_env, "1") == 0);
+
 quit:
     return err;
 }
@@ -88,112 +118,424 @@ void dummy_f(android_native_base_t *base)
 {
 }
 
-int sfconnection_t::wait_for_buffer(int &timedout, bool &is_not_a_buffer)
+// messages shorter than what we know are zero padded
+template<typename T> static void read_message(const struct sb_header_t *header, T &msg)
 {
-    int err = 0;
-    int r;
-    int gerr;
-    char buf[1];
-    ANativeWindowBuffer *buffer = nullptr;
-    native_handle_t *handle = nullptr;
-    int registered = 0;
-    timedout = 0;
+    memset(&msg, 0, sizeof(msg));
+    memcpy(&msg, header, std::min<size_t>(header->size, sizeof(msg)));
+}
+
+int sfconnection_t::handle_hello(const struct sb_header_t *header)
+{
+    struct sb_hello_t hello;
+    struct {
+        struct sb_welcome_t welcome;
+        struct sb_ring_setup_t ring_setup;
+    } reply;
+    size_t reply_size = sizeof(struct sb_welcome_t);
+    int fds[3];
+    int num_fds = 0;
+
+    read_message(header, hello);
+
+    if(hello.version < 1)
+    {
+        cerr << "invalid sharebuffer protocol version: " << hello.version << endl;
+        return 1;
+    }
+
+    recorder.record_connect(hello.version, hello.capabilities);
+
+    protocol_version = std::min<uint32_t>(hello.version, SB_PROTOCOL_VERSION);
+    capabilities = hello.capabilities & SB_SUPPORTED_CAPABILITIES;
 
 #if DEBUG
-    cout << "waiting for notification" << endl;
+    cout << "sharebuffer protocol version " << protocol_version << " capabilities " << capabilities << endl;
 #endif
-    r = recv(fd_client, buf, 1, 0);
-    if(r < 0)
+
+    if((capabilities & SB_CAP_SHM_RING) && ring.create() != 0)
     {
-        if(errno == ETIMEDOUT || errno == EAGAIN || errno == EINTR)
-        {
-            timedout = 1;
-            err = 0;
-            goto quit;
-        }
+        capabilities &= ~SB_CAP_SHM_RING;
+    }
 
-        cerr << "lost client " << strerror(errno) << endl;
-        err = 1;
-        goto quit;
+    memset(&reply, 0, sizeof(reply));
+    reply.welcome.header.type = SB_WELCOME;
+    reply.welcome.header.size = sizeof(reply.welcome);
+    reply.welcome.version = protocol_version;
+    reply.welcome.capabilities = capabilities;
+
+    if(capabilities & SB_CAP_SHM_RING)
+    {
+        reply.ring_setup.header.type = SB_RING_SETUP;
+        reply.ring_setup.header.size = sizeof(reply.ring_setup);
+        reply.ring_setup.shm_size = sizeof(struct sb_shm_t);
+        reply.ring_setup.ring_size = SB_RING_SIZE;
+        reply_size = SB_ALIGN(sizeof(reply.welcome)) + sizeof(reply.ring_setup);
+
+        fds[0] = ring.get_shm_fd();
+        fds[1] = ring.get_post_doorbell();
+        fds[2] = ring.get_ack_doorbell();
+        num_fds = 3;
     }
 
-    if(buf[0] != 0xFF && buf[0] != 0xFE && buf[0] != 0xFD)
+    if(send_message(fd_client, &reply, reply_size, fds, num_fds) < 0)
     {
-#if DEBUG
-        cout << "received post notification" << endl;
-#endif
-        unsigned int index = buf[0];
-        if(index < 0 || index > buffers.size())
+        cerr << "failed to send welcome: " << strerror(errno) << endl;
+        return 2;
+    }
+
+    handshake_done = true;
+    return 0;
+}
+
+int sfconnection_t::handle_layer(const struct sb_header_t *header)
+{
+    struct sb_layer_t layer;
+    sfdroid_event event;
+
+    read_message(header, layer);
+
+    if(layer.length > SB_MAX_LAYER_NAME || sizeof(layer) + layer.length > header->size)
+    {
+        cerr << "invalid layer name length: " << layer.length << endl;
+        return 1;
+    }
+
+    memcpy(event.data.layer_name, (const char*)header + sizeof(layer), layer.length);
+    event.data.layer_name[layer.length] = 0;
+    recorder.record_layer(header->type, event.data.layer_name, layer.length);
+
+    event.type = (header->type == SB_LAYER_NAME) ? LAYER_NAME : LAYER_CLOSE;
+    sfdroid_events_mutex.lock();
+    sfdroid_events.push_back(event);
+    sfdroid_events_mutex.unlock();
+
+    return 0;
+}
+
+int sfconnection_t::handle_new_buffer(const struct sb_header_t *header, const int *fds, int num_fds, int &fds_used)
+{
+    const struct sb_new_buffer_t *msg = (const struct sb_new_buffer_t*)header;
+    buffer_slot_t *slot;
+    union {
+        native_handle_t handle;
+        int handle_storage[sizeof(native_handle_t) / sizeof(int) + MAX_NUM_FDS + MAX_NUM_INTS];
+    } decoded;
+    buffer_info_t info;
+    int gerr;
+
+    if(header->size < sizeof(struct sb_new_buffer_t))
+    {
+        cerr << "new buffer message too short" << endl;
+        return 1;
+    }
+
+    // registered indices can be registered again, new ones come in order
+    if(msg->index > num_buffers || msg->index >= MAX_NUM_BUFFERS)
+    {
+        if(msg->index >= MAX_NUM_BUFFERS) cerr << "all " << MAX_NUM_BUFFERS << " buffer slots are in use, refusing buffer " << msg->index << endl;
+        else cerr << "unexpected buffer index: " << msg->index << " expected at most " << num_buffers << endl;
+        return 2;
+    }
+
+    if(msg->num_fds > (unsigned int)num_fds)
+    {
+        cerr << "missing fds for buffer " << msg->index << endl;
+        return 3;
+    }
+
+    // a slot that is registered again keeps its buffer until the new one is known to be valid
+    if(decode_new_buffer(msg, fds, &decoded.handle, &info) != 0) return 4;
+
+    // lock() hands out the whole mapping, whoever reads the pixels trusts the dimensions
+    if(memfd_buffers && memfd_gralloc_buffer_size(&decoded.handle) < (size_t)info.stride * info.height * bytes_per_pixel(info.pixel_format))
+    {
+        cerr << "buffer " << msg->index << " is smaller than " << info.stride << "x" << info.height << " pixels" << endl;
+        return 4;
+    }
+    fds_used += msg->num_fds;
+
+    slot = &slots[msg->index];
+
+    if(msg->index < num_buffers) replace_buffer(msg->index);
+
+    // gralloc may remember the handle's address, it is registered where it stays
+    memcpy(slot->handle_storage, decoded.handle_storage, sizeof(slot->handle_storage));
+    slot->info = info;
+
+    gerr = gralloc_module->registerBuffer(gralloc_module, &slot->handle);
+    metrics_t::count(COUNTER_BUFFER_REGISTRATIONS);
+    if(gerr)
+    {
+        cerr << "registerBuffer failed: " << strerror(-gerr) << endl;
+        close_handle(&slot->handle);
+        // a replaced slot stays counted, nothing in it may be released again
+        slot->handle.numFds = 0;
+        slot->handle.numInts = 0;
+        slot->registered = false;
+        return 5;
+    }
+    slot->registered = true;
+
+    slot->buffer.width = slot->info.width;
+    slot->buffer.height = slot->info.height;
+    slot->buffer.stride = slot->info.stride;
+    slot->buffer.format = slot->info.pixel_format;
+    slot->buffer.handle = &slot->handle;
+    slot->buffer.common.incRef = dummy_f;
+    slot->buffer.common.decRef = dummy_f;
+    slot->shown = 0;
+
+    send_mutex.lock();
+    if(msg->index == num_buffers) num_buffers++;
+    send_mutex.unlock();
+
+    recorder.record_new_buffer(msg->index, slot->info);
+
+    LOG_D(LOG_SFCONNECTION, "new buffer %u: width %u height %u stride %u pixel_format %d", msg->index, slot->info.width, slot->info.height, slot->info.stride, slot->info.pixel_format);
+
+    return 0;
+}
+
+void sfconnection_t::replace_buffer(uint32_t index)
+{
+    sfdroid_event event;
+
+    LOG_D(LOG_SFCONNECTION, "buffer %u registered again", index);
+
+    // with the events mutex held the main thread can't commit a held frame
+    // of this buffer, and it handles the event before it commits again
+    sfdroid_events_mutex.lock();
+
+    // the producer gave it up, no releases are owed for it anymore
+    send_mutex.lock();
+    if(slots[index].registered)
+    {
+        gralloc_module->unregisterBuffer(gralloc_module, &slots[index].handle);
+        metrics_t::count(COUNTER_BUFFER_UNREGISTRATIONS);
+        close_handle(&slots[index].handle);
+    }
+    slots[index].registered = false;
+    slots[index].shown = 0;
+    drop_fenced_releases(index);
+    send_mutex.unlock();
+
+    // renderers must forget what they know about the old buffer
+    event.type = BUFFER_REPLACED;
+    event.data.buffer.buffer = &slots[index].buffer;
+    event.data.buffer.info = nullptr;
+    event.data.buffer.acquire_fence = -1;
+    event.data.buffer.post_ns = 0;
+    event.data.buffer.frame_id = 0;
+    sfdroid_events.push_back(event);
+    sfdroid_events_mutex.unlock();
+}
+
+int sfconnection_t::handle_message(const struct sb_header_t *header, const int *fds, int num_fds, int &fds_used)
+{
+    struct sb_post_t post;
+
+    if(!handshake_done && header->type != SB_HELLO)
+    {
+        cerr << "expected hello from sharebuffer, got " << header->type << endl;
+        return 1;
+    }
+
+    switch(header->type)
+    {
+        case SB_HELLO:
+            return handle_hello(header);
+        case SB_LAYER_NAME:
+        case SB_LAYER_CLOSE:
+            LOG_D(LOG_SFCONNECTION, "received layer %s event", header->type == SB_LAYER_NAME ? "name" : "close");
+            return handle_layer(header);
+        case SB_NEW_BUFFER:
+            LOG_D(LOG_SFCONNECTION, "received new buffer");
+            return handle_new_buffer(header, fds, num_fds, fds_used);
+        case SB_POST:
+            LOG_D(LOG_SFCONNECTION, "received post notification");
+            read_message(header, post);
+            if(post.index >= num_buffers)
+            {
+                cerr << "invalid index: " << post.index << endl;
+                return 1;
+            }
+            if(post.flags & SB_POST_ACQUIRE_FENCE)
+            {
+                if(!(capabilities & SB_CAP_FENCES) || num_fds < 1)
+                {
+                    cerr << "unexpected acquire fence for buffer " << post.index << endl;
+                    return 1;
+                }
+                pending_posts.push_back(pending_post_t(post.index, false, fds[0], received_ns));
+                recorder.record_post(post.index, SESSION_POST_FENCE, received_ns);
+                fds_used++;
+                return 0;
+            }
+            pending_posts.push_back(pending_post_t(post.index, false, -1, received_ns));
+            recorder.record_post(post.index, 0, received_ns);
+            return 0;
+        default:
+            LOG_D(LOG_SFCONNECTION, "ignoring unknown message %u", header->type);
+            return 0;
+    }
+}
+
+int sfconnection_t::take_ring_posts()
+{
+    struct sb_ring_entry_t entry;
+    int64_t now = monotonic_ns();
+    int r;
+
+    while((r = sbring_t::pop(ring.posts(), ring.get_post_tail(), entry)) > 0)
+    {
+        if(entry.type != SB_POST || entry.index >= num_buffers)
         {
-            cerr << "invalid index: " << index << endl;
-            err = 1;
-            goto quit;
+            cerr << "invalid ring entry: " << entry.type << " " << entry.index << endl;
+            return -1;
         }
 
-        current_buffer = buffers[index];
-        current_info = buffer_infos[index];
+        // producers may stamp posts with the time they queued them
+        if(entry.timestamp_ns <= 0 || entry.timestamp_ns > now) entry.timestamp_ns = now;
+        pending_posts.push_back(pending_post_t(entry.index, true, -1, entry.timestamp_ns));
+        recorder.record_post(entry.index, SESSION_POST_RING, entry.timestamp_ns);
+    }
 
-        err = 0;
-        goto quit;
+    // the ring never holds more than SB_RING_SIZE posts
+    if(r < 0)
+    {
+        cerr << "invalid post ring head" << endl;
+        return -1;
     }
 
-    if(buf[0] == 0xFD)
+    return 0;
+}
+
+// waits for the socket, ring posts and the fences of queued releases, sends
+// the releases whose fence signaled. returns 1 if the socket has something
+// to read, 0 if there are posts or on timeout
+int sfconnection_t::poll_client()
+{
+    vector<struct pollfd> pfd;
+    int64_t deadline_ns;
+    int timeout_ms;
+    int r;
+
+    if(my_have_focus) timeout_ms = SHAREBUFFER_SOCKET_TIMEOUT_US / 1000;
+    else timeout_ms = SHAREBUFFER_SOCKET_FOCUS_LOST_TIMEOUT_S * 1000;
+    deadline_ns = monotonic_ns() + timeout_ms * 1000000LL;
+
+    while(true)
     {
-#if DEBUG
-        cout << "received close event" << endl;
-#endif
-        sfdroid_event event;
+        bool ring_wait = false;
+        int64_t wake_ns = deadline_ns;
+        int64_t release_ns, now;
 
-        r = recv(fd_client, buf, 1, 0);
-        if(r < 0)
+        if(ring.is_active())
         {
-            if(errno == ETIMEDOUT || errno == EAGAIN || errno == EINTR)
-            {
-                timedout = 1;
-                err = 0;
-                goto quit;
-            }
+            if(take_ring_posts() < 0) return -1;
+            if(!pending_posts.empty()) return 0;
+        }
 
-            cerr << "lost client " << strerror(errno) << endl;
-            err = 1;
-            goto quit;
+        release_ns = send_signaled_releases();
+        if(release_ns != 0 && release_ns < wake_ns) wake_ns = release_ns;
+
+        now = monotonic_ns();
+        if(now >= deadline_ns) return 0;
+
+        pfd.resize(2);
+        pfd[0].fd = fd_client;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = release_doorbell;
+        pfd[1].events = POLLIN;
+
+        if(ring.is_active())
+        {
+            // the next round takes what arrived meanwhile
+            if(!sbring_t::prepare_wait(ring.posts(), ring.get_post_tail())) continue;
+            ring_wait = true;
+            pfd.resize(3);
+            pfd[2].fd = ring.get_post_doorbell();
+            pfd[2].events = POLLIN;
         }
 
-        r = recv(fd_client, event.data.layer_name, buf[0], 0);
-        if(r < 0)
+        send_mutex.lock();
+        for(size_t i = 0;i < fenced_releases.size();i++)
         {
-            if(errno == ETIMEDOUT || errno == EAGAIN || errno == EINTR)
-            {
-                timedout = 1;
-                err = 0;
-                goto quit;
-            }
+            struct pollfd fence;
+            fence.fd = fenced_releases[i].fence;
+            fence.events = POLLIN;
+            pfd.push_back(fence);
+        }
+        send_mutex.unlock();
 
-            cerr << "lost client " << strerror(errno) << endl;
-            err = 1;
-            goto quit;
+        for(size_t i = 0;i < pfd.size();i++) pfd[i].revents = 0;
+
+        metrics_t::count(ring_wait ? COUNTER_SYSCALLS_RING : COUNTER_SYSCALLS_SOCKET);
+        r = poll(pfd.data(), pfd.size(), (int)((wake_ns - now + 999999) / 1000000));
+
+        if(ring_wait) sbring_t::finish_wait(ring.posts(), ring.get_post_doorbell());
+
+        if(r < 0 && errno != EINTR)
+        {
+            cerr << "poll failed: " << strerror(errno) << endl;
+            return -1;
         }
 
-        event.data.layer_name[(unsigned int)buf[0]] = 0;
+        if(r > 0 && (pfd[1].revents & POLLIN))
+        {
+            uint64_t count;
 
-        event.type = LAYER_CLOSE;
-        sfdroid_events_mutex.lock();
-        sfdroid_events.push_back(event);
-        sfdroid_events_mutex.unlock();
+            // non blocking, the new fence is polled in the next round
+            do
+            {
+                metrics_t::count(COUNTER_SYSCALLS_SOCKET);
+            } while(read(release_doorbell, &count, sizeof(count)) > 0);
+        }
 
-        is_not_a_buffer = true;
-        err = 0;
-        goto quit;
+        if(r > 0 && (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            if(ring.is_active() && take_ring_posts() < 0) return -1;
+            return 1;
+        }
     }
+}
+
+int sfconnection_t::wait_for_buffer(int &timedout, bool &is_not_a_buffer)
+{
+    TRACE_SCOPE("wait_for_buffer");
+    int err = 0;
+    int r;
+    int fds[MAX_NUM_FDS];
+    int num_fds = 0;
+    int fds_used = 0;
+    unsigned int offset = 0;
+    timedout = 0;
 
-    if(buf[0] == 0xFE)
+    // steady state posts come through the ring, only look at the socket if it
+    // has something. queued releases are waited for in the same poll
+    if(pending_posts.empty() && (ring.is_active() || polls_releases()))
     {
-#if DEBUG
-        cout << "received layer name" << endl;
-#endif
-        sfdroid_event event;
+        r = poll_client();
+        if(r < 0)
+        {
+            err = 1;
+            goto quit;
+        }
 
-        r = recv(fd_client, buf, 1, 0);
+        if(r == 0 && pending_posts.empty())
+        {
+            timedout = 1;
+            err = 0;
+            goto quit;
+        }
+    }
+
+    // a single datagram can carry more than one post
+    if(pending_posts.empty())
+    {
+        LOG_D(LOG_SFCONNECTION, "waiting for notification");
+        r = recv_message(fd_client, msg_buffer, sizeof(msg_buffer), fds, &num_fds);
         if(r < 0)
         {
             if(errno == ETIMEDOUT || errno == EAGAIN || errno == EINTR)
@@ -208,138 +550,347 @@ int sfconnection_t::wait_for_buffer(int &timedout, bool &is_not_a_buffer)
             goto quit;
         }
 
-        r = recv(fd_client, event.data.layer_name, buf[0], 0);
-        if(r < 0)
+        if(r == 0)
         {
-            if(errno == ETIMEDOUT || errno == EAGAIN || errno == EINTR)
+            cerr << "lost client" << endl;
+            err = 1;
+            goto quit;
+        }
+
+        received_ns = monotonic_ns();
+
+        while(offset + sizeof(struct sb_header_t) <= (unsigned int)r)
+        {
+            const struct sb_header_t *header = (const struct sb_header_t*)((const char*)msg_buffer + offset);
+
+            if(header->size < sizeof(struct sb_header_t) || offset + header->size > (unsigned int)r)
             {
-                timedout = 1;
-                err = 0;
+                cerr << "invalid message size: " << header->size << endl;
+                err = 1;
                 goto quit;
             }
 
-            cerr << "lost client " << strerror(errno) << endl;
-            err = 1;
-            goto quit;
+            if(handle_message(header, fds + fds_used, num_fds - fds_used, fds_used) != 0)
+            {
+                err = 1;
+                goto quit;
+            }
+
+            offset += SB_ALIGN(header->size);
         }
+    }
+
+    if(pending_posts.empty())
+    {
+        is_not_a_buffer = true;
+        goto quit;
+    }
+
+    current_index = pending_posts.front().index;
+    current_from_ring = pending_posts.front().from_ring;
+    current_acquire_fence = pending_posts.front().acquire_fence;
+    current_post_ns = pending_posts.front().post_ns;
+    pending_posts.pop_front();
+
+    // one async slice per post, from here to the status
+    current_frame_id = ++frame_seq;
+    TRACE_ASYNC_BEGIN("frame", current_frame_id);
+    TRACE_COUNTER("pending_posts", pending_posts.size());
 
-        event.data.layer_name[(unsigned int)buf[0]] = 0;
+    current_buffer = &slots[current_index].buffer;
+    current_info = slots[current_index].info;
+    if(recorder.is_active()) recorder.record_snapshot(current_index, current_buffer, current_acquire_fence);
 
-        event.type = LAYER_NAME;
-        sfdroid_events_mutex.lock();
-        sfdroid_events.push_back(event);
+    is_not_a_buffer = false;
+
+quit:
+    // fds of messages we didn't understand
+    for(int i = fds_used;i < num_fds;i++)
+    {
+        close(fds[i]);
+    }
+
+    if(err != 0)
+    {
+        drop_client();
+    }
+    return err;
+}
+
+void sfconnection_t::drop_client()
+{
+    if(fd_client >= 0) recorder.record_disconnect();
+
+    send_mutex.lock();
+    // does this also make sense if layer name or layer close failed?
+    if(fd_client >= 0) close(fd_client);
+    fd_client = -1;
+    ring.deinit();
+    send_mutex.unlock();
+
+    remove_buffers();
+}
+
+void sfconnection_t::remove_buffers()
+{
+    sfdroid_event event;
+
+    // the main thread holds the events mutex while it takes send_mutex and
+    // while it commits held frames, which must not see the buffers go away
+    sfdroid_events_mutex.lock();
+    send_mutex.lock();
+    if(num_buffers == 0)
+    {
+        send_mutex.unlock();
         sfdroid_events_mutex.unlock();
+        return;
+    }
 
-        is_not_a_buffer = true;
-        err = 0;
-        goto quit;
+    for(unsigned int i = 0;i < num_buffers;i++)
+    {
+        // a failed registration left nothing to release
+        if(slots[i].registered)
+        {
+            gralloc_module->unregisterBuffer(gralloc_module, &slots[i].handle);
+            metrics_t::count(COUNTER_BUFFER_UNREGISTRATIONS);
+            close_handle(&slots[i].handle);
+        }
+        slots[i].registered = false;
+        slots[i].shown = 0;
     }
 
-    buffer = new ANativeWindowBuffer();
+    drop_fenced_releases(num_buffers);
+    num_buffers = 0;
+    send_mutex.unlock();
 
-#if DEBUG
-    cout << "waiting for handle" << endl;
-#endif
-    r = recv_native_handle(fd_client, &handle, &current_info);
-    if(r < 0)
+    // the slots get reused, renderers must forget what they know about them
+    event.type = BUFFERS_REMOVED;
+    sfdroid_events.push_back(event);
+    sfdroid_events_mutex.unlock();
+
+    clear_pending_posts();
+    current_buffer = nullptr;
+}
+
+void sfconnection_t::clear_pending_posts()
+{
+    for(std::deque<pending_post_t>::iterator it = pending_posts.begin();it != pending_posts.end();it++)
+    {
+        if(it->acquire_fence >= 0) close(it->acquire_fence);
+    }
+    pending_posts.clear();
+}
+
+void sfconnection_t::send_status_and_cleanup()
+{
+    if(fd_client >= 0)
     {
-        if(errno == ETIMEDOUT || errno == EAGAIN)
+        TRACE_SCOPE("send_status");
+        unique_lock<mutex> lock(send_mutex);
+        int r;
+
+        TRACE_ASYNC_END("frame", current_frame_id);
+
+        LOG_D(LOG_SFCONNECTION, "sending status %d for buffer %u", current_status, current_index);
+
+        // answer on the channel the post came in
+        if(current_from_ring)
         {
-            timedout = 1;
-            err = 0;
-            goto quit;
+            struct sb_ring_entry_t entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.type = SB_STATUS;
+            entry.index = current_index;
+            entry.value = current_status;
+
+            if(sbring_t::push(ring.acks(), ring.get_ack_doorbell(), entry))
+            {
+                metrics_t::record(HISTOGRAM_ACK_ROUND_TRIP, monotonic_ns() - current_post_ns);
+                return;
+            }
+
+            // the producer stopped reading acks, a status on the socket would go unseen
+            lock.unlock();
+            cerr << "ack ring full, dropping client" << endl;
+            drop_client();
+            return;
         }
 
-        cerr << "lost client " << strerror(errno) << endl;
-        err = 1;
-        goto quit;
+        r = send_status(fd_client, current_index, current_status);
+        lock.unlock();
+
+        metrics_t::record(HISTOGRAM_ACK_ROUND_TRIP, monotonic_ns() - current_post_ns);
+
+        if(r < 0)
+        {
+            cerr << "lost client" << endl;
+            drop_client();
+        }
     }
- 
-    gerr = gralloc_module->registerBuffer(gralloc_module, handle);
-    if(gerr)
+}
+
+unsigned int sfconnection_t::slot_index(ANativeWindowBuffer *buffer)
+{
+    unsigned int index;
+
+    for(index = 0;index < num_buffers;index++)
     {
-        cerr << "registerBuffer failed: " << strerror(-gerr) << endl;
-        err = 1;
-        goto quit;
+        if(&slots[index].buffer == buffer) break;
     }
 
-    buffer->width = current_info.width;
-    buffer->height = current_info.height;
-    buffer->stride = current_info.stride;
-    buffer->format = current_info.pixel_format;
-    buffer->handle = handle;
-    buffer->common.incRef = dummy_f;
-    buffer->common.decRef = dummy_f;
+    return index;
+}
+
+void sfconnection_t::notify_buffer_shown(ANativeWindowBuffer *buffer)
+{
+    unique_lock<mutex> lock(send_mutex);
+    unsigned int index = slot_index(buffer);
 
-    current_buffer = buffer;
+    // the backend may release it before the status went out
+    if(index < num_buffers) slots[index].shown++;
+}
 
-    buffers.push_back(current_buffer);
-    buffer_infos.push_back(current_info);
+void sfconnection_t::notify_buffer_released(ANativeWindowBuffer *buffer, int release_fence)
+{
+    unique_lock<mutex> lock(send_mutex);
+    unsigned int index = slot_index(buffer);
+    unsigned int posts;
 
-#if DEBUG
-    cout << "buffer info:" << endl;
-    cout << "width: " << current_info.width << " height: " << current_info.height << " stride: " << current_info.stride << " pixel_format: " << current_info.pixel_format << endl;
-#endif
+    // released twice or already gone with its client
+    if(index >= num_buffers || slots[index].shown == 0) goto quit;
+    posts = slots[index].shown;
+    slots[index].shown = 0;
 
-    is_not_a_buffer = false;
+    if(fd_client < 0 || !(capabilities & SB_CAP_BUFFER_RELEASE)) goto quit;
 
-quit:
-    if(err != 0)
+    if(release_fence >= 0 && !(capabilities & SB_CAP_FENCES))
     {
-        if(registered)
+        // the producer can't wait on it. the connection thread sends the
+        // release once it signaled, this thread must not block on it
+        if(!fence_signaled(release_fence))
         {
-            gralloc_module->unregisterBuffer(gralloc_module, handle);
+            uint64_t one = 1;
+
+            LOG_D(LOG_SFCONNECTION, "queueing %u buffer release(s) %u until the fence signaled", posts, index);
+            fenced_releases.push_back(fenced_release_t(index, posts, release_fence, monotonic_ns()));
+            metrics_t::count(COUNTER_SYSCALLS_SOCKET);
+            if(write(release_doorbell, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            {
+                cerr << "failed to ring release doorbell: " << strerror(errno) << endl;
+            }
+            return;
         }
-        // does this also make sense if layer name or layer close failed?
-        close(fd_client);
-        fd_client = -1;
-        remove_buffers();
-        if(buffer) delete buffer;
-        if(handle)
+        close(release_fence);
+        release_fence = -1;
+    }
+
+    send_release(index, posts, release_fence);
+
+quit:
+    if(release_fence >= 0) close(release_fence);
+}
+
+void sfconnection_t::send_release(uint32_t index, unsigned int posts, int release_fence)
+{
+    struct sb_buffer_release_t release;
+
+    LOG_D(LOG_SFCONNECTION, "sending %u buffer release(s) %u%s", posts, index, release_fence >= 0 ? " with fence" : "");
+    // one release per post shown, they all carry the same fence
+    for(unsigned int i = 0;i < posts;i++)
+    {
+        if(ring.is_active() && release_fence < 0)
         {
-            free_handle(handle);
+            struct sb_ring_entry_t entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.type = SB_BUFFER_RELEASE;
+            entry.index = index;
+
+            if(sbring_t::push(ring.acks(), ring.get_ack_doorbell(), entry)) continue;
         }
+
+        memset(&release, 0, sizeof(release));
+        release.header.type = SB_BUFFER_RELEASE;
+        release.header.size = sizeof(release);
+        release.index = index;
+        release.flags = (release_fence >= 0) ? SB_RELEASE_FENCE : 0;
+
+        // a lost client is noticed by the connection thread
+        send_message(fd_client, &release, sizeof(release), &release_fence, (release_fence >= 0) ? 1 : 0);
     }
-    return err;
 }
 
-void sfconnection_t::remove_buffers()
+int64_t sfconnection_t::send_signaled_releases()
 {
-    for(std::vector<ANativeWindowBuffer*>::size_type i = 0;i < buffers.size();i++)
-    {
-        ANativeWindowBuffer *buffer = buffers[i];
-        const native_handle_t *handle = buffer->handle;
+    unique_lock<mutex> lock(send_mutex);
+    int64_t now = monotonic_ns();
+    int64_t next = 0;
 
-        gralloc_module->unregisterBuffer(gralloc_module, handle);
+    for(size_t i = 0;i < fenced_releases.size();)
+    {
+        const fenced_release_t &r = fenced_releases[i];
+        int64_t timeout_ns = r.queued_ns + FENCE_WAIT_TIMEOUT_MS * 1000000LL;
 
-        for(int i=0;i<handle->numFds;i++)
+        if(!fence_signaled(r.fence))
         {
-            close(handle->data[i]);
+            // like wait_fence(), the producer gets it back in the end
+            if(now < timeout_ns)
+            {
+                if(next == 0 || timeout_ns < next) next = timeout_ns;
+                i++;
+                continue;
+            }
+            cerr << "fence not signaled after " << FENCE_WAIT_TIMEOUT_MS << "ms" << endl;
         }
-        free((void*)handle);
 
-        delete buffer;
+        close(r.fence);
+        if(fd_client >= 0) send_release(r.index, r.posts, -1);
+        fenced_releases.erase(fenced_releases.begin() + i);
     }
 
-    buffers.resize(0);
-    buffer_infos.resize(0);
+    return next;
 }
 
-void sfconnection_t::send_status_and_cleanup()
+void sfconnection_t::drop_fenced_releases(unsigned int index)
 {
-    if(fd_client >= 0)
+    for(size_t i = 0;i < fenced_releases.size();)
     {
-#if DEBUG
-        cout << "sending status" << endl;
-#endif
-        if(send_status(fd_client, current_status) < 0)
+        if(index < num_buffers && fenced_releases[i].index != index)
         {
-            cerr << "lost client" << endl;
-            close(fd_client);
-            fd_client = -1;
-            remove_buffers();
+            i++;
+            continue;
         }
+
+        close(fenced_releases[i].fence);
+        fenced_releases.erase(fenced_releases.begin() + i);
+    }
+}
+
+void sfconnection_t::notify_vsync(int64_t timestamp_ns, int64_t period_ns, uint32_t flags)
+{
+    unique_lock<mutex> lock(send_mutex);
+    struct sb_vsync_t vsync;
+
+    if(fd_client < 0 || !(capabilities & SB_CAP_VSYNC)) return;
+
+    if(ring.is_active())
+    {
+        struct sb_ring_entry_t entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.type = SB_VSYNC;
+        entry.value = (int32_t)period_ns;
+        entry.flags = flags;
+        entry.timestamp_ns = timestamp_ns;
+
+        if(sbring_t::push(ring.acks(), ring.get_ack_doorbell(), entry)) return;
     }
+
+    memset(&vsync, 0, sizeof(vsync));
+    vsync.header.type = SB_VSYNC;
+    vsync.header.size = sizeof(vsync);
+    vsync.flags = flags;
+    vsync.timestamp_ns = timestamp_ns;
+    vsync.period_ns = period_ns;
+
+    send_message(fd_client, &vsync, sizeof(vsync), NULL, 0);
 }
 
 buffer_info_t *sfconnection_t::get_current_info()
@@ -366,6 +917,11 @@ int sfconnection_t::wait_for_client()
         goto quit;
     }
 
+    // the client has to say hello first
+    handshake_done = false;
+    protocol_version = 0;
+    capabilities = 0;
+
     update_timeout();
 
 quit:
@@ -394,6 +950,7 @@ void sfconnection_t::update_timeout()
 
 void sfconnection_t::thread_loop()
 {
+    thread_stats_t::register_thread(THREAD_SFCONNECTION, "sfd-sharebuffer");
     running = true;
 
     while(running)
@@ -433,9 +990,16 @@ void sfconnection_t::thread_loop()
                         event.type = BUFFER;
                         event.data.buffer.buffer = current_buffer;
                         event.data.buffer.info = &current_info;
+                        event.data.buffer.acquire_fence = current_acquire_fence;
+                        current_acquire_fence = -1;
+                        event.data.buffer.post_ns = current_post_ns;
+                        event.data.buffer.frame_id = current_frame_id;
+                        TRACE_ASYNC_BEGIN("queued", current_frame_id);
                         sfdroid_events_mutex.lock();
                         sfdroid_events.push_back(event);
                         sfdroid_events_mutex.unlock();
+                        // the main loop might be sleeping until the deadline of a held frame
+                        back_cond.notify_one();
 
                         unique_lock<mutex> lock(notify_mutex);
 
@@ -451,12 +1015,15 @@ void sfconnection_t::thread_loop()
                     {
                         if(((timeout_count + 1) * SHAREBUFFER_SOCKET_TIMEOUT_US) / 1000 >= DUMMY_RENDER_TIMEOUT_MS)
                         {
-                            if(buffers.size() > 0)
+                            if(num_buffers > 0)
                             {
                                 sfdroid_event event;
                                 event.type = NO_BUFFER;
                                 event.data.buffer.buffer = current_buffer;
                                 event.data.buffer.info = &current_info;
+                                event.data.buffer.acquire_fence = -1;
+                                event.data.buffer.post_ns = monotonic_ns();
+                                event.data.buffer.frame_id = 0;
                                 sfdroid_events_mutex.lock();
                                 sfdroid_events.push_back(event);
                                 sfdroid_events_mutex.unlock();
@@ -485,6 +1052,7 @@ void sfconnection_t::thread_loop()
 
         std::this_thread::yield();
     }
+    thread_stats_t::unregister_thread(THREAD_SFCONNECTION);
     thread_exited = true;
 }
 
@@ -522,6 +1090,14 @@ void sfconnection_t::wait_for_event(int timeout)
     back_cond.wait_for(notify_back_lock, std::chrono::milliseconds(timeout));
 }
 
+void sfconnection_t::wait_for_event_ns(int64_t timeout_ns)
+{
+    if(timeout_ns <= 0) return;
+
+    unique_lock<mutex> notify_back_lock(notify_back_mutex);
+    back_cond.wait_for(notify_back_lock, std::chrono::nanoseconds(timeout_ns));
+}
+
 bool sfconnection_t::have_client()
 {
     return (fd_client >= 0);
@@ -539,9 +1115,11 @@ void sfconnection_t::gained_focus()
 
 void sfconnection_t::deinit()
 {
-    remove_buffers();
+    drop_client();
+    recorder.deinit();
+    if(release_doorbell >= 0) close(release_doorbell);
+    release_doorbell = -1;
     if(fd_pass_socket >= 0) close(fd_pass_socket);
-    if(fd_client >= 0) close(fd_client);
     unlink(SHAREBUFFER_HANDLE_FILE);
 }
 
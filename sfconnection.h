@@ -5,6 +5,7 @@
 #include <atomic>
 #include <condition_variable>
 #include <vector>
+#include <deque>
 #include <mutex>
 
 #include <hardware/hardware.h>
@@ -12,18 +13,21 @@
 #include <system/window.h>
 
 #include "sfdroid_defs.h"
+#include "sbring.h"
+#include "session_recorder.h"
 
 extern gralloc_module_t *gralloc_module;
 
 class sfconnection_t {
     public:
-        sfconnection_t() : current_status(0), fd_pass_socket(-1), fd_client(-1), running(false), current_buffer(nullptr), timeout_count(0), my_have_focus(true), notified(false) {}
+        sfconnection_t() : current_status(0), fd_pass_socket(-1), fd_client(-1), handshake_done(false), protocol_version(0), capabilities(0), running(false), current_buffer(nullptr), current_index(0), current_from_ring(false), current_acquire_fence(-1), current_post_ns(0), received_ns(0), current_frame_id(0), frame_seq(0), timeout_count(0), my_have_focus(true), notified(false), release_doorbell(-1), memfd_buffers(false), num_buffers(0) {}
         int init();
         void deinit();
         int wait_for_client();
         buffer_info_t *get_current_info();
         ANativeWindowBuffer *get_current_buffer();
         void wait_for_event(int timeout);
+        void wait_for_event_ns(int64_t timeout_ns);
         void start_thread();
         void thread_loop();
         void stop_thread();
@@ -31,6 +35,14 @@ class sfconnection_t {
         bool have_client();
         bool have_focus() { return my_have_focus; }
         void notify_buffer_done(int failed);
+        // called from the main thread before notify_buffer_done(0) for a
+        // post, every post shown gets its own release
+        void notify_buffer_shown(ANativeWindowBuffer *buffer);
+        // called from the main thread when the compositor released a buffer,
+        // takes over release_fence (-1 if there is none)
+        void notify_buffer_released(ANativeWindowBuffer *buffer, int release_fence);
+        // called from the main thread for every refresh of the host display
+        void notify_vsync(int64_t timestamp_ns, int64_t period_ns, uint32_t flags);
 
         void remove_buffers();
 
@@ -38,29 +50,107 @@ class sfconnection_t {
         void gained_focus();
 
     private:
+        struct pending_post_t
+        {
+            pending_post_t(uint32_t i, bool r, int f, int64_t t) : index(i), from_ring(r), acquire_fence(f), post_ns(t) {}
+            uint32_t index;
+            bool from_ring;
+            int acquire_fence;
+            int64_t post_ns;
+        };
+
+        // a release whose fence the producer can't wait on
+        struct fenced_release_t
+        {
+            fenced_release_t(uint32_t i, unsigned int p, int f, int64_t t) : index(i), posts(p), fence(f), queued_ns(t) {}
+            uint32_t index;
+            unsigned int posts;
+            int fence;
+            int64_t queued_ns;
+        };
+
         int wait_for_buffer(int &timedout, bool &is_not_a_buffer);
+        int poll_client();
+        bool polls_releases() { return (capabilities & SB_CAP_BUFFER_RELEASE) && !(capabilities & SB_CAP_FENCES); }
+        int take_ring_posts();
+        void drop_client();
+        void clear_pending_posts();
+        int handle_message(const struct sb_header_t *header, const int *fds, int num_fds, int &fds_used);
+        int handle_hello(const struct sb_header_t *header);
+        int handle_layer(const struct sb_header_t *header);
+        int handle_new_buffer(const struct sb_header_t *header, const int *fds, int num_fds, int &fds_used);
+        // unregisters the buffer in a slot that is about to be registered again
+        void replace_buffer(uint32_t index);
         void send_status_and_cleanup();
+        // with send_mutex held, num_buffers if it isn't one of ours
+        unsigned int slot_index(ANativeWindowBuffer *buffer);
+        // with send_mutex held, release_fence has signaled or is -1
+        void send_release(uint32_t index, unsigned int posts, int release_fence);
+        // on the connection thread, sends the queued releases whose fence
+        // signaled, returns when the next one times out or 0
+        int64_t send_signaled_releases();
+        // with send_mutex held, those of slot index, of every slot if index >= num_buffers
+        void drop_fenced_releases(unsigned int index);
         int current_status;
         bool thread_exited;
 
         int fd_pass_socket; // listen for surfaceflinger
         int fd_client; // the client (sharebuffer module)
 
+        bool handshake_done;
+        uint32_t protocol_version;
+        uint32_t capabilities;
+        uint64_t msg_buffer[SB_MAX_DATAGRAM_SIZE / sizeof(uint64_t)];
+        std::deque<pending_post_t> pending_posts;
+        sbring_t ring;
+        session_recorder_t recorder; // SFDROID_RECORD
+
         std::thread my_thread;
         std::atomic<bool> running;
         std::condition_variable buffer_cond;
         std::condition_variable back_cond;
         std::mutex notify_mutex, notify_back_mutex;
+        // fd_client and the ack ring are used by the main thread for releases too
+        std::mutex send_mutex;
 
         buffer_info_t current_info;
         ANativeWindowBuffer *current_buffer;
+        uint32_t current_index;
+        bool current_from_ring;
+        int current_acquire_fence; // handed to the main thread with the event
+        int64_t current_post_ns;
+        int64_t received_ns; // when the datagram being parsed arrived
+        int32_t current_frame_id;
+        int32_t frame_seq;
         unsigned int timeout_count;
 
         bool my_have_focus;
         bool notified;
 
-        std::vector<ANativeWindowBuffer*> buffers;
-        std::vector<buffer_info_t> buffer_infos;
+        // queued by the main thread, sent by the connection thread once the
+        // fence signaled. the doorbell wakes it for a new fence
+        std::vector<fenced_release_t> fenced_releases;
+        int release_doorbell;
+
+        // buffers are decoded straight into preallocated slots,
+        // slot i holds the buffer the client registered as index i
+        struct buffer_slot_t
+        {
+            ANativeWindowBuffer buffer;
+            buffer_info_t info;
+            // posts shown and not released yet, the backends release a
+            // buffer once no matter how often it was shown in a row
+            unsigned int shown;
+            bool registered; // false after a failed registration, nothing to release
+            union {
+                native_handle_t handle;
+                int handle_storage[sizeof(native_handle_t) / sizeof(int) + MAX_NUM_FDS + MAX_NUM_INTS];
+            };
+        };
+
+        bool memfd_buffers; // SFDROID_GRALLOC=memfd, the handles say how big they are
+        buffer_slot_t slots[MAX_NUM_BUFFERS];
+        unsigned int num_buffers;
 };
 
 #endif
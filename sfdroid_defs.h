@@ -1,22 +1,53 @@
 #ifndef __SFDROID_DEFS_H__
 #define __SFDROID_DEFS_H__
 
+#include "sharebuffer_protocol.h"
+
 #define SFDROID_ROOT "/tmp/sfdroid"
 #define SHAREBUFFER_HANDLE_FILE (SFDROID_ROOT "/gralloc_buffer_handle")
 #define SENSORS_HANDLE_FILE (SFDROID_ROOT "/sensors_handle")
 #define APP_HELPERS_HANDLE_FILE (SFDROID_ROOT "/app_helpers_handle")
 #define AM_START_STILL_RUNNING_FILE (SFDROID_ROOT "/to_front_still_processing")
+#define METRICS_FILE (SFDROID_ROOT "/stats")
+// written when sfdroid exits, outside of SFDROID_ROOT which is removed then
+#define JANK_FILE "/tmp/sfdroid_jank"
+
+// SFDROID_TRACE=1
+#define TRACE_MARKER_FILE "/sys/kernel/tracing/trace_marker"
+#define TRACE_MARKER_FILE_DEBUGFS "/sys/kernel/debug/tracing/trace_marker"
+#define TRACE_MAX_MARKER_LENGTH 256
+
+// SFDROID_LOG, see logger.h
+#define LOG_RING_SIZE 1024 // power of two
+#define LOG_MAX_MESSAGE_LENGTH 200
+#define LOG_FLUSH_INTERVAL_MS 20
 
 // hmmm
-#define MAX_NUM_FDS 32
-#define MAX_NUM_INTS 32
+#define MAX_NUM_FDS SB_MAX_FDS
+#define MAX_NUM_INTS SB_MAX_INTS
+
+// slots in the buffer arena of sfconnection_t
+#define MAX_NUM_BUFFERS 64
 
 #define DUMMY_RENDER_TIMEOUT_MS 250
 
+// how often the main loop adds up the cpu time of all threads
+#define THREAD_STATS_INTERVAL_MS 1000
+
+// longer gaps between frames mean the app was idle, not janky
+#define JANK_IDLE_GAP_MS 250
+
+// how long to wait on a fence when the compositor can't do it for us
+#define FENCE_WAIT_TIMEOUT_MS 1000
+
 #define SHAREBUFFER_SOCKET_TIMEOUT_US 250000
 #define SHAREBUFFER_SOCKET_FOCUS_LOST_TIMEOUT_S 60*60*24
 #define SENSOR_SOCKET_TIMEOUT_US 250000
 #define SENSOR_SOCKET_FOCUS_LOST_TIMEOUT_S 60*60*24
+// a sensor backend that failed to start is tried again after this long
+#define SENSOR_BACKEND_RETRY_MS 5000
+// the answer to get: while the backend isn't there, it doesn't parse as a sample
+#define SENSOR_UNAVAILABLE_ANSWER "unavailable"
 
 #define APP_SOCKET_TIMEOUT_S 60*60*24
 
@@ -26,6 +57,20 @@
 
 #define ACCELEROMETER 0
 
+// SFDROID_PRESENT=null|file, there is no compositor to ask for the output
+#define HEADLESS_WIDTH 720
+#define HEADLESS_HEIGHT 1280
+#define HEADLESS_REFRESH 60000 // mHz
+// default for SFDROID_PRESENT_FILE, see file_backend.h
+#define FRAMES_FILE (SFDROID_ROOT "/frames")
+// SFDROID_RECORD_SNAPSHOTS=1, see session_recorder.h
+#define SESSION_SNAPSHOT_SCALE 4
+#define SESSION_SNAPSHOT_INTERVAL_MS 1000
+
+// defaults for SFDROID_SENSORS=iio
+#define IIO_SYSFS_ROOT "/sys/bus/iio/devices"
+#define IIO_DEV_ROOT "/dev"
+
 #include <cstdint>
 
 struct buffer_info_t
@@ -39,9 +84,16 @@ struct buffer_info_t
 #include <hardware/gralloc.h>
 #include <hardware/hardware.h>
 
-int recv_native_handle(int fd, native_handle_t **handle, struct buffer_info_t *info);
-int send_status(int fd, int failed);
-void free_handle(native_handle_t *handle);
+int recv_message(int fd, void *buffer, size_t size, int *fds, int *num_fds);
+int send_message(int fd, const void *buffer, size_t size, const int *fds, int num_fds);
+int decode_new_buffer(const struct sb_new_buffer_t *msg, const int *fds, native_handle_t *handle, struct buffer_info_t *info);
+int send_status(int fd, uint32_t index, int failed);
+void close_handle(const native_handle_t *handle);
+int wait_fence(int fd, int timeout_ms);
+// doesn't wait, false while the fence is pending
+bool fence_signaled(int fd);
+// 0 for formats we can't read
+uint32_t bytes_per_pixel(int32_t pixel_format);
 
 enum sfdroid_event_type
 {
@@ -50,6 +102,8 @@ enum sfdroid_event_type
     BUFFER = 2,
     NO_BUFFER = 3,
     LAST_WINDOW_CLOSED = 4,
+    BUFFERS_REMOVED = 5,
+    BUFFER_REPLACED = 6, // the client registered its index again, data.buffer.buffer
 };
 
 #include <system/window.h>
@@ -63,6 +117,9 @@ struct sfdroid_event
         struct {
             ANativeWindowBuffer *buffer;
             buffer_info_t *info;
+            int acquire_fence; // -1 if the buffer is ready, closed by the main loop
+            int64_t post_ns; // when the post arrived, or when the producer queued it
+            int32_t frame_id; // cookie for trace markers
         } buffer;
     } data;
 };
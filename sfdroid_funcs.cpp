@@ -19,104 +19,215 @@
  */
 
 #include "sfdroid_defs.h"
+#include "metrics.h"
 
 #include <sys/socket.h>
+#include <poll.h>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 using namespace std;
 
-int recv_native_handle(int fd, native_handle_t **handle, struct buffer_info_t *info)
+int recv_message(int fd, void *buffer, size_t size, int *fds, int *num_fds)
 {
     struct msghdr socket_message;
     struct iovec io_vector[1];
     struct cmsghdr *control_message = NULL;
-    unsigned int buffer_size = sizeof(struct buffer_info_t) + sizeof(native_handle_t) + sizeof(int)*(MAX_NUM_FDS + MAX_NUM_INTS);
-    unsigned int handle_size = sizeof(native_handle_t) + sizeof(int)*(MAX_NUM_FDS + MAX_NUM_INTS);
-    char message_buffer[buffer_size];
     char ancillary_buffer[CMSG_SPACE(sizeof(int) * MAX_NUM_FDS)];
+    ssize_t r;
 
-    *handle = (native_handle_t*)malloc(handle_size);
-    if(!(*handle)) return -1;
+    *num_fds = 0;
 
     memset(&socket_message, 0, sizeof(struct msghdr));
-    memset(ancillary_buffer, 0, CMSG_SPACE(sizeof(int) * MAX_NUM_FDS));
 
-    io_vector[0].iov_base = message_buffer;
-    io_vector[0].iov_len = buffer_size;
+    io_vector[0].iov_base = buffer;
+    io_vector[0].iov_len = size;
     socket_message.msg_iov = io_vector;
     socket_message.msg_iovlen = 1;
 
     socket_message.msg_control = ancillary_buffer;
-    socket_message.msg_controllen = CMSG_SPACE(sizeof(int) * MAX_NUM_FDS);
+    socket_message.msg_controllen = sizeof(ancillary_buffer);
 
-    control_message = CMSG_FIRSTHDR(&socket_message);
-    control_message->cmsg_len = socket_message.msg_controllen;
-    control_message->cmsg_level = SOL_SOCKET;
-    control_message->cmsg_type = SCM_RIGHTS;
-
-    if(recvmsg(fd, &socket_message, MSG_CMSG_CLOEXEC) < 0)
+    metrics_t::count(COUNTER_SYSCALLS_SOCKET);
+    r = recvmsg(fd, &socket_message, MSG_CMSG_CLOEXEC);
+    if(r < 0)
     {
-        if(errno != ETIMEDOUT && errno != EAGAIN) cerr << "recvmsg failed: " << strerror(errno) << endl;
-        free(*handle);
-        *handle = NULL;
+        if(errno != ETIMEDOUT && errno != EAGAIN && errno != EINTR) cerr << "recvmsg failed: " << strerror(errno) << endl;
         return -1;
     }
 
-    memcpy(info, message_buffer, sizeof(struct buffer_info_t));
-    memcpy(*handle, message_buffer + sizeof(struct buffer_info_t), sizeof(native_handle_t));
+    for(control_message = CMSG_FIRSTHDR(&socket_message);control_message != NULL;control_message = CMSG_NXTHDR(&socket_message, control_message))
+    {
+        if(control_message->cmsg_level == SOL_SOCKET && control_message->cmsg_type == SCM_RIGHTS)
+        {
+            int n = (control_message->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds + *num_fds, CMSG_DATA(control_message), n * sizeof(int));
+            *num_fds += n;
+        }
+    }
 
-    if((*handle)->numFds > MAX_NUM_FDS)
+    if(socket_message.msg_flags & (MSG_CTRUNC | MSG_TRUNC))
     {
-        cerr << "too less space reserved for fds: " << (*handle)->numFds << " > " << MAX_NUM_FDS << endl;
-        free(*handle);
-        *handle = NULL;
+        cerr << "message or ancillary data truncated" << endl;
+        for(int i=0;i<*num_fds;i++) close(fds[i]);
+        *num_fds = 0;
+        errno = EMSGSIZE;
         return -1;
     }
 
-    if((*handle)->numInts > MAX_NUM_INTS)
+    return r;
+}
+
+int send_message(int fd, const void *buffer, size_t size, const int *fds, int num_fds)
+{
+    struct msghdr socket_message;
+    struct iovec io_vector[1];
+    struct cmsghdr *control_message = NULL;
+    char ancillary_buffer[CMSG_SPACE(sizeof(int) * MAX_NUM_FDS)];
+
+    if(num_fds > MAX_NUM_FDS)
     {
-        cerr << "too less space reserved for ints: " << (*handle)->numInts << " > " << MAX_NUM_INTS << endl;
-        free(*handle);
-        *handle = NULL;
+        errno = EINVAL;
         return -1;
     }
 
-    *handle = (native_handle_t*)realloc(*handle, sizeof(native_handle_t) + sizeof(int)*((*handle)->numFds + (*handle)->numInts));
+    memset(&socket_message, 0, sizeof(struct msghdr));
 
-    memcpy((char*)*handle + sizeof(native_handle_t), message_buffer + sizeof(struct buffer_info_t) + sizeof(native_handle_t), sizeof(int)*((*handle)->numFds + (*handle)->numInts));
+    io_vector[0].iov_base = (void*)buffer;
+    io_vector[0].iov_len = size;
+    socket_message.msg_iov = io_vector;
+    socket_message.msg_iovlen = 1;
 
-    if(socket_message.msg_flags & MSG_CTRUNC)
+    if(num_fds > 0)
     {
-        cerr << "not enough space in the ancillary buffer" << endl;
-        free(*handle);
-        *handle = NULL;
+        memset(ancillary_buffer, 0, sizeof(ancillary_buffer));
+        socket_message.msg_control = ancillary_buffer;
+        socket_message.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+
+        control_message = CMSG_FIRSTHDR(&socket_message);
+        control_message->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+        control_message->cmsg_level = SOL_SOCKET;
+        control_message->cmsg_type = SCM_RIGHTS;
+        memcpy(CMSG_DATA(control_message), fds, sizeof(int) * num_fds);
+    }
+
+    metrics_t::count(COUNTER_SYSCALLS_SOCKET);
+    return sendmsg(fd, &socket_message, MSG_NOSIGNAL);
+}
+
+int decode_new_buffer(const struct sb_new_buffer_t *msg, const int *fds, native_handle_t *handle, struct buffer_info_t *info)
+{
+    if(msg->num_fds > MAX_NUM_FDS)
+    {
+        cerr << "too less space reserved for fds: " << msg->num_fds << " > " << MAX_NUM_FDS << endl;
         return -1;
     }
 
-    for(int i=0;i<(*handle)->numFds;i++)
+    if(msg->num_ints > MAX_NUM_INTS)
     {
-        ((native_handle_t*)(*handle))->data[i] = ((int*)CMSG_DATA(control_message))[i];
+        cerr << "too less space reserved for ints: " << msg->num_ints << " > " << MAX_NUM_INTS << endl;
+        return -1;
     }
 
+    // ints_offset comes from the client, the sum could wrap around
+    if(msg->ints_offset < sizeof(struct sb_new_buffer_t) || msg->ints_offset > msg->header.size ||
+        sizeof(int) * msg->num_ints > msg->header.size - msg->ints_offset)
+    {
+        cerr << "invalid native handle layout" << endl;
+        return -1;
+    }
+
+    // handle has room for MAX_NUM_FDS + MAX_NUM_INTS
+    handle->version = sizeof(native_handle_t);
+    handle->numFds = msg->num_fds;
+    handle->numInts = msg->num_ints;
+    memcpy(handle->data, fds, sizeof(int) * msg->num_fds);
+    memcpy(handle->data + msg->num_fds, (const char*)msg + msg->ints_offset, sizeof(int) * msg->num_ints);
+
+    info->width = msg->width;
+    info->height = msg->height;
+    info->stride = msg->stride;
+    info->pixel_format = msg->pixel_format;
+
     return 0;
 }
 
-int send_status(int fd, int failed)
+int send_status(int fd, uint32_t index, int failed)
 {
-    char message_buffer[3];
-    if(failed) memcpy(message_buffer, "FA", sizeof(message_buffer));
-    else memcpy(message_buffer, "OK", sizeof(message_buffer));
+    struct sb_status_t status;
 
-    return send(fd, message_buffer, sizeof(message_buffer), MSG_NOSIGNAL);
+    memset(&status, 0, sizeof(status));
+    status.header.type = SB_STATUS;
+    status.header.size = sizeof(status);
+    status.index = index;
+    status.failed = failed;
+
+    return send_message(fd, &status, sizeof(status), NULL, 0);
 }
 
-void free_handle(native_handle_t *handle)
+void close_handle(const native_handle_t *handle)
 {
     for(int i=0;i<handle->numFds;i++)
     {
         close(handle->data[i]);
     }
-    free((void*)handle);
+}
+
+
+// sync_file and eventfd fences both poll readable once signaled
+int wait_fence(int fd, int timeout_ms)
+{
+    struct pollfd pfd;
+    int r;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    do
+    {
+        r = poll(&pfd, 1, timeout_ms);
+    } while(r < 0 && errno == EINTR);
+
+    if(r < 0)
+    {
+        cerr << "waiting for fence failed: " << strerror(errno) << endl;
+        return -1;
+    }
+
+    if(r == 0)
+    {
+        cerr << "fence not signaled after " << timeout_ms << "ms" << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+bool fence_signaled(int fd)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+uint32_t bytes_per_pixel(int32_t pixel_format)
+{
+    switch(pixel_format)
+    {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+        case HAL_PIXEL_FORMAT_BGRA_8888:
+            return 4;
+        case HAL_PIXEL_FORMAT_RGB_888:
+            return 3;
+        case HAL_PIXEL_FORMAT_RGB_565:
+            return 2;
+        default:
+            return 0;
+    }
 }
 
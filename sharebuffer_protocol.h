@@ -0,0 +1,211 @@
+#ifndef __SHAREBUFFER_PROTOCOL_H__
+#define __SHAREBUFFER_PROTOCOL_H__
+
+// protocol between the sharebuffer module in android and sfconnection_t.
+//
+// the socket at SHAREBUFFER_HANDLE_FILE is SOCK_SEQPACKET. every datagram
+// carries one or more messages, each one starts with a sb_header_t and the
+// next one follows at SB_ALIGN(size). file descriptors of all messages in a
+// datagram (sb_new_buffer_t, fenced sb_post_t) are passed in one SCM_RIGHTS
+// array, in message order.
+//
+// buffers are registered with sb_new_buffer_t, new indices in order from 0.
+// registering an index again replaces its buffer (e.g. after a resize), no
+// release is sent for the old one anymore.
+//
+// the first message from the producer has to be sb_hello_t, the renderer
+// answers with sb_welcome_t carrying the version and capabilities both sides
+// support. unknown message types are skipped and messages shorter than the
+// struct the receiver knows are zero padded, so fields can be appended to
+// the end of a message without breaking older peers.
+//
+// with SB_CAP_SHM_RING the welcome is followed by sb_ring_setup_t in the same
+// datagram. from then on posts of already registered buffers can go through
+// the shared memory ring instead of the socket, every post is answered on
+// the channel it arrived on. a buffer's first post always goes through the
+// socket together with or after its sb_new_buffer_t. a producer that lets
+// the ack ring fill up so that a status doesn't fit is disconnected.
+//
+// with SB_CAP_BUFFER_RELEASE every post answered with failed == 0 is later
+// followed by exactly one sb_buffer_release_t once the compositor stopped
+// reading the buffer, the producer must not render into it before that.
+// a post answered with failed != 0 was never shown and is free right away.
+// releases go through the ack ring if there is one, the socket if it is full.
+//
+// with SB_CAP_FENCES a sb_post_t with SB_POST_ACQUIRE_FENCE carries a sync
+// fence fd (sync_file, eventfd for testing, anything that polls readable once
+// signaled), the producer can post as soon as its rendering is queued. a
+// sb_buffer_release_t with SB_RELEASE_FENCE carries the fence the compositor
+// signals when it stopped reading. fds can't go through the ring, so fenced
+// posts and releases always use the socket.
+//
+// with SB_CAP_VSYNC the renderer sends a sb_vsync_t for every refresh of the
+// output it learns about while it is showing frames, through the ack ring if
+// there is one and it has room, the socket otherwise. timestamps are
+// CLOCK_MONOTONIC, both sides share the kernel.
+
+#include <stdint.h>
+
+#define SB_PROTOCOL_VERSION 1
+
+#define SB_MAX_DATAGRAM_SIZE 4096
+#define SB_MAX_FDS 32
+#define SB_MAX_INTS 32
+#define SB_MAX_LAYER_NAME 1023
+
+#define SB_ALIGN(size) (((size) + 7) & ~7u)
+
+enum sb_message_type
+{
+    SB_HELLO = 1,       // producer -> renderer
+    SB_WELCOME = 2,     // renderer -> producer
+    SB_LAYER_NAME = 3,  // producer -> renderer
+    SB_LAYER_CLOSE = 4, // producer -> renderer
+    SB_NEW_BUFFER = 5,  // producer -> renderer, registers a buffer
+    SB_POST = 6,        // producer -> renderer, shows a registered buffer
+    SB_STATUS = 7,      // renderer -> producer, answers every SB_POST
+    SB_RING_SETUP = 8,  // renderer -> producer, fds: shm, post doorbell, ack doorbell
+    SB_BUFFER_RELEASE = 9, // renderer -> producer, the compositor is done with a buffer
+    SB_VSYNC = 10,      // renderer -> producer, timing of the host display
+};
+
+// bits for sb_hello_t/sb_welcome_t capabilities
+enum sb_capability
+{
+    SB_CAP_NONE = 0,
+    SB_CAP_SHM_RING = 1 << 0,
+    SB_CAP_BUFFER_RELEASE = 1 << 1,
+    SB_CAP_FENCES = 1 << 2,
+    SB_CAP_VSYNC = 1 << 3,
+};
+
+#define SB_SUPPORTED_CAPABILITIES (SB_CAP_SHM_RING | SB_CAP_BUFFER_RELEASE | SB_CAP_FENCES | SB_CAP_VSYNC)
+
+struct sb_header_t
+{
+    uint32_t type;
+    uint32_t size; // including the header, without padding
+};
+
+struct sb_hello_t
+{
+    struct sb_header_t header;
+    uint32_t version;
+    uint32_t capabilities;
+};
+
+struct sb_welcome_t
+{
+    struct sb_header_t header;
+    uint32_t version;
+    uint32_t capabilities;
+};
+
+// SB_LAYER_NAME and SB_LAYER_CLOSE, the name follows the struct, not terminated
+struct sb_layer_t
+{
+    struct sb_header_t header;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+struct sb_new_buffer_t
+{
+    struct sb_header_t header;
+    uint32_t index;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    int32_t pixel_format;
+    uint32_t num_fds;
+    uint32_t num_ints;
+    uint32_t ints_offset; // from the start of the message
+};
+
+// sb_post_t flags
+#define SB_POST_ACQUIRE_FENCE (1 << 0)
+
+struct sb_post_t
+{
+    struct sb_header_t header;
+    uint32_t index;
+    uint32_t flags;
+};
+
+struct sb_status_t
+{
+    struct sb_header_t header;
+    uint32_t index;
+    int32_t failed;
+};
+
+// sb_buffer_release_t flags
+#define SB_RELEASE_FENCE (1 << 0)
+
+struct sb_buffer_release_t
+{
+    struct sb_header_t header;
+    uint32_t index;
+    uint32_t flags;
+};
+
+// sb_vsync_t flags
+#define SB_VSYNC_EXACT (1 << 0) // from presentation feedback, not estimated from frame callbacks
+
+struct sb_vsync_t
+{
+    struct sb_header_t header;
+    uint32_t flags;
+    uint32_t reserved;
+    int64_t timestamp_ns; // the last vsync
+    int64_t period_ns;
+};
+
+struct sb_ring_setup_t
+{
+    struct sb_header_t header;
+    uint32_t shm_size;
+    uint32_t ring_size;
+};
+
+// shared memory layout for SB_CAP_SHM_RING.
+//
+// each ring has exactly one writer. the writer fills entries[head % SB_RING_SIZE]
+// and then advances head, the reader advances tail. before sleeping on its
+// doorbell eventfd the reader sets waiting and checks the ring once more,
+// the writer only writes to the doorbell when waiting is set, so steady state
+// traffic does not need any syscalls.
+
+#define SB_RING_MAGIC 0x53424652
+#define SB_RING_SIZE 16
+
+struct sb_ring_entry_t
+{
+    uint32_t type; // SB_POST, SB_STATUS, SB_BUFFER_RELEASE or SB_VSYNC
+    uint32_t index;
+    int32_t value; // failed for SB_STATUS, period_ns for SB_VSYNC
+    uint32_t flags;
+    int64_t timestamp_ns;
+};
+
+struct sb_ring_t
+{
+    uint32_t head;
+    uint32_t pad0[15];
+    uint32_t tail;
+    uint32_t waiting;
+    uint32_t pad1[14];
+    struct sb_ring_entry_t entries[SB_RING_SIZE];
+};
+
+struct sb_shm_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pad[14];
+    struct sb_ring_t posts; // producer -> renderer
+    struct sb_ring_t acks;  // renderer -> producer
+};
+
+#endif
+
@@ -0,0 +1,98 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <cstring>
+
+#include <pthread.h>
+
+#include "thread_stats.h"
+#include "sfdroid_defs.h"
+#include "metrics.h"
+
+using namespace std;
+
+#define THREAD_STATS_INTERVAL_NS (THREAD_STATS_INTERVAL_MS * 1000000LL)
+
+mutex thread_stats_t::stats_mutex;
+bool thread_stats_t::registered[NUM_THREADS];
+clockid_t thread_stats_t::clocks[NUM_THREADS];
+int64_t thread_stats_t::last_cpu_ns[NUM_THREADS];
+int64_t thread_stats_t::last_sample_ns(0);
+
+void thread_stats_t::register_thread(sfdroid_thread thread, const char *name)
+{
+    unique_lock<mutex> lock(stats_mutex);
+    int r;
+
+    r = pthread_setname_np(pthread_self(), name);
+    if(r != 0) cerr << "failed to name thread " << name << ": " << strerror(r) << endl;
+
+    r = pthread_getcpuclockid(pthread_self(), &clocks[thread]);
+    if(r != 0)
+    {
+        cerr << "no cpu clock for thread " << name << ": " << strerror(r) << endl;
+        return;
+    }
+
+    registered[thread] = true;
+    last_cpu_ns[thread] = 0;
+    sample_thread(thread, CLOCK_THREAD_CPUTIME_ID);
+}
+
+void thread_stats_t::unregister_thread(sfdroid_thread thread)
+{
+    unique_lock<mutex> lock(stats_mutex);
+
+    if(!registered[thread]) return;
+
+    sample_thread(thread, CLOCK_THREAD_CPUTIME_ID);
+    registered[thread] = false;
+}
+
+void thread_stats_t::sample_thread(sfdroid_thread thread, clockid_t clock)
+{
+    struct timespec ts;
+    int64_t cpu_ns;
+
+    if(clock_gettime(clock, &ts) != 0) return;
+
+    cpu_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    // the first sample of a thread only sets the start
+    if(last_cpu_ns[thread] != 0 && cpu_ns > last_cpu_ns[thread])
+    {
+        metrics_t::count((metric_counter)(COUNTER_CPU_US_MAIN + thread), (cpu_ns - last_cpu_ns[thread]) / 1000);
+    }
+    // sub microsecond rests are carried over
+    last_cpu_ns[thread] = (last_cpu_ns[thread] != 0) ? last_cpu_ns[thread] + (cpu_ns - last_cpu_ns[thread]) / 1000 * 1000 : cpu_ns;
+}
+
+void thread_stats_t::sample(int64_t now_ns)
+{
+    // reading another thread's cpu clock is a syscall, no need to do it every frame
+    if(now_ns - last_sample_ns < THREAD_STATS_INTERVAL_NS) return;
+    last_sample_ns = now_ns;
+
+    unique_lock<mutex> lock(stats_mutex);
+    for(int i=0;i<NUM_THREADS;i++)
+    {
+        if(registered[i]) sample_thread((sfdroid_thread)i, clocks[i]);
+    }
+}
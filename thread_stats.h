@@ -0,0 +1,41 @@
+#ifndef __THREAD_STATS_H__
+#define __THREAD_STATS_H__
+
+#include <cstdint>
+#include <mutex>
+
+#include <time.h>
+
+// in the order of the COUNTER_CPU_US_* metrics
+enum sfdroid_thread
+{
+    THREAD_MAIN = 0,
+    THREAD_SFCONNECTION,
+    THREAD_SENSORS,
+    THREAD_LOGGER,
+    NUM_THREADS
+};
+
+// names the threads and adds the cpu time they use to the stats file.
+// the main loop samples every thread's cpu clock once per
+// THREAD_STATS_INTERVAL_MS, so per frame numbers are averages over that.
+class thread_stats_t {
+    public:
+        // on the thread itself, name shows up in top and /proc (15 characters)
+        static void register_thread(sfdroid_thread thread, const char *name);
+        // on the thread itself right before it ends, counts what is left
+        static void unregister_thread(sfdroid_thread thread);
+        // from the main loop
+        static void sample(int64_t now_ns);
+
+    private:
+        static void sample_thread(sfdroid_thread thread, clockid_t clock);
+
+        static std::mutex stats_mutex;
+        static bool registered[NUM_THREADS];
+        static clockid_t clocks[NUM_THREADS];
+        static int64_t last_cpu_ns[NUM_THREADS];
+        static int64_t last_sample_ns;
+};
+
+#endif
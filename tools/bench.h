@@ -0,0 +1,213 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+// helpers for the tools that measure sfdroid, header only like sb_client.h
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <mutex>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sfdroid_defs.h"
+#include "windowmanager.h"
+#include "wayland_helper.h"
+#include "sfconnection.h"
+#include "renderer.h"
+#include "utility.h"
+#include "sb_client.h"
+
+// sfdroid is considered stuck after this long
+#define BENCH_EVENT_TIMEOUT_MS 2000
+// android keeps a frame back while to_front is running, give up after this many
+#define BENCH_MAX_SUPPRESSED_POSTS 200
+
+static inline int64_t thread_cpu_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline int64_t percentile_ns(const std::vector<int64_t> &sorted, double fraction)
+{
+    size_t rank = (size_t)(sorted.size() * fraction);
+
+    if(rank >= sorted.size()) rank = sorted.size() - 1;
+    return sorted[rank];
+}
+
+// sorts values_ns, prints nothing if it is empty
+static inline void print_percentiles(const char *name, std::vector<int64_t> &values_ns)
+{
+    int64_t sum = 0;
+
+    if(values_ns.empty()) return;
+
+    std::sort(values_ns.begin(), values_ns.end());
+    for(size_t i=0;i<values_ns.size();i++) sum += values_ns[i];
+
+    std::cout << name << " (us): mean " << std::fixed << std::setprecision(1) << sum / (double)values_ns.size() / 1000.0
+         << " p50 " << percentile_ns(values_ns, 0.5) / 1000.0
+         << " p90 " << percentile_ns(values_ns, 0.9) / 1000.0
+         << " p99 " << percentile_ns(values_ns, 0.99) / 1000.0
+         << " max " << values_ns.back() / 1000.0 << std::endl;
+}
+
+// the multiwindow main loop of sfdroid and a producer standing in for
+// android. sfdroid itself must not run, start() takes over its socket.
+// the tool defines sfdroid_events and sfdroid_events_mutex
+class bench_fixture_t {
+    public:
+        bench_fixture_t() : retry_interval_ns(1000000000LL / 60), suppressed(0), started(false) {}
+
+        static std::string layer_name(int app)
+        {
+            char name[256];
+
+            snprintf(name, sizeof(name), "com.example.sfdroid_bench%d/com.example.sfdroid_bench%d.MainActivity", app, app);
+            return name;
+        }
+
+        // returns 2 if sfdroid didn't come up, 3 if the producer didn't.
+        // SFDROID_PRESENT and SFDROID_UINPUT the tool set before are kept
+        int start(uint32_t width, uint32_t height)
+        {
+            // the producer's buffers are memfds and there is no /dev/uinput to feed
+            setenv("SFDROID_PRESENT", "null", 0);
+            setenv("SFDROID_GRALLOC", "memfd", 1);
+            setenv("SFDROID_UINPUT", "/dev/null", 0);
+            mkdir(SFDROID_ROOT, 0770);
+            unlink(AM_START_STILL_RUNNING_FILE);
+
+            if(renderer_t::select_backend() != 0) return 2;
+            if(wayland_helper::init(windowmanager, !renderer_t::is_headless()) != 0 || sfconnection.init() != 0 || windowmanager.init(sfconnection) != 0) return 2;
+
+            sfconnection.start_thread();
+            sfconnection.gained_focus();
+            started = true;
+
+            if(producer.connect_to(SHAREBUFFER_HANDLE_FILE) != 0 || producer.handshake(SB_CAP_NONE) != 0) return 3;
+
+            // one producer for all apps like the sharebuffer module, HAL_PIXEL_FORMAT_RGBA_8888
+            for(int i=0;i<3;i++)
+            {
+                if(producer.add_buffer(width, height, width, 1, 4) < 0) return 3;
+            }
+
+            return 0;
+        }
+
+        // no windowmanager.deinit(), it would force-stop the apps and write the jank file
+        void stop()
+        {
+            producer.disconnect();
+            if(started) sfconnection.stop_thread();
+            started = false;
+            sfconnection.deinit();
+        }
+
+        // handles events like the main loop until one of the type was handled.
+        // seen_ns is when it was found in the queue, done_ns when it was handled
+        int handle_until(sfdroid_event_type type, int64_t &seen_ns, int64_t &done_ns)
+        {
+            int64_t deadline = monotonic_ns() + BENCH_EVENT_TIMEOUT_MS * 1000000LL;
+
+            while(monotonic_ns() < deadline)
+            {
+                bool found = false;
+
+                sfdroid_events_mutex.lock();
+                for(size_t i=0;i<sfdroid_events.size();i++)
+                {
+                    if(sfdroid_events[i].type == type) found = true;
+                }
+                if(found) seen_ns = monotonic_ns();
+                // dummy frames have to be answered too, the sfconnection thread waits for them
+                windowmanager.handle_sfdroid_events(true);
+                if(found) done_ns = monotonic_ns();
+                sfdroid_events_mutex.unlock();
+
+                if(found) return 0;
+                sfconnection.wait_for_event(1);
+            }
+
+            std::cerr << "sfdroid didn't queue event " << type << " in time" << std::endl;
+            return -1;
+        }
+
+        int handle_until(sfdroid_event_type type)
+        {
+            int64_t seen_ns, done_ns;
+
+            return handle_until(type, seen_ns, done_ns);
+        }
+
+        // waits for the status of every post
+        int wait_for_status()
+        {
+            while(!producer.outstanding.empty())
+            {
+                if(producer.receive(BENCH_EVENT_TIMEOUT_MS) <= 0)
+                {
+                    std::cerr << "no status from sfdroid" << std::endl;
+                    return -1;
+                }
+            }
+            return 0;
+        }
+
+        // posts until a frame gets through, returns when the status arrived
+        int post_until_shown(int64_t &status_ns)
+        {
+            for(int tries=0;tries<BENCH_MAX_SUPPRESSED_POSTS;tries++)
+            {
+                uint64_t failed = producer.failed;
+                int index = producer.find_free_buffer();
+
+                if(index < 0 || producer.post(index) < 0) return -1;
+                if(handle_until(BUFFER) != 0) return -1;
+                if(wait_for_status() != 0) return -1;
+                status_ns = monotonic_ns();
+
+                if(producer.failed == failed) return 0;
+
+                // to_front is still running, android would try again with the next frame
+                suppressed++;
+                usleep(retry_interval_ns / 1000);
+            }
+
+            std::cerr << "no frame got through after " << BENCH_MAX_SUPPRESSED_POSTS << " tries" << std::endl;
+            return -1;
+        }
+
+        // android starts the app, its layer shows up and it draws a frame
+        int open_app(int app)
+        {
+            int64_t status_ns;
+
+            if(producer.send_layer(SB_LAYER_NAME, layer_name(app), 1) < 0) return -1;
+            if(handle_until(LAYER_NAME) != 0) return -1;
+            return post_until_shown(status_ns);
+        }
+
+        windowmanager_t windowmanager;
+        sfconnection_t sfconnection;
+        sb_client_t producer;
+        int64_t retry_interval_ns; // between posts that to_front held back
+        uint64_t suppressed; // posts that to_front held back
+
+    private:
+        bool started;
+};
+
+#endif
+
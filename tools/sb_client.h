@@ -0,0 +1,468 @@
+#ifndef __SB_CLIENT_H__
+#define __SB_CLIENT_H__
+
+// the producer side of the sharebuffer protocol for the tools that stand in
+// for android: memfd backed buffers (see memfd_handle.h), everything goes
+// through the socket. header only, every tool is built from a single file.
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <deque>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "sharebuffer_protocol.h"
+#include "memfd_handle.h"
+
+struct sb_client_buffer_t
+{
+    int fd;
+    void *addr; // mapped on demand
+    size_t size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    int32_t pixel_format;
+    uint32_t bytes_per_pixel;
+    bool registered;
+    bool busy; // sfdroid still has it
+};
+
+class sb_client_t {
+    public:
+        struct post_t
+        {
+            uint32_t index;
+            int64_t sent_ns;
+        };
+
+        sb_client_t() : fd(-1), capabilities(0), acked(0), failed(0), releases(0), vsyncs(0) {}
+        ~sb_client_t() { disconnect(); }
+
+        int connect_to(const char *file)
+        {
+            struct sockaddr_un addr;
+
+            fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+            if(fd < 0)
+            {
+                std::cerr << "failed to create socket: " << strerror(errno) << std::endl;
+                return -1;
+            }
+
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, file, sizeof(addr.sun_path) - 1);
+            if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+            {
+                std::cerr << "failed to connect to " << file << ": " << strerror(errno) << std::endl;
+                return -1;
+            }
+
+            return 0;
+        }
+
+        // closes the socket and forgets all buffers, sfdroid does the same
+        void disconnect()
+        {
+            for(size_t i=0;i<buffers.size();i++)
+            {
+                if(buffers[i].addr) munmap(buffers[i].addr, buffers[i].size);
+                if(buffers[i].fd >= 0) close(buffers[i].fd);
+            }
+            buffers.clear();
+            outstanding.clear();
+            if(fd >= 0) close(fd);
+            fd = -1;
+        }
+
+        // only the capabilities that work without shared memory are asked for
+        int handshake(uint32_t wanted)
+        {
+            struct sb_hello_t hello;
+            char buffer[SB_MAX_DATAGRAM_SIZE];
+            const struct sb_welcome_t *welcome = (const struct sb_welcome_t*)buffer;
+            ssize_t r;
+
+            memset(&hello, 0, sizeof(hello));
+            hello.header.type = SB_HELLO;
+            hello.header.size = sizeof(hello);
+            hello.version = SB_PROTOCOL_VERSION;
+            hello.capabilities = wanted & (SB_CAP_BUFFER_RELEASE | SB_CAP_VSYNC);
+
+            if(send_datagram(&hello, sizeof(hello), NULL, 0) < 0) return -1;
+
+            r = recv(fd, buffer, sizeof(buffer), 0);
+            if(r < (ssize_t)sizeof(struct sb_welcome_t) || welcome->header.type != SB_WELCOME)
+            {
+                std::cerr << "no welcome from sfdroid" << std::endl;
+                return -1;
+            }
+
+            capabilities = welcome->capabilities;
+            return 0;
+        }
+
+        // returns the index of the new buffer, it is registered with its first post
+        int add_buffer(uint32_t width, uint32_t height, uint32_t stride, int32_t pixel_format, uint32_t bytes_per_pixel)
+        {
+            sb_client_buffer_t b;
+
+            if(create_buffer(b, width, height, stride, pixel_format, bytes_per_pixel) != 0) return -1;
+
+            buffers.push_back(b);
+            return buffers.size() - 1;
+        }
+
+        // a new buffer for an index, registered again with its next post
+        int replace_buffer(uint32_t index, uint32_t width, uint32_t height, uint32_t stride, int32_t pixel_format, uint32_t bytes_per_pixel)
+        {
+            sb_client_buffer_t b;
+
+            if(create_buffer(b, width, height, stride, pixel_format, bytes_per_pixel) != 0) return -1;
+
+            if(buffers[index].addr) munmap(buffers[index].addr, buffers[index].size);
+            if(buffers[index].fd >= 0) close(buffers[index].fd);
+            buffers[index] = b;
+            return 0;
+        }
+
+        void *map_buffer(uint32_t index)
+        {
+            sb_client_buffer_t &b = buffers[index];
+
+            if(b.addr) return b.addr;
+
+            b.addr = mmap(NULL, b.size, PROT_READ | PROT_WRITE, MAP_SHARED, b.fd, 0);
+            if(b.addr == MAP_FAILED)
+            {
+                std::cerr << "failed to map buffer " << index << ": " << strerror(errno) << std::endl;
+                b.addr = NULL;
+            }
+            return b.addr;
+        }
+
+        int send_layer(uint32_t type, const std::string &name, int count)
+        {
+            std::vector<char> datagram;
+
+            for(int i=0;i<count;i++) append_layer(datagram, type, name);
+            return send_datagram(datagram.data(), datagram.size(), NULL, 0);
+        }
+
+        // sends the buffer's sb_new_buffer_t on its own, post() does it otherwise
+        int register_buffer(uint32_t index)
+        {
+            struct {
+                struct sb_new_buffer_t new_buffer;
+                struct memfd_handle_ints_t ints;
+            } msg;
+            sb_client_buffer_t &b = buffers[index];
+
+            fill_new_buffer(index, msg.new_buffer, msg.ints);
+            if(send_datagram(&msg, sizeof(msg), &b.fd, 1) < 0) return -1;
+
+            b.registered = true;
+            return 0;
+        }
+
+        int post(uint32_t index)
+        {
+            struct {
+                struct sb_new_buffer_t new_buffer;
+                struct memfd_handle_ints_t ints;
+                struct sb_post_t post;
+            } msg;
+            sb_client_buffer_t &b = buffers[index];
+            size_t offset = 0;
+            post_t p;
+
+            memset(&msg, 0, sizeof(msg));
+
+            // a buffer is registered with its first post
+            if(!b.registered)
+            {
+                fill_new_buffer(index, msg.new_buffer, msg.ints);
+                offset = SB_ALIGN(msg.new_buffer.header.size);
+            }
+
+            struct sb_post_t *sb_post = (struct sb_post_t*)((char*)&msg + offset);
+            sb_post->header.type = SB_POST;
+            sb_post->header.size = sizeof(struct sb_post_t);
+            sb_post->index = index;
+            sb_post->flags = 0;
+
+            p.index = index;
+            p.sent_ns = now_ns();
+            if(send_datagram(&msg, offset + sizeof(struct sb_post_t), b.registered ? NULL : &b.fd, b.registered ? 0 : 1) < 0) return -1;
+
+            b.registered = true;
+            b.busy = true;
+            outstanding.push_back(p);
+            return 0;
+        }
+
+        // handles everything in one datagram, waits at most timeout_ms for it.
+        // returns 1 if something was handled, 0 on timeout
+        int receive(int timeout_ms)
+        {
+            char buffer[SB_MAX_DATAGRAM_SIZE];
+            char ancillary_buffer[CMSG_SPACE(sizeof(int) * SB_MAX_FDS)];
+            struct msghdr socket_message;
+            struct iovec io_vector[1];
+            struct pollfd pfd;
+            ssize_t r;
+            size_t offset = 0;
+
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            r = poll(&pfd, 1, timeout_ms);
+            if(r < 0 && errno != EINTR)
+            {
+                std::cerr << "poll failed: " << strerror(errno) << std::endl;
+                return -1;
+            }
+            if(r <= 0) return 0;
+
+            memset(&socket_message, 0, sizeof(socket_message));
+            io_vector[0].iov_base = buffer;
+            io_vector[0].iov_len = sizeof(buffer);
+            socket_message.msg_iov = io_vector;
+            socket_message.msg_iovlen = 1;
+            socket_message.msg_control = ancillary_buffer;
+            socket_message.msg_controllen = sizeof(ancillary_buffer);
+
+            r = recvmsg(fd, &socket_message, MSG_CMSG_CLOEXEC);
+            if(r <= 0)
+            {
+                std::cerr << "lost connection to sfdroid" << std::endl;
+                return -1;
+            }
+
+            // release fences, we don't draw so we don't need to wait for them
+            for(struct cmsghdr *c = CMSG_FIRSTHDR(&socket_message);c != NULL;c = CMSG_NXTHDR(&socket_message, c))
+            {
+                if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS)
+                {
+                    int n = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                    for(int i=0;i<n;i++) close(((int*)CMSG_DATA(c))[i]);
+                }
+            }
+
+            while(offset + sizeof(struct sb_header_t) <= (size_t)r)
+            {
+                const struct sb_header_t *header = (const struct sb_header_t*)(buffer + offset);
+
+                if(header->size < sizeof(struct sb_header_t) || offset + header->size > (size_t)r)
+                {
+                    std::cerr << "malformed message from sfdroid" << std::endl;
+                    return -1;
+                }
+
+                if(header->type == SB_STATUS && header->size >= sizeof(struct sb_status_t))
+                {
+                    const struct sb_status_t *status = (const struct sb_status_t*)header;
+
+                    if(outstanding.empty() || outstanding.front().index != status->index)
+                    {
+                        std::cerr << "status for buffer " << status->index << " that wasn't posted" << std::endl;
+                        return -1;
+                    }
+
+                    latencies_ns.push_back(now_ns() - outstanding.front().sent_ns);
+                    outstanding.pop_front();
+                    acked++;
+                    if(status->failed) failed++;
+                    // only shown buffers get a release
+                    if(status->failed || !(capabilities & SB_CAP_BUFFER_RELEASE)) buffers[status->index].busy = false;
+                }
+                else if(header->type == SB_BUFFER_RELEASE && header->size >= sizeof(struct sb_buffer_release_t))
+                {
+                    const struct sb_buffer_release_t *release = (const struct sb_buffer_release_t*)header;
+
+                    if(release->index < buffers.size()) buffers[release->index].busy = false;
+                    releases++;
+                }
+                else if(header->type == SB_VSYNC)
+                {
+                    vsyncs++;
+                }
+
+                offset += SB_ALIGN(header->size);
+            }
+
+            return 1;
+        }
+
+        int find_free_buffer()
+        {
+            for(size_t i=0;i<buffers.size();i++)
+            {
+                if(!buffers[i].busy) return i;
+            }
+            return -1;
+        }
+
+        static uint64_t percentile_us(const std::vector<int64_t> &sorted, double fraction)
+        {
+            size_t rank = (size_t)(sorted.size() * fraction);
+
+            if(rank >= sorted.size()) rank = sorted.size() - 1;
+            return sorted[rank] / 1000;
+        }
+
+        void print_results(uint64_t posted, int64_t duration_ns)
+        {
+            double seconds = duration_ns / 1e9;
+            std::vector<int64_t> sorted = latencies_ns;
+            int64_t sum = 0;
+
+            std::sort(sorted.begin(), sorted.end());
+            for(size_t i=0;i<sorted.size();i++) sum += sorted[i];
+
+            std::cout << "posted " << posted << ", answered " << acked << " (" << failed << " failed), " << releases << " releases, " << vsyncs << " vsyncs" << std::endl;
+            std::cout << "throughput " << std::fixed << std::setprecision(1) << (seconds > 0 ? acked / seconds : 0.0) << " posts/s over " << seconds << "s" << std::endl;
+            if(sorted.empty()) return;
+            std::cout << "ack latency (us): mean " << sum / (int64_t)sorted.size() / 1000
+                 << " p50 " << percentile_us(sorted, 0.5) << " p90 " << percentile_us(sorted, 0.9)
+                 << " p99 " << percentile_us(sorted, 0.99) << " max " << sorted.back() / 1000 << std::endl;
+        }
+
+        int fd;
+        uint32_t capabilities;
+        std::vector<sb_client_buffer_t> buffers;
+        std::deque<post_t> outstanding;
+        std::vector<int64_t> latencies_ns;
+        uint64_t acked;
+        uint64_t failed;
+        uint64_t releases;
+        uint64_t vsyncs;
+
+    private:
+        // tools built against sfdroid's objects have monotonic_ns() already
+        static int64_t now_ns()
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        }
+
+        // a sized memfd, mapped by map_buffer on demand
+        int create_buffer(sb_client_buffer_t &b, uint32_t width, uint32_t height, uint32_t stride, int32_t pixel_format, uint32_t bytes_per_pixel)
+        {
+            memset(&b, 0, sizeof(b));
+            b.width = width;
+            b.height = height;
+            b.stride = stride;
+            b.pixel_format = pixel_format;
+            b.bytes_per_pixel = bytes_per_pixel;
+            b.size = (size_t)stride * height * bytes_per_pixel;
+
+#ifdef SYS_memfd_create
+            b.fd = syscall(SYS_memfd_create, "sfdroid-producer", 1 /* MFD_CLOEXEC */);
+#else
+            b.fd = -1;
+            errno = ENOSYS;
+#endif
+            if(b.fd < 0)
+            {
+                std::cerr << "failed to create memfd: " << strerror(errno) << std::endl;
+                return -1;
+            }
+
+            if(ftruncate(b.fd, b.size) < 0)
+            {
+                std::cerr << "failed to size memfd: " << strerror(errno) << std::endl;
+                close(b.fd);
+                return -1;
+            }
+
+            return 0;
+        }
+
+        int send_datagram(const void *buffer, size_t size, const int *fds, int num_fds)
+        {
+            struct msghdr socket_message;
+            struct iovec io_vector[1];
+            char ancillary_buffer[CMSG_SPACE(sizeof(int) * SB_MAX_FDS)];
+
+            memset(&socket_message, 0, sizeof(socket_message));
+            io_vector[0].iov_base = (void*)buffer;
+            io_vector[0].iov_len = size;
+            socket_message.msg_iov = io_vector;
+            socket_message.msg_iovlen = 1;
+
+            if(num_fds > 0)
+            {
+                struct cmsghdr *control_message;
+
+                memset(ancillary_buffer, 0, sizeof(ancillary_buffer));
+                socket_message.msg_control = ancillary_buffer;
+                socket_message.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+                control_message = CMSG_FIRSTHDR(&socket_message);
+                control_message->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+                control_message->cmsg_level = SOL_SOCKET;
+                control_message->cmsg_type = SCM_RIGHTS;
+                memcpy(CMSG_DATA(control_message), fds, sizeof(int) * num_fds);
+            }
+
+            if(sendmsg(fd, &socket_message, MSG_NOSIGNAL) < 0)
+            {
+                std::cerr << "sendmsg failed: " << strerror(errno) << std::endl;
+                return -1;
+            }
+
+            return 0;
+        }
+
+        void fill_new_buffer(uint32_t index, struct sb_new_buffer_t &new_buffer, struct memfd_handle_ints_t &ints)
+        {
+            const sb_client_buffer_t &b = buffers[index];
+
+            memset(&new_buffer, 0, sizeof(new_buffer));
+            memset(&ints, 0, sizeof(ints));
+            new_buffer.header.type = SB_NEW_BUFFER;
+            new_buffer.header.size = sizeof(new_buffer) + sizeof(ints);
+            new_buffer.index = index;
+            new_buffer.width = b.width;
+            new_buffer.height = b.height;
+            new_buffer.stride = b.stride;
+            new_buffer.pixel_format = b.pixel_format;
+            new_buffer.num_fds = MEMFD_HANDLE_NUM_FDS;
+            new_buffer.num_ints = MEMFD_HANDLE_NUM_INTS;
+            new_buffer.ints_offset = sizeof(new_buffer);
+            ints.magic = MEMFD_HANDLE_MAGIC;
+            ints.size = b.size;
+            ints.bytes_per_pixel = b.bytes_per_pixel;
+        }
+
+        static void append_layer(std::vector<char> &datagram, uint32_t type, const std::string &name)
+        {
+            struct sb_layer_t layer;
+            size_t offset = datagram.size();
+
+            memset(&layer, 0, sizeof(layer));
+            layer.header.type = type;
+            layer.header.size = sizeof(layer) + name.size();
+            layer.length = name.size();
+
+            datagram.resize(offset + SB_ALIGN(layer.header.size), 0);
+            memcpy(datagram.data() + offset, &layer, sizeof(layer));
+            memcpy(datagram.data() + offset + sizeof(layer), name.data(), name.size());
+        }
+};
+
+#endif
+
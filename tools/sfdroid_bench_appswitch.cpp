@@ -0,0 +1,189 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// measures app switches in multiwindow mode. stands in for the compositor
+// (keyboard leave/enter on the windows' surfaces, presentation through
+// SFDROID_PRESENT, null by default) and for android (a sharebuffer producer
+// that answers to_front with the app's layer name and a frame). everything
+// between those is sfdroid's own code, built against its objects. sfdroid
+// itself must not run, the benchmark takes over its socket.
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <cstdlib>
+#include <cstdio>
+
+#include <unistd.h>
+
+#include "sfdroid_defs.h"
+#include "windowmanager.h"
+#include "renderer.h"
+#include "utility.h"
+#include "bench.h"
+
+using namespace std;
+
+std::vector<sfdroid_event> sfdroid_events;
+std::mutex sfdroid_events_mutex;
+
+enum phase_t
+{
+    PHASE_LEAVE, // keyboard_handle_leave of the old window
+    PHASE_ENTER, // keyboard_handle_enter, take_focus and to_front
+    PHASE_LAYER_NAME, // the layer name from the socket to the event queue
+    PHASE_SWITCH, // handle_layer_name_event
+    PHASE_FIRST_FRAME, // until the first frame of the new app is committed
+    PHASE_TOTAL,
+    NUM_PHASES,
+};
+
+static const char *phase_names[NUM_PHASES] = {
+    "keyboard leave",
+    "keyboard enter",
+    "layer name to queue",
+    "layer name handling",
+    "first frame",
+    "total",
+};
+
+static void usage(const char *name)
+{
+    cout << name << " [-a apps] [-n switches] [-r fps] [-s WxH]" << endl;
+    cout << "\t-a number of apps to switch between (default 4)" << endl;
+    cout << "\t-n number of app switches (default 100)" << endl;
+    cout << "\t-r how often the producer tries again while to_front holds frames back (default 60)" << endl;
+    cout << "\t-s buffer size (default 720x1280)" << endl;
+}
+
+static int switch_app(bench_fixture_t &b, int from, int to, vector<int64_t> *phases)
+{
+    renderer_t *from_window = b.windowmanager.get_window(get_app_name((char*)bench_fixture_t::layer_name(from).c_str()));
+    renderer_t *to_window = b.windowmanager.get_window(get_app_name((char*)bench_fixture_t::layer_name(to).c_str()));
+    int64_t t0, t1, t2, sent_ns, seen_ns, done_ns, status_ns;
+
+    if(!from_window || !to_window)
+    {
+        cerr << "app " << (from_window ? to : from) << " has no window" << endl;
+        return -1;
+    }
+
+    // what the compositor sends when the user picks another window
+    t0 = monotonic_ns();
+    windowmanager_t::keyboard_handle_leave(&b.windowmanager, nullptr, 0, from_window->get_surface());
+    t1 = monotonic_ns();
+    windowmanager_t::keyboard_handle_enter(&b.windowmanager, nullptr, 0, to_window->get_surface(), nullptr);
+    t2 = monotonic_ns();
+
+    // android brings the app to the front and its layer shows up
+    sent_ns = monotonic_ns();
+    if(b.producer.send_layer(SB_LAYER_NAME, bench_fixture_t::layer_name(to), 1) < 0) return -1;
+    if(b.handle_until(LAYER_NAME, seen_ns, done_ns) != 0) return -1;
+
+    if(b.post_until_shown(status_ns) != 0) return -1;
+
+    phases[PHASE_LEAVE].push_back(t1 - t0);
+    phases[PHASE_ENTER].push_back(t2 - t1);
+    phases[PHASE_LAYER_NAME].push_back(seen_ns - sent_ns);
+    phases[PHASE_SWITCH].push_back(done_ns - seen_ns);
+    phases[PHASE_FIRST_FRAME].push_back(status_ns - done_ns);
+    phases[PHASE_TOTAL].push_back(status_ns - t0);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int err = 0;
+    int apps = 4;
+    int switches = 100;
+    double rate = 60.0;
+    uint32_t width = 720, height = 1280;
+    bench_fixture_t b;
+    vector<int64_t> phases[NUM_PHASES];
+    int active;
+    int opt;
+
+    while((opt = getopt(argc, argv, "a:n:r:s:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'a':
+                apps = atoi(optarg);
+                break;
+            case 'n':
+                switches = atoi(optarg);
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 's':
+                if(sscanf(optarg, "%ux%u", &width, &height) != 2)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(apps < 2 || switches < 1 || rate <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    b.retry_interval_ns = (int64_t)(1e9 / rate);
+
+    if((err = b.start(width, height)) != 0) goto quit;
+
+    // android starts them one after another
+    for(int i=0;i<apps;i++)
+    {
+        if(b.open_app(i) != 0)
+        {
+            err = 4;
+            goto quit;
+        }
+    }
+
+    active = apps - 1;
+    for(int i=0;i<switches;i++)
+    {
+        int next = (active + 1) % apps;
+
+        if(switch_app(b, active, next, phases) != 0)
+        {
+            err = 5;
+            goto quit;
+        }
+        active = next;
+    }
+
+    cout << switches << " switches between " << apps << " apps, " << b.suppressed << " frames held back while to_front ran" << endl;
+    for(int i=0;i<NUM_PHASES;i++) print_percentiles(phase_names[i], phases[i]);
+
+quit:
+    b.stop();
+    return err;
+}
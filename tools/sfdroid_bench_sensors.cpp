@@ -0,0 +1,422 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// sensors path throughput and latency. stands in for the sensors HAL in
+// android (requests on SENSORS_HANDLE_FILE, one at a time like the HAL
+// does) and for the accelerometer (a fake iio device, see iio_backend.h,
+// whose buffer is a fifo fed by a thread). everything between those is
+// sensorconnection_t, built against sfdroid's objects. sfdroid itself must
+// not run, the benchmark takes over its socket.
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+
+#include "sfdroid_defs.h"
+#include "sensorconnection.h"
+#include "utility.h"
+#include "bench.h"
+
+using namespace std;
+
+// sfdroid is considered stuck after this long
+#define RESPONSE_TIMEOUT_MS 2000
+#define SENSORS_THREAD_NAME "sfd-sensors"
+
+struct fake_accel_t
+{
+    int fd; // the fifo iio_backend_t reads samples from
+    int rate_hz;
+    std::atomic<bool> stopping;
+};
+
+static void usage(const char *name)
+{
+    cout << name << " [-r rates] [-d seconds] [-S hz]" << endl;
+    cout << "\t-r comma separated request rates per second, 0 requests as fast as sfdroid answers (default 50,100,200,500,1000,0)" << endl;
+    cout << "\t-d seconds per rate (default 2)" << endl;
+    cout << "\t-S samples per second of the fake accelerometer (default 200)" << endl;
+}
+
+static int write_file(const string &path, const string &value)
+{
+    ofstream f(path.c_str());
+    if(!f.is_open())
+    {
+        cerr << "failed to create " << path << endl;
+        return -1;
+    }
+    f << value << endl;
+    return f.good() ? 0 : -1;
+}
+
+// an accelerometer with a buffer and three 16 bit channels, no trigger
+static int create_fake_iio(const string &root)
+{
+    string device = root + "/sys/iio:device0";
+    const char *axes[] = { "x", "y", "z" };
+
+    if(mkdir((root + "/sys").c_str(), 0700) < 0 || mkdir((root + "/dev").c_str(), 0700) < 0 ||
+        mkdir(device.c_str(), 0700) < 0 || mkdir((device + "/scan_elements").c_str(), 0700) < 0 || mkdir((device + "/buffer").c_str(), 0700) < 0)
+    {
+        cerr << "failed to create fake sysfs in " << root << ": " << strerror(errno) << endl;
+        return -1;
+    }
+
+    if(write_file(device + "/name", "bench_accel") != 0) return -1;
+    if(write_file(device + "/in_accel_scale", "0.01") != 0) return -1;
+    if(write_file(device + "/buffer/enable", "0") != 0) return -1;
+
+    for(int i=0;i<3;i++)
+    {
+        string channel = device + "/scan_elements/in_accel_" + axes[i];
+        if(write_file(channel + "_en", "0") != 0) return -1;
+        if(write_file(channel + "_index", to_string(i)) != 0) return -1;
+        if(write_file(channel + "_type", "le:s16/16>>0") != 0) return -1;
+    }
+
+    if(mkfifo((root + "/dev/iio:device0").c_str(), 0600) < 0)
+    {
+        cerr << "failed to create fake iio buffer: " << strerror(errno) << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    return remove(path);
+}
+
+static void fake_accel_loop(fake_accel_t *accel)
+{
+    int64_t interval_ns = 1000000000LL / accel->rate_hz;
+    int64_t next_ns = monotonic_ns();
+    int16_t sample[3];
+    uint32_t n = 0;
+
+    while(!accel->stopping)
+    {
+        sample[0] = n % 1000;
+        sample[1] = -(int16_t)(n % 1000);
+        sample[2] = 981;
+        n++;
+
+        // a full fifo drops samples like a full iio buffer does
+        if(write(accel->fd, sample, sizeof(sample)) < 0 && errno != EAGAIN)
+        {
+            cerr << "failed to write to fake iio buffer: " << strerror(errno) << endl;
+            return;
+        }
+
+        next_ns += interval_ns;
+        int64_t now = monotonic_ns();
+        if(next_ns > now) usleep((next_ns - now) / 1000);
+        else next_ns = now;
+    }
+}
+
+// the sensors thread names itself, its run time is in schedstat
+static string find_sensors_thread()
+{
+    DIR *dir = opendir("/proc/self/task");
+    struct dirent *entry;
+    string found;
+
+    if(!dir) return "";
+
+    while((entry = readdir(dir)) != NULL)
+    {
+        string comm;
+        string task = string("/proc/self/task/") + entry->d_name;
+        ifstream f((task + "/comm").c_str());
+
+        if(entry->d_name[0] == '.' || !getline(f, comm)) continue;
+        if(comm == SENSORS_THREAD_NAME)
+        {
+            found = task;
+            break;
+        }
+    }
+    closedir(dir);
+
+    return found;
+}
+
+static int64_t task_cpu_ns(const string &task)
+{
+    ifstream f((task + "/schedstat").c_str());
+    long long run_ns;
+
+    if(task == "" || !(f >> run_ns)) return -1;
+    return run_ns;
+}
+
+// what the sensors HAL sends: the length including the terminating zero, then the request
+static int send_request(int fd, const string &request)
+{
+    char length = request.size() + 1;
+
+    if(send(fd, &length, 1, 0) != 1 || send(fd, request.c_str(), request.size() + 1, 0) != (ssize_t)request.size() + 1)
+    {
+        cerr << "failed to send " << request << ": " << strerror(errno) << endl;
+        return -1;
+    }
+    return 0;
+}
+
+static int receive_sample(int fd, double &x, double &y, double &z)
+{
+    unsigned char length;
+    char buffer[256];
+    long long timestamp;
+
+    if(recv(fd, &length, 1, MSG_WAITALL) != 1 || recv(fd, buffer, length, MSG_WAITALL) != length)
+    {
+        cerr << "no accelerometer data from sfdroid" << endl;
+        return -1;
+    }
+
+    buffer[length > 0 ? length - 1 : 0] = 0;
+    if(sscanf(buffer, "acceleration:%lf:%lf:%lf:%lld", &x, &y, &z, &timestamp) != 4)
+    {
+        cerr << "invalid accelerometer data: " << buffer << endl;
+        return -1;
+    }
+    return 0;
+}
+
+static int connect_sensors()
+{
+    struct sockaddr_un addr;
+    struct timeval timeout;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if(fd < 0)
+    {
+        cerr << "failed to create socket: " << strerror(errno) << endl;
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, SENSORS_HANDLE_FILE, sizeof(addr.sun_path)-1);
+
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        cerr << "failed to connect to " << SENSORS_HANDLE_FILE << ": " << strerror(errno) << endl;
+        close(fd);
+        return -1;
+    }
+
+    memset(&timeout, 0, sizeof(timeout));
+    timeout.tv_sec = RESPONSE_TIMEOUT_MS / 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
+
+    return fd;
+}
+
+// one rate, prints a line per metric
+static int run_rate(int fd, const string &task, double rate, int seconds)
+{
+    int64_t interval_ns = (rate > 0) ? (int64_t)(1e9 / rate) : 0;
+    int64_t start_ns, end_ns, next_ns, cpu_start, cpu_end;
+    vector<int64_t> latencies;
+    char delay[64];
+    double x, y, z;
+
+    // the HAL asks for the rate it polls at
+    snprintf(delay, sizeof(delay), "setDelay:acceleration:%lld", (long long)(interval_ns ? interval_ns : 1000000));
+    if(send_request(fd, delay) != 0) return -1;
+
+    cpu_start = task_cpu_ns(task);
+    start_ns = next_ns = monotonic_ns();
+    end_ns = start_ns + seconds * 1000000000LL;
+
+    while(monotonic_ns() < end_ns)
+    {
+        int64_t now = monotonic_ns();
+        int64_t sent_ns;
+
+        if(now < next_ns)
+        {
+            usleep((next_ns - now) / 1000);
+            continue;
+        }
+
+        sent_ns = monotonic_ns();
+        if(send_request(fd, "get:accelerometer") != 0 || receive_sample(fd, x, y, z) != 0) return -1;
+        latencies.push_back(monotonic_ns() - sent_ns);
+
+        // the HAL doesn't catch up after sfdroid stalled it
+        next_ns += interval_ns;
+        if(next_ns < monotonic_ns()) next_ns = monotonic_ns();
+    }
+
+    end_ns = monotonic_ns();
+    cpu_end = task_cpu_ns(task);
+
+    if(rate > 0) cout << "rate " << rate << "/s: ";
+    else cout << "back to back: ";
+    cout << latencies.size() << " samples, " << latencies.size() * 1e9 / (end_ns - start_ns) << " samples/s";
+    if(cpu_start >= 0 && cpu_end >= 0 && !latencies.empty())
+    {
+        cout << ", sensors thread " << (cpu_end - cpu_start) / (double)latencies.size() / 1000.0 << " us cpu per sample";
+    }
+    cout << endl;
+    print_percentiles("\trequest to response", latencies);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int err = 0;
+    vector<double> rates = { 50, 100, 200, 500, 1000, 0 };
+    int seconds = 2;
+    char root[] = "/tmp/sfdroid_bench_sensors.XXXXXX";
+    bool have_root = false;
+    fake_accel_t accel;
+    std::thread accel_thread;
+    sensorconnection_t sensorconnection;
+    bool started = false;
+    int fd = -1;
+    string task;
+    double x, y, z;
+    int opt;
+
+    accel.fd = -1;
+    accel.rate_hz = 200;
+    accel.stopping = false;
+
+    while((opt = getopt(argc, argv, "r:d:S:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'r':
+            {
+                stringstream list(optarg);
+                string rate;
+
+                rates.clear();
+                while(getline(list, rate, ',')) rates.push_back(atof(rate.c_str()));
+                break;
+            }
+            case 'd':
+                seconds = atoi(optarg);
+                break;
+            case 'S':
+                accel.rate_hz = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(rates.empty() || seconds < 1 || accel.rate_hz < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(!mkdtemp(root))
+    {
+        cerr << "failed to create " << root << ": " << strerror(errno) << endl;
+        return 2;
+    }
+    have_root = true;
+
+    if(create_fake_iio(root) != 0)
+    {
+        err = 2;
+        goto quit;
+    }
+
+    // read and write, so that the fifo neither blocks nor ends while the backend reopens it
+    accel.fd = open((string(root) + "/dev/iio:device0").c_str(), O_RDWR | O_NONBLOCK);
+    if(accel.fd < 0)
+    {
+        cerr << "failed to open fake iio buffer: " << strerror(errno) << endl;
+        err = 2;
+        goto quit;
+    }
+    accel_thread = std::thread(fake_accel_loop, &accel);
+
+    setenv("SFDROID_SENSORS", "iio", 1);
+    setenv("SFDROID_IIO_SYSFS_ROOT", (string(root) + "/sys").c_str(), 1);
+    setenv("SFDROID_IIO_DEV_ROOT", (string(root) + "/dev").c_str(), 1);
+    mkdir(SFDROID_ROOT, 0770);
+
+    if(sensorconnection.init() != 0)
+    {
+        err = 3;
+        goto quit;
+    }
+    sensorconnection.start_thread();
+    started = true;
+
+    fd = connect_sensors();
+    // the first answer starts the backend, by then the sensors thread has named itself
+    if(fd < 0 || send_request(fd, "set:acceleration:1") != 0 || send_request(fd, "get:accelerometer") != 0 || receive_sample(fd, x, y, z) != 0)
+    {
+        err = 4;
+        goto quit;
+    }
+    task = find_sensors_thread();
+
+    cout << fixed << setprecision(1);
+    cout << "fake accelerometer at " << accel.rate_hz << " samples/s" << endl;
+    for(size_t i=0;i<rates.size();i++)
+    {
+        if(run_rate(fd, task, rates[i], seconds) != 0)
+        {
+            err = 5;
+            goto quit;
+        }
+    }
+
+quit:
+    if(fd >= 0) close(fd);
+    if(started) sensorconnection.stop_thread();
+    sensorconnection.deinit();
+    accel.stopping = true;
+    if(accel_thread.joinable()) accel_thread.join();
+    if(accel.fd >= 0) close(accel.fd);
+    if(have_root) nftw(root, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+    return err;
+}
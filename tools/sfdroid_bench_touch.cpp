@@ -0,0 +1,364 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// touch to photon latency. touches go into windowmanager_t's wayland touch
+// handlers like the compositor would send them, uinput_t writes them to a
+// pipe (SFDROID_UINPUT) and a producer thread standing in for android
+// answers every touch with a frame that has the touch's sequence number in
+// its first pixel. frames are presented by the file backend, which records
+// when renderer_t committed them and their pixels. built against sfdroid's
+// objects, sfdroid itself must not run, the benchmark takes over its socket.
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+#include <linux/input.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "sfdroid_defs.h"
+#include "windowmanager.h"
+#include "wayland_helper.h"
+#include "file_backend.h"
+#include "utility.h"
+#include "bench.h"
+
+using namespace std;
+
+#define FRAMES_FILE_BENCH (SFDROID_ROOT "/touch_frames")
+#define NO_TOUCH 0xffffffff
+
+std::vector<sfdroid_event> sfdroid_events;
+std::mutex sfdroid_events_mutex;
+
+struct touch_bench_t : public bench_fixture_t
+{
+    int input_fd; // what uinput_t writes
+    uint32_t samples;
+    // per touch, by sequence number
+    vector<int64_t> inject_ns;
+    vector<int64_t> uinput_ns;
+    vector<int64_t> post_ns;
+    vector<int64_t> present_ns;
+    std::atomic<uint32_t> answered;
+    std::atomic<bool> failed;
+    std::atomic<bool> stopping;
+};
+
+static void usage(const char *name)
+{
+    cout << name << " [-n touches] [-r touches per second] [-s WxH]" << endl;
+    cout << "\t-n number of touches (default 300)" << endl;
+    cout << "\t-r touches per second (default 20)" << endl;
+    cout << "\t-s buffer size, the pixels of every frame are recorded (default 64x64)" << endl;
+    cout << "frames are presented by SFDROID_PRESENT=file, a frame is presented when renderer_t commits it" << endl;
+}
+
+// android draws the frame, the touch's sequence number goes into the first pixel
+static int answer(touch_bench_t &b, uint32_t seq)
+{
+    int index = b.producer.find_free_buffer();
+    void *pixels;
+
+    if(index < 0 || (pixels = b.producer.map_buffer(index)) == NULL) return -1;
+    memcpy(pixels, &seq, sizeof(seq));
+
+    if(seq != NO_TOUCH) b.post_ns[seq] = monotonic_ns();
+    return b.producer.post(index);
+}
+
+static void producer_loop(touch_bench_t *b)
+{
+    struct input_event ev;
+    struct pollfd pfd;
+    uint32_t seq = 0;
+
+    pfd.fd = b->input_fd;
+    pfd.events = POLLIN;
+
+    while(seq < b->samples && !b->stopping)
+    {
+        // uinput_t keeps its own end of the pipe open, poll so that we can be stopped
+        if(poll(&pfd, 1, 100) <= 0) continue;
+
+        if(read(b->input_fd, &ev, sizeof(ev)) != sizeof(ev))
+        {
+            cerr << "lost the uinput pipe" << endl;
+            b->failed = true;
+            return;
+        }
+
+        // every touch ends with one SYN_REPORT
+        if(ev.type != EV_SYN || ev.code != SYN_REPORT) continue;
+        b->uinput_ns[seq] = (int64_t)ev.time.tv_sec * 1000000000LL + (int64_t)ev.time.tv_usec * 1000;
+
+        // a failed post is a touch that is never presented
+        if(answer(*b, seq) != 0)
+        {
+            b->failed = true;
+            return;
+        }
+
+        if(b->wait_for_status() != 0)
+        {
+            b->failed = true;
+            return;
+        }
+
+        seq++;
+        b->answered = seq;
+    }
+}
+
+// one round of the main loop
+static void run_main_loop(touch_bench_t &b, int timeout_ms)
+{
+    int64_t deadline;
+
+    sfdroid_events_mutex.lock();
+    b.windowmanager.handle_sfdroid_events(true);
+    deadline = b.windowmanager.commit_due_frames(monotonic_ns());
+    sfdroid_events_mutex.unlock();
+
+    if(deadline) b.sfconnection.wait_for_event_ns(deadline - monotonic_ns());
+    else b.sfconnection.wait_for_event(timeout_ms);
+}
+
+// android keeps posting until the window shows something
+static int show_first_frame(touch_bench_t &b)
+{
+    int64_t deadline = monotonic_ns() + BENCH_EVENT_TIMEOUT_MS * 1000000LL;
+
+    while(monotonic_ns() < deadline)
+    {
+        uint64_t failed = b.producer.failed;
+
+        if(answer(b, NO_TOUCH) != 0) return -1;
+
+        while(!b.producer.outstanding.empty())
+        {
+            run_main_loop(b, 1);
+            if(b.producer.receive(0) < 0) return -1;
+            if(monotonic_ns() > deadline) break;
+        }
+
+        if(b.producer.outstanding.empty() && b.producer.failed == failed) return 0;
+    }
+
+    cerr << "sfdroid didn't show the first frame" << endl;
+    return -1;
+}
+
+// the first present of every touch, dummy frames show the same pixels again
+static int read_frames(touch_bench_t &b)
+{
+    ifstream in(FRAMES_FILE_BENCH, ios::binary);
+    struct frame_record_t record;
+    vector<char> pixels;
+
+    if(!in)
+    {
+        cerr << "failed to open " << FRAMES_FILE_BENCH << endl;
+        return -1;
+    }
+
+    while(in.read((char*)&record, sizeof(record)))
+    {
+        uint32_t seq;
+
+        if(record.magic != FRAME_RECORD_MAGIC || record.size < sizeof(record))
+        {
+            cerr << "invalid frame record" << endl;
+            return -1;
+        }
+
+        pixels.resize(record.size - sizeof(record));
+        if(!pixels.empty() && !in.read(pixels.data(), pixels.size())) break;
+        if(pixels.size() < sizeof(seq)) continue;
+
+        memcpy(&seq, pixels.data(), sizeof(seq));
+        if(seq < b.samples && b.present_ns[seq] == 0) b.present_ns[seq] = record.present_ns;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int err = 0;
+    double rate = 20.0;
+    uint32_t width = 64, height = 64;
+    touch_bench_t b;
+    int pipe_fds[2] = {-1, -1};
+    char sink[64];
+    std::thread producer;
+    int64_t interval_ns, next_ns, deadline;
+    uint32_t injected = 0;
+    uint64_t dropped = 0;
+    vector<int64_t> input_leg, android_leg, display_leg, total;
+    int opt;
+
+    b.samples = 300;
+    b.answered = 0;
+    b.failed = false;
+    b.stopping = false;
+
+    while((opt = getopt(argc, argv, "n:r:s:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n':
+                b.samples = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 's':
+                if(sscanf(optarg, "%ux%u", &width, &height) != 2)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    // a touch down, motions and an up
+    if(b.samples < 2 || rate <= 0 || width < 1 || height < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    b.inject_ns.resize(b.samples, 0);
+    b.uinput_ns.resize(b.samples, 0);
+    b.post_ns.resize(b.samples, 0);
+    b.present_ns.resize(b.samples, 0);
+
+    if(pipe(pipe_fds) < 0)
+    {
+        cerr << "failed to create pipe: " << strerror(errno) << endl;
+        return 2;
+    }
+    b.input_fd = pipe_fds[0];
+    snprintf(sink, sizeof(sink), "/proc/self/fd/%d", pipe_fds[1]);
+
+    setenv("SFDROID_PRESENT", "file", 1);
+    setenv("SFDROID_PRESENT_FILE", FRAMES_FILE_BENCH, 1);
+    setenv("SFDROID_PRESENT_PIXELS", "1", 1);
+    setenv("SFDROID_UINPUT", sink, 1);
+
+    if((err = b.start(width, height)) != 0) goto quit;
+
+    // the app's window and a first frame that answers no touch
+    if(b.producer.send_layer(SB_LAYER_NAME, "com.example.sfdroid_touch/com.example.sfdroid_touch.MainActivity", 1) < 0 || show_first_frame(b) != 0)
+    {
+        err = 4;
+        goto quit;
+    }
+
+    producer = std::thread(producer_loop, &b);
+
+    interval_ns = (int64_t)(1e9 / rate);
+    next_ns = monotonic_ns();
+    deadline = 0;
+
+    while(b.answered < b.samples && !b.failed)
+    {
+        int64_t now = monotonic_ns();
+
+        if(injected < b.samples && now >= next_ns)
+        {
+            // what the compositor sends, stamped with the clock sfdroid expects
+            wl_fixed_t x = wl_fixed_from_int(wayland_helper::width / 2 + injected % 16);
+            wl_fixed_t y = wl_fixed_from_int(wayland_helper::height / 2);
+            uint32_t time = (uint32_t)(now / 1000000);
+
+            b.inject_ns[injected] = now;
+            if(injected == 0) windowmanager_t::touch_handle_down(&b.windowmanager, nullptr, 0, time, nullptr, 0, x, y);
+            else if(injected == b.samples - 1) windowmanager_t::touch_handle_up(&b.windowmanager, nullptr, 0, time, 0);
+            else windowmanager_t::touch_handle_motion(&b.windowmanager, nullptr, time, 0, x, y);
+            windowmanager_t::touch_handle_frame(&b.windowmanager, nullptr);
+
+            injected++;
+            next_ns += interval_ns;
+            deadline = monotonic_ns() + BENCH_EVENT_TIMEOUT_MS * 1000000LL;
+        }
+
+        if(deadline && monotonic_ns() > deadline)
+        {
+            cerr << "touch " << b.answered << " wasn't answered" << endl;
+            b.failed = true;
+            break;
+        }
+
+        run_main_loop(b, 1);
+    }
+
+    if(b.failed)
+    {
+        err = 5;
+        goto quit;
+    }
+
+    if(read_frames(b) != 0)
+    {
+        err = 6;
+        goto quit;
+    }
+
+    for(uint32_t i=0;i<b.samples;i++)
+    {
+        input_leg.push_back(b.uinput_ns[i] - b.inject_ns[i]);
+        android_leg.push_back(b.post_ns[i] - b.uinput_ns[i]);
+        if(b.present_ns[i] == 0)
+        {
+            dropped++;
+            continue;
+        }
+        display_leg.push_back(b.present_ns[i] - b.post_ns[i]);
+        total.push_back(b.present_ns[i] - b.inject_ns[i]);
+    }
+
+    cout << b.samples << " touches, " << dropped << " never presented" << endl;
+    print_percentiles("input leg, wayland to uinput", input_leg);
+    print_percentiles("producer, uinput to post", android_leg);
+    print_percentiles("display leg, post to present", display_leg);
+    print_percentiles("touch to photon", total);
+
+quit:
+    b.stopping = true;
+    if(producer.joinable()) producer.join();
+    b.stop();
+    if(pipe_fds[0] >= 0) close(pipe_fds[0]);
+    if(pipe_fds[1] >= 0) close(pipe_fds[1]);
+    return err;
+}
@@ -0,0 +1,286 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// how the window manager scales with the number of open apps. opens apps
+// through layer names like android does (multiwindow), one frame each, and
+// at every step measures memory, file descriptors, wayland objects and how
+// long buffer and focus events take. built against sfdroid's objects, sfdroid
+// itself must not run, the benchmark takes over its socket. headless by
+// default, with SFDROID_PRESENT=wlegl it needs a compositor.
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include "sfdroid_defs.h"
+#include "windowmanager.h"
+#include "utility.h"
+#include "bench.h"
+
+using namespace std;
+
+// no dot, a layer that doesn't get its own window
+#define BLACKLISTED_LAYER "StatusBar"
+
+std::vector<sfdroid_event> sfdroid_events;
+std::mutex sfdroid_events_mutex;
+
+static void usage(const char *name)
+{
+    cout << name << " [-w counts] [-n events] [-s WxH]" << endl;
+    cout << "\t-w comma separated numbers of open apps, ascending (default 1,10,50,100)" << endl;
+    cout << "\t-n events of each kind measured per step (default 100)" << endl;
+    cout << "\t-s buffer size (default 720x1280)" << endl;
+}
+
+static long rss_kb()
+{
+    ifstream f("/proc/self/status");
+    string line;
+    long kb = -1;
+
+    while(getline(f, line))
+    {
+        if(sscanf(line.c_str(), "VmRSS: %ld kB", &kb) == 1) break;
+    }
+    return kb;
+}
+
+static int open_fds()
+{
+    DIR *dir = opendir("/proc/self/fd");
+    struct dirent *entry;
+    int count = 0;
+
+    if(!dir) return -1;
+    while((entry = readdir(dir)) != NULL)
+    {
+        if(entry->d_name[0] != '.') count++;
+    }
+    closedir(dir);
+
+    // without the one opendir() used
+    return count - 1;
+}
+
+// posts a frame and handles it like the main loop does, handle_ns is how long handle_buffer_event took
+static int post_frame(bench_fixture_t &b, int64_t &handle_ns)
+{
+    int64_t deadline = monotonic_ns() + BENCH_EVENT_TIMEOUT_MS * 1000000LL;
+    int64_t commit_deadline;
+    int index = b.producer.find_free_buffer();
+    bool handled = false;
+
+    if(index < 0 || b.producer.post(index) < 0) return -1;
+
+    while(!handled)
+    {
+        sfdroid_events_mutex.lock();
+        // alone in the queue, so that nothing else is timed with it
+        if(sfdroid_events.size() == 1 && sfdroid_events[0].type == BUFFER)
+        {
+            sfdroid_event &event = sfdroid_events[0];
+            int64_t start_ns = monotonic_ns();
+            bool shown = b.windowmanager.handle_buffer_event(event.data.buffer.buffer, *event.data.buffer.info, event.data.buffer.acquire_fence, event.data.buffer.frame_id);
+
+            handle_ns = monotonic_ns() - start_ns;
+            if(shown) b.sfconnection.notify_buffer_shown(event.data.buffer.buffer);
+            b.sfconnection.notify_buffer_done(shown ? 0 : 1);
+            if(event.data.buffer.acquire_fence >= 0) close(event.data.buffer.acquire_fence);
+            sfdroid_events.clear();
+            handled = true;
+        }
+        else b.windowmanager.handle_sfdroid_events(true);
+        sfdroid_events_mutex.unlock();
+
+        if(!handled)
+        {
+            if(monotonic_ns() > deadline)
+            {
+                cerr << "sfdroid didn't queue the frame in time" << endl;
+                return -1;
+            }
+            b.sfconnection.wait_for_event(1);
+        }
+    }
+
+    // late latched frames are committed before the next one comes
+    while(true)
+    {
+        sfdroid_events_mutex.lock();
+        b.windowmanager.handle_sfdroid_events(true);
+        commit_deadline = b.windowmanager.commit_due_frames(monotonic_ns());
+        sfdroid_events_mutex.unlock();
+
+        if(commit_deadline == 0) break;
+        b.sfconnection.wait_for_event_ns(commit_deadline - monotonic_ns());
+    }
+
+    return b.wait_for_status();
+}
+
+// a blacklisted layer takes the focus away from every window, the app's
+// layer name gives it back. both run on the main thread like in the main loop
+static void switch_focus(bench_fixture_t &b, int app, int64_t &take_ns, int64_t &back_ns)
+{
+    string name = bench_fixture_t::layer_name(app);
+    vector<char> app_layer(name.begin(), name.end());
+    char blacklisted[] = BLACKLISTED_LAYER;
+    int64_t t0, t1, t2;
+
+    app_layer.push_back(0);
+
+    t0 = monotonic_ns();
+    b.windowmanager.handle_layer_name_event(blacklisted);
+    t1 = monotonic_ns();
+    b.windowmanager.handle_layer_name_event(app_layer.data());
+    t2 = monotonic_ns();
+
+    take_ns = t1 - t0;
+    back_ns = t2 - t1;
+}
+
+static int measure(bench_fixture_t &b, int apps, int events, long base_rss_kb)
+{
+    vector<int64_t> buffer_ns, take_ns, back_ns;
+    long rss = rss_kb();
+
+    for(int i=0;i<events;i++)
+    {
+        int64_t ns, back;
+
+        if(post_frame(b, ns) != 0) return -1;
+        buffer_ns.push_back(ns);
+
+        switch_focus(b, apps - 1, ns, back);
+        take_ns.push_back(ns);
+        back_ns.push_back(back);
+    }
+
+    cout << apps << " windows: rss " << rss / 1024.0 << " MB (" << (rss - base_rss_kb) / (double)apps << " kB per window), "
+         << open_fds() << " fds, " << b.windowmanager.wayland_objects() << " wayland objects" << endl;
+    print_percentiles("\thandle_buffer_event", buffer_ns);
+    print_percentiles("\tblacklisted layer, take_focus", take_ns);
+    print_percentiles("\tlayer name, focus back", back_ns);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int err = 0;
+    vector<int> counts = { 1, 10, 50, 100 };
+    int events = 100;
+    uint32_t width = 720, height = 1280;
+    bench_fixture_t b;
+    long base_rss;
+    int opened = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "w:n:s:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'w':
+            {
+                stringstream list(optarg);
+                string count;
+
+                counts.clear();
+                while(getline(list, count, ',')) counts.push_back(atoi(count.c_str()));
+                break;
+            }
+            case 'n':
+                events = atoi(optarg);
+                break;
+            case 's':
+                if(sscanf(optarg, "%ux%u", &width, &height) != 2)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    for(size_t i=0;i<counts.size();i++)
+    {
+        if(counts[i] < 1 || (i > 0 && counts[i] <= counts[i - 1]))
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(counts.empty() || events < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if((err = b.start(width, height)) != 0) goto quit;
+
+    cout << fixed << setprecision(1);
+    base_rss = rss_kb();
+    cout << "no windows: rss " << base_rss / 1024.0 << " MB, " << open_fds() << " fds" << endl;
+
+    for(size_t i=0;i<counts.size();i++)
+    {
+        // android starts them one after another, the last one has the focus
+        for(;opened<counts[i];opened++)
+        {
+            if(b.open_app(opened) != 0)
+            {
+                err = 4;
+                goto quit;
+            }
+        }
+
+        if(b.windowmanager.window_count() != (size_t)opened)
+        {
+            cerr << b.windowmanager.window_count() << " windows for " << opened << " apps" << endl;
+            err = 4;
+            goto quit;
+        }
+
+        if(measure(b, opened, events, base_rss) != 0)
+        {
+            err = 5;
+            goto quit;
+        }
+    }
+
+quit:
+    b.stop();
+    return err;
+}
@@ -0,0 +1,1168 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// a headless stand-in for lipstick: implements just the globals sfdroid binds
+// (wl_compositor, wl_shell, wl_output, wl_seat, qt_surface_extension and
+// android_wlegl), accepts buffers without looking at them, fires frame
+// callbacks at a fixed refresh rate and plays a script of touch and keyboard
+// focus events. every commit, presentation and injected event is logged with
+// its CLOCK_MONOTONIC timestamp so runs can be compared.
+//
+// EGL is not provided, sfdroid's dummy draw and screenshot paths need a real
+// compositor.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <list>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+
+#include <sys/timerfd.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <wayland-server.h>
+#include "wayland-android-server-protocol.h"
+
+using namespace std;
+
+#define DEFAULT_DISPLAY_NAME "sfdroid-test"
+#define MAX_HANDLE_FDS 16
+
+struct compositor_t;
+
+struct buffer_t
+{
+    struct wl_resource *resource;
+    compositor_t *compositor;
+    int32_t width;
+    int32_t height;
+    vector<int> fds;
+    vector<int32_t> ints;
+};
+
+struct handle_t
+{
+    int32_t num_fds;
+    vector<int> fds;
+    vector<int32_t> ints;
+};
+
+struct surface_t
+{
+    struct wl_resource *resource;
+    struct wl_resource *extended; // qt_extended_surface, for the close event
+    compositor_t *compositor;
+    buffer_t *pending;
+    bool pending_attached;
+    buffer_t *current;
+    bool current_presented;
+    vector<buffer_t*> releases; // replaced by current, released once it is shown
+    vector<struct wl_resource*> pending_callbacks;
+    vector<struct wl_resource*> frame_callbacks;
+};
+
+enum script_command_t
+{
+    SCRIPT_DOWN,
+    SCRIPT_MOTION,
+    SCRIPT_UP,
+    SCRIPT_FOCUS,
+    SCRIPT_LEAVE,
+    SCRIPT_CLOSE,
+    SCRIPT_QUIT,
+};
+
+struct script_event_t
+{
+    int64_t at_ms; // after the first surface got created
+    script_command_t command;
+    int32_t id;  // touch id, or surface index for focus and close, -1 for the newest
+    int32_t x;
+    int32_t y;
+};
+
+struct compositor_t
+{
+    struct wl_display *display;
+    struct wl_event_source *refresh_source;
+    struct wl_event_source *script_source;
+    int timer_fd;
+    int32_t width;
+    int32_t height;
+    double refresh_rate;
+    ostream *log;
+    list<surface_t*> surfaces;
+    vector<struct wl_resource*> touches;
+    vector<struct wl_resource*> keyboards;
+    surface_t *focus;
+    vector<script_event_t> script;
+    size_t next_event;
+    int64_t script_start_ns;
+    uint64_t commits;
+    uint64_t presents;
+};
+
+static int64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint32_t monotonic_ms()
+{
+    return (uint32_t)(monotonic_ns() / 1000000);
+}
+
+static ostream &log_line(compositor_t *c)
+{
+    return *c->log << monotonic_ns() << " ";
+}
+
+static void remove_resource(vector<struct wl_resource*> &resources, struct wl_resource *resource)
+{
+    resources.erase(remove(resources.begin(), resources.end(), resource), resources.end());
+}
+
+// qt_surface_extension is not shipped as xml, the interfaces mirror the
+// client side ones in wayland_helper.cpp
+
+struct qt_surface_extension_implementation
+{
+    void (*get_extended_surface)(struct wl_client *client, struct wl_resource *resource, uint32_t id, struct wl_resource *surface);
+};
+
+struct qt_extended_surface_implementation
+{
+    void (*update_generic_property)(struct wl_client *client, struct wl_resource *resource, const char *name, struct wl_array *value);
+    void (*set_content_orientation)(struct wl_client *client, struct wl_resource *resource, int32_t orientation);
+    void (*set_window_flags)(struct wl_client *client, struct wl_resource *resource, int32_t flags);
+};
+
+#define QT_EXTENDED_SURFACE_CLOSE 2
+
+extern const struct wl_interface qt_extended_surface_interface;
+
+static const struct wl_interface *qt_surface_extension_types[4] = {
+    NULL,
+    NULL,
+    &qt_extended_surface_interface,
+    &wl_surface_interface,
+};
+
+static const struct wl_message qt_extended_surface_requests[3] = {
+    { "update_generic_property", "sa", qt_surface_extension_types + 0 },
+    { "set_content_orientation", "i", qt_surface_extension_types + 0 },
+    { "set_window_flags", "i", qt_surface_extension_types + 0 },
+};
+
+static const struct wl_message qt_extended_surface_events[3] = {
+    { "onscreen_visibility", "i", qt_surface_extension_types + 0 },
+    { "set_generic_property", "sa", qt_surface_extension_types + 0 },
+    { "close", "", qt_surface_extension_types + 0 },
+};
+
+const struct wl_interface qt_extended_surface_interface = {
+    "qt_extended_surface", 1,
+    3, qt_extended_surface_requests,
+    3, qt_extended_surface_events,
+};
+
+static const struct wl_message qt_surface_extension_requests[1] = {
+    { "get_extended_surface", "no", qt_surface_extension_types + 2 },
+};
+
+static const struct wl_interface qt_surface_extension_interface = {
+    "qt_surface_extension", 1,
+    1, qt_surface_extension_requests,
+    0, NULL,
+};
+
+// buffers
+
+static void buffer_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+    wl_resource_destroy(resource);
+}
+
+static const struct wl_buffer_interface buffer_implementation = {
+    buffer_destroy,
+};
+
+static void buffer_resource_destroy(struct wl_resource *resource)
+{
+    buffer_t *buffer = (buffer_t*)wl_resource_get_user_data(resource);
+    compositor_t *c = buffer->compositor;
+
+    for(list<surface_t*>::iterator it = c->surfaces.begin();it != c->surfaces.end();it++)
+    {
+        surface_t *surface = *it;
+
+        if(surface->pending == buffer) surface->pending = NULL;
+        if(surface->current == buffer) surface->current = NULL;
+        surface->releases.erase(remove(surface->releases.begin(), surface->releases.end(), buffer), surface->releases.end());
+    }
+
+    for(size_t i=0;i<buffer->fds.size();i++) close(buffer->fds[i]);
+    delete buffer;
+}
+
+static void release_buffer(buffer_t *buffer)
+{
+    wl_buffer_send_release(buffer->resource);
+}
+
+// android_wlegl
+
+static void handle_add_fd(struct wl_client *client, struct wl_resource *resource, int32_t fd)
+{
+    handle_t *handle = (handle_t*)wl_resource_get_user_data(resource);
+
+    if((int32_t)handle->fds.size() >= handle->num_fds)
+    {
+        close(fd);
+        wl_resource_post_error(resource, ANDROID_WLEGL_HANDLE_ERROR_TOO_MANY_FDS, "too many file descriptors");
+        return;
+    }
+
+    handle->fds.push_back(fd);
+}
+
+static void handle_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+    wl_resource_destroy(resource);
+}
+
+static const struct android_wlegl_handle_interface handle_implementation = {
+    handle_add_fd,
+    handle_destroy,
+};
+
+static void handle_resource_destroy(struct wl_resource *resource)
+{
+    handle_t *handle = (handle_t*)wl_resource_get_user_data(resource);
+
+    for(size_t i=0;i<handle->fds.size();i++) close(handle->fds[i]);
+    delete handle;
+}
+
+static void wlegl_create_handle(struct wl_client *client, struct wl_resource *resource, uint32_t id, int32_t num_fds, struct wl_array *ints)
+{
+    struct wl_resource *handle_resource;
+    handle_t *handle;
+
+    if(num_fds < 0 || num_fds > MAX_HANDLE_FDS)
+    {
+        wl_resource_post_error(resource, ANDROID_WLEGL_ERROR_BAD_VALUE, "invalid number of file descriptors");
+        return;
+    }
+
+    handle_resource = wl_resource_create(client, &android_wlegl_handle_interface, wl_resource_get_version(resource), id);
+    if(handle_resource == NULL)
+    {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    handle = new handle_t;
+    handle->num_fds = num_fds;
+    handle->ints.assign((int32_t*)ints->data, (int32_t*)ints->data + ints->size / sizeof(int32_t));
+    wl_resource_set_implementation(handle_resource, &handle_implementation, handle, handle_resource_destroy);
+}
+
+static void wlegl_create_buffer(struct wl_client *client, struct wl_resource *resource, uint32_t id, int32_t width, int32_t height, int32_t stride, int32_t format, int32_t usage, struct wl_resource *native_handle)
+{
+    compositor_t *c = (compositor_t*)wl_resource_get_user_data(resource);
+    handle_t *handle = (handle_t*)wl_resource_get_user_data(native_handle);
+    buffer_t *buffer;
+
+    if((int32_t)handle->fds.size() != handle->num_fds)
+    {
+        wl_resource_post_error(resource, ANDROID_WLEGL_ERROR_BAD_HANDLE, "native handle is missing file descriptors");
+        return;
+    }
+
+    if(width < 1 || height < 1)
+    {
+        wl_resource_post_error(resource, ANDROID_WLEGL_ERROR_BAD_VALUE, "invalid buffer size");
+        return;
+    }
+
+    buffer = new buffer_t;
+    buffer->resource = wl_resource_create(client, &wl_buffer_interface, 1, id);
+    if(buffer->resource == NULL)
+    {
+        delete buffer;
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    // the client destroys the handle right away, the buffer keeps its fds
+    buffer->compositor = c;
+    buffer->width = width;
+    buffer->height = height;
+    buffer->fds.swap(handle->fds);
+    buffer->ints.swap(handle->ints);
+    wl_resource_set_implementation(buffer->resource, &buffer_implementation, buffer, buffer_resource_destroy);
+
+    log_line(c) << "buffer " << wl_resource_get_id(buffer->resource) << " " << width << "x" << height << " stride " << stride << " format " << format << " usage 0x" << hex << usage << dec << endl;
+}
+
+static void wlegl_get_server_buffer_handle(struct wl_client *client, struct wl_resource *resource, uint32_t id, int32_t width, int32_t height, int32_t format, int32_t usage)
+{
+    wl_resource_post_error(resource, ANDROID_WLEGL_ERROR_BAD_VALUE, "server allocated buffers are not supported");
+}
+
+static const struct android_wlegl_interface wlegl_implementation = {
+    wlegl_create_handle,
+    wlegl_create_buffer,
+    wlegl_get_server_buffer_handle,
+};
+
+static void bind_wlegl(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client, &android_wlegl_interface, version, id);
+
+    if(resource == NULL)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &wlegl_implementation, data, NULL);
+}
+
+// frame callbacks
+
+static void callback_resource_destroy(struct wl_resource *resource)
+{
+    surface_t *surface = (surface_t*)wl_resource_get_user_data(resource);
+
+    if(surface == NULL) return;
+    remove_resource(surface->pending_callbacks, resource);
+    remove_resource(surface->frame_callbacks, resource);
+}
+
+// surfaces
+
+static void surface_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+    wl_resource_destroy(resource);
+}
+
+static void surface_attach(struct wl_client *client, struct wl_resource *resource, struct wl_resource *buffer_resource, int32_t x, int32_t y)
+{
+    surface_t *surface = (surface_t*)wl_resource_get_user_data(resource);
+
+    surface->pending = buffer_resource ? (buffer_t*)wl_resource_get_user_data(buffer_resource) : NULL;
+    surface->pending_attached = true;
+}
+
+static void surface_damage(struct wl_client *client, struct wl_resource *resource, int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static void surface_frame(struct wl_client *client, struct wl_resource *resource, uint32_t callback)
+{
+    surface_t *surface = (surface_t*)wl_resource_get_user_data(resource);
+    struct wl_resource *callback_resource = wl_resource_create(client, &wl_callback_interface, 1, callback);
+
+    if(callback_resource == NULL)
+    {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    wl_resource_set_implementation(callback_resource, NULL, surface, callback_resource_destroy);
+    surface->pending_callbacks.push_back(callback_resource);
+}
+
+static void surface_set_region(struct wl_client *client, struct wl_resource *resource, struct wl_resource *region)
+{
+}
+
+static void surface_commit(struct wl_client *client, struct wl_resource *resource)
+{
+    surface_t *surface = (surface_t*)wl_resource_get_user_data(resource);
+    compositor_t *c = surface->compositor;
+
+    if(surface->pending_attached && surface->pending != surface->current)
+    {
+        if(surface->current != NULL)
+        {
+            // a buffer that never made it to the screen can go back right away
+            if(surface->current_presented) surface->releases.push_back(surface->current);
+            else release_buffer(surface->current);
+        }
+        surface->current = surface->pending;
+        surface->current_presented = false;
+    }
+    surface->pending = NULL;
+    surface->pending_attached = false;
+
+    surface->frame_callbacks.insert(surface->frame_callbacks.end(), surface->pending_callbacks.begin(), surface->pending_callbacks.end());
+    surface->pending_callbacks.clear();
+
+    c->commits++;
+    log_line(c) << "commit surface " << wl_resource_get_id(resource) << " buffer " << (surface->current ? (int)wl_resource_get_id(surface->current->resource) : 0) << endl;
+}
+
+static void surface_set_buffer_transform(struct wl_client *client, struct wl_resource *resource, int32_t transform)
+{
+}
+
+static void surface_set_buffer_scale(struct wl_client *client, struct wl_resource *resource, int32_t scale)
+{
+}
+
+static const struct wl_surface_interface surface_implementation = {
+    surface_destroy,
+    surface_attach,
+    surface_damage,
+    surface_frame,
+    surface_set_region,
+    surface_set_region,
+    surface_commit,
+    surface_set_buffer_transform,
+    surface_set_buffer_scale,
+};
+
+static void surface_resource_destroy(struct wl_resource *resource)
+{
+    surface_t *surface = (surface_t*)wl_resource_get_user_data(resource);
+    compositor_t *c = surface->compositor;
+
+    for(size_t i=0;i<surface->pending_callbacks.size();i++) wl_resource_set_user_data(surface->pending_callbacks[i], NULL);
+    for(size_t i=0;i<surface->frame_callbacks.size();i++) wl_resource_set_user_data(surface->frame_callbacks[i], NULL);
+    if(surface->extended) wl_resource_set_user_data(surface->extended, NULL);
+
+    if(c->focus == surface) c->focus = NULL;
+    c->surfaces.remove(surface);
+
+    log_line(c) << "destroy surface " << wl_resource_get_id(resource) << endl;
+    delete surface;
+}
+
+// regions are accepted and ignored
+
+static void region_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+    wl_resource_destroy(resource);
+}
+
+static void region_add(struct wl_client *client, struct wl_resource *resource, int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static const struct wl_region_interface region_implementation = {
+    region_destroy,
+    region_add,
+    region_add,
+};
+
+// wl_compositor
+
+static void compositor_create_surface(struct wl_client *client, struct wl_resource *resource, uint32_t id)
+{
+    compositor_t *c = (compositor_t*)wl_resource_get_user_data(resource);
+    surface_t *surface = new surface_t;
+
+    surface->resource = wl_resource_create(client, &wl_surface_interface, wl_resource_get_version(resource), id);
+    if(surface->resource == NULL)
+    {
+        delete surface;
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    surface->extended = NULL;
+    surface->compositor = c;
+    surface->pending = NULL;
+    surface->pending_attached = false;
+    surface->current = NULL;
+    surface->current_presented = false;
+    wl_resource_set_implementation(surface->resource, &surface_implementation, surface, surface_resource_destroy);
+    c->surfaces.push_back(surface);
+
+    log_line(c) << "create surface " << id << endl;
+
+    // the script runs relative to the first window
+    if(c->script_start_ns == 0 && !c->script.empty())
+    {
+        c->script_start_ns = monotonic_ns();
+        wl_event_source_timer_update(c->script_source, max<int64_t>(c->script[0].at_ms, 1));
+    }
+}
+
+static void compositor_create_region(struct wl_client *client, struct wl_resource *resource, uint32_t id)
+{
+    struct wl_resource *region = wl_resource_create(client, &wl_region_interface, 1, id);
+
+    if(region == NULL)
+    {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+    wl_resource_set_implementation(region, &region_implementation, NULL, NULL);
+}
+
+static const struct wl_compositor_interface compositor_implementation = {
+    compositor_create_surface,
+    compositor_create_region,
+};
+
+static void bind_compositor(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client, &wl_compositor_interface, version, id);
+
+    if(resource == NULL)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &compositor_implementation, data, NULL);
+}
+
+// wl_shell, every request is accepted and ignored
+
+static void shell_surface_pong(struct wl_client *client, struct wl_resource *resource, uint32_t serial)
+{
+}
+
+static void shell_surface_move(struct wl_client *client, struct wl_resource *resource, struct wl_resource *seat, uint32_t serial)
+{
+}
+
+static void shell_surface_resize(struct wl_client *client, struct wl_resource *resource, struct wl_resource *seat, uint32_t serial, uint32_t edges)
+{
+}
+
+static void shell_surface_set_toplevel(struct wl_client *client, struct wl_resource *resource)
+{
+}
+
+static void shell_surface_set_transient(struct wl_client *client, struct wl_resource *resource, struct wl_resource *parent, int32_t x, int32_t y, uint32_t flags)
+{
+}
+
+static void shell_surface_set_fullscreen(struct wl_client *client, struct wl_resource *resource, uint32_t method, uint32_t framerate, struct wl_resource *output)
+{
+}
+
+static void shell_surface_set_popup(struct wl_client *client, struct wl_resource *resource, struct wl_resource *seat, uint32_t serial, struct wl_resource *parent, int32_t x, int32_t y, uint32_t flags)
+{
+}
+
+static void shell_surface_set_maximized(struct wl_client *client, struct wl_resource *resource, struct wl_resource *output)
+{
+}
+
+static void shell_surface_set_string(struct wl_client *client, struct wl_resource *resource, const char *title)
+{
+}
+
+static const struct wl_shell_surface_interface shell_surface_implementation = {
+    shell_surface_pong,
+    shell_surface_move,
+    shell_surface_resize,
+    shell_surface_set_toplevel,
+    shell_surface_set_transient,
+    shell_surface_set_fullscreen,
+    shell_surface_set_popup,
+    shell_surface_set_maximized,
+    shell_surface_set_string,
+    shell_surface_set_string,
+};
+
+static void shell_get_shell_surface(struct wl_client *client, struct wl_resource *resource, uint32_t id, struct wl_resource *surface)
+{
+    struct wl_resource *shell_surface = wl_resource_create(client, &wl_shell_surface_interface, 1, id);
+
+    if(shell_surface == NULL)
+    {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+    wl_resource_set_implementation(shell_surface, &shell_surface_implementation, NULL, NULL);
+}
+
+static const struct wl_shell_interface shell_implementation = {
+    shell_get_shell_surface,
+};
+
+static void bind_shell(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client, &wl_shell_interface, version, id);
+
+    if(resource == NULL)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &shell_implementation, data, NULL);
+}
+
+// qt_surface_extension
+
+static void extended_surface_update_generic_property(struct wl_client *client, struct wl_resource *resource, const char *name, struct wl_array *value)
+{
+}
+
+static void extended_surface_set_int(struct wl_client *client, struct wl_resource *resource, int32_t value)
+{
+}
+
+static const struct qt_extended_surface_implementation extended_surface_implementation = {
+    extended_surface_update_generic_property,
+    extended_surface_set_int,
+    extended_surface_set_int,
+};
+
+static void extended_surface_resource_destroy(struct wl_resource *resource)
+{
+    surface_t *surface = (surface_t*)wl_resource_get_user_data(resource);
+
+    if(surface != NULL && surface->extended == resource) surface->extended = NULL;
+}
+
+static void surface_extension_get_extended_surface(struct wl_client *client, struct wl_resource *resource, uint32_t id, struct wl_resource *surface_resource)
+{
+    surface_t *surface = (surface_t*)wl_resource_get_user_data(surface_resource);
+    struct wl_resource *extended = wl_resource_create(client, &qt_extended_surface_interface, 1, id);
+
+    if(extended == NULL)
+    {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+    wl_resource_set_implementation(extended, &extended_surface_implementation, surface, extended_surface_resource_destroy);
+    surface->extended = extended;
+}
+
+static const struct qt_surface_extension_implementation surface_extension_implementation = {
+    surface_extension_get_extended_surface,
+};
+
+static void bind_surface_extension(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client, &qt_surface_extension_interface, version, id);
+
+    if(resource == NULL)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &surface_extension_implementation, data, NULL);
+}
+
+// wl_output
+
+static void bind_output(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+    compositor_t *c = (compositor_t*)data;
+    struct wl_resource *resource = wl_resource_create(client, &wl_output_interface, version, id);
+
+    if(resource == NULL)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, NULL, data, NULL);
+
+    wl_output_send_geometry(resource, 0, 0, c->width / 10, c->height / 10, WL_OUTPUT_SUBPIXEL_UNKNOWN, "sfdroid", "headless", WL_OUTPUT_TRANSFORM_NORMAL);
+    wl_output_send_mode(resource, WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED, c->width, c->height, (int32_t)(c->refresh_rate * 1000));
+    if(version >= WL_OUTPUT_DONE_SINCE_VERSION) wl_output_send_done(resource);
+}
+
+// wl_seat with touch and keyboard
+
+static void input_release(struct wl_client *client, struct wl_resource *resource)
+{
+    wl_resource_destroy(resource);
+}
+
+static const struct wl_touch_interface touch_implementation = {
+    input_release,
+};
+
+static const struct wl_keyboard_interface keyboard_implementation = {
+    input_release,
+};
+
+static void touch_resource_destroy(struct wl_resource *resource)
+{
+    compositor_t *c = (compositor_t*)wl_resource_get_user_data(resource);
+    remove_resource(c->touches, resource);
+}
+
+static void keyboard_resource_destroy(struct wl_resource *resource)
+{
+    compositor_t *c = (compositor_t*)wl_resource_get_user_data(resource);
+    remove_resource(c->keyboards, resource);
+}
+
+static void seat_get_pointer(struct wl_client *client, struct wl_resource *resource, uint32_t id)
+{
+    wl_resource_post_error(resource, WL_SEAT_ERROR_MISSING_CAPABILITY, "no pointer");
+}
+
+static void seat_get_keyboard(struct wl_client *client, struct wl_resource *resource, uint32_t id)
+{
+    compositor_t *c = (compositor_t*)wl_resource_get_user_data(resource);
+    struct wl_resource *keyboard = wl_resource_create(client, &wl_keyboard_interface, wl_resource_get_version(resource), id);
+
+    if(keyboard == NULL)
+    {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+    wl_resource_set_implementation(keyboard, &keyboard_implementation, c, keyboard_resource_destroy);
+    c->keyboards.push_back(keyboard);
+}
+
+static void seat_get_touch(struct wl_client *client, struct wl_resource *resource, uint32_t id)
+{
+    compositor_t *c = (compositor_t*)wl_resource_get_user_data(resource);
+    struct wl_resource *touch = wl_resource_create(client, &wl_touch_interface, wl_resource_get_version(resource), id);
+
+    if(touch == NULL)
+    {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+    wl_resource_set_implementation(touch, &touch_implementation, c, touch_resource_destroy);
+    c->touches.push_back(touch);
+}
+
+static const struct wl_seat_interface seat_implementation = {
+    seat_get_pointer,
+    seat_get_keyboard,
+    seat_get_touch,
+    input_release,
+};
+
+static void bind_seat(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client, &wl_seat_interface, version, id);
+
+    if(resource == NULL)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &seat_implementation, data, NULL);
+    wl_seat_send_capabilities(resource, WL_SEAT_CAPABILITY_TOUCH | WL_SEAT_CAPABILITY_KEYBOARD);
+}
+
+// refresh
+
+static int handle_refresh(int fd, uint32_t mask, void *data)
+{
+    compositor_t *c = (compositor_t*)data;
+    uint64_t expirations;
+    uint32_t time = monotonic_ms();
+
+    if(read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return 0;
+
+    for(list<surface_t*>::iterator it = c->surfaces.begin();it != c->surfaces.end();it++)
+    {
+        surface_t *surface = *it;
+
+        for(size_t i=0;i<surface->releases.size();i++) release_buffer(surface->releases[i]);
+        surface->releases.clear();
+
+        if(surface->current != NULL && !surface->current_presented)
+        {
+            surface->current_presented = true;
+            c->presents++;
+            log_line(c) << "present surface " << wl_resource_get_id(surface->resource) << " buffer " << wl_resource_get_id(surface->current->resource) << endl;
+        }
+
+        for(size_t i=0;i<surface->frame_callbacks.size();i++)
+        {
+            wl_callback_send_done(surface->frame_callbacks[i], time);
+            wl_resource_set_user_data(surface->frame_callbacks[i], NULL);
+            wl_resource_destroy(surface->frame_callbacks[i]);
+        }
+        surface->frame_callbacks.clear();
+    }
+
+    if(expirations > 1) log_line(c) << "missed " << expirations - 1 << " refreshes" << endl;
+
+    return 0;
+}
+
+// script
+
+static surface_t *find_surface(compositor_t *c, int32_t index)
+{
+    int32_t i = 0;
+
+    if(c->surfaces.empty()) return NULL;
+    if(index < 0) return c->surfaces.back();
+
+    for(list<surface_t*>::iterator it = c->surfaces.begin();it != c->surfaces.end();it++, i++)
+    {
+        if(i == index) return *it;
+    }
+    return NULL;
+}
+
+static void send_to_client(vector<struct wl_resource*> &resources, struct wl_client *client, vector<struct wl_resource*> &out)
+{
+    for(size_t i=0;i<resources.size();i++)
+    {
+        if(wl_resource_get_client(resources[i]) == client) out.push_back(resources[i]);
+    }
+}
+
+static void set_focus(compositor_t *c, surface_t *surface)
+{
+    vector<struct wl_resource*> keyboards;
+    struct wl_array keys;
+
+    if(c->focus == surface) return;
+
+    if(c->focus != NULL)
+    {
+        send_to_client(c->keyboards, wl_resource_get_client(c->focus->resource), keyboards);
+        for(size_t i=0;i<keyboards.size();i++) wl_keyboard_send_leave(keyboards[i], wl_display_next_serial(c->display), c->focus->resource);
+        log_line(c) << "leave surface " << wl_resource_get_id(c->focus->resource) << endl;
+    }
+
+    c->focus = surface;
+    if(surface == NULL) return;
+
+    keyboards.clear();
+    wl_array_init(&keys);
+    send_to_client(c->keyboards, wl_resource_get_client(surface->resource), keyboards);
+    for(size_t i=0;i<keyboards.size();i++) wl_keyboard_send_enter(keyboards[i], wl_display_next_serial(c->display), surface->resource, &keys);
+    wl_array_release(&keys);
+    log_line(c) << "enter surface " << wl_resource_get_id(surface->resource) << endl;
+}
+
+static void run_event(compositor_t *c, const script_event_t &e)
+{
+    surface_t *target = c->focus ? c->focus : find_surface(c, -1);
+    vector<struct wl_resource*> touches;
+    uint32_t time = monotonic_ms();
+
+    if(e.command == SCRIPT_DOWN || e.command == SCRIPT_MOTION || e.command == SCRIPT_UP)
+    {
+        if(target == NULL) return;
+        send_to_client(c->touches, wl_resource_get_client(target->resource), touches);
+    }
+
+    switch(e.command)
+    {
+        case SCRIPT_DOWN:
+            for(size_t i=0;i<touches.size();i++)
+            {
+                wl_touch_send_down(touches[i], wl_display_next_serial(c->display), time, target->resource, e.id, wl_fixed_from_int(e.x), wl_fixed_from_int(e.y));
+                wl_touch_send_frame(touches[i]);
+            }
+            log_line(c) << "touch down " << e.id << " " << e.x << " " << e.y << endl;
+            break;
+        case SCRIPT_MOTION:
+            for(size_t i=0;i<touches.size();i++)
+            {
+                wl_touch_send_motion(touches[i], time, e.id, wl_fixed_from_int(e.x), wl_fixed_from_int(e.y));
+                wl_touch_send_frame(touches[i]);
+            }
+            log_line(c) << "touch motion " << e.id << " " << e.x << " " << e.y << endl;
+            break;
+        case SCRIPT_UP:
+            for(size_t i=0;i<touches.size();i++)
+            {
+                wl_touch_send_up(touches[i], wl_display_next_serial(c->display), time, e.id);
+                wl_touch_send_frame(touches[i]);
+            }
+            log_line(c) << "touch up " << e.id << endl;
+            break;
+        case SCRIPT_FOCUS:
+            set_focus(c, find_surface(c, e.id));
+            break;
+        case SCRIPT_LEAVE:
+            set_focus(c, NULL);
+            break;
+        case SCRIPT_CLOSE:
+            target = find_surface(c, e.id);
+            if(target != NULL && target->extended != NULL)
+            {
+                wl_resource_post_event(target->extended, QT_EXTENDED_SURFACE_CLOSE);
+                log_line(c) << "close surface " << wl_resource_get_id(target->resource) << endl;
+            }
+            break;
+        case SCRIPT_QUIT:
+            wl_display_terminate(c->display);
+            break;
+    }
+}
+
+static int handle_script(void *data)
+{
+    compositor_t *c = (compositor_t*)data;
+    int64_t elapsed_ms = (monotonic_ns() - c->script_start_ns) / 1000000;
+
+    while(c->next_event < c->script.size() && c->script[c->next_event].at_ms <= elapsed_ms)
+    {
+        run_event(c, c->script[c->next_event]);
+        c->next_event++;
+    }
+
+    if(c->next_event < c->script.size())
+    {
+        wl_event_source_timer_update(c->script_source, max<int64_t>(c->script[c->next_event].at_ms - elapsed_ms, 1));
+    }
+
+    return 0;
+}
+
+// one event per line: "<ms> down <id> <x> <y>", "<ms> motion <id> <x> <y>",
+// "<ms> up <id>", "<ms> focus [surface]", "<ms> leave", "<ms> close [surface]"
+// or "<ms> quit". surfaces are numbered in creation order, without a number
+// the newest one is used. touches go to the focused surface.
+static int load_script(const char *file, vector<script_event_t> &script)
+{
+    ifstream f(file);
+    string line;
+    int line_number = 0;
+
+    if(!f.is_open())
+    {
+        cerr << "failed to open " << file << ": " << strerror(errno) << endl;
+        return -1;
+    }
+
+    while(getline(f, line))
+    {
+        istringstream in(line);
+        script_event_t e;
+        string command;
+
+        line_number++;
+        if(!(in >> e.at_ms) || line[0] == '#') continue;
+        in >> command;
+
+        e.id = -1;
+        e.x = e.y = 0;
+        if(command == "down" || command == "motion")
+        {
+            e.command = (command == "down") ? SCRIPT_DOWN : SCRIPT_MOTION;
+            if(!(in >> e.id >> e.x >> e.y)) goto bad_line;
+        }
+        else if(command == "up")
+        {
+            e.command = SCRIPT_UP;
+            if(!(in >> e.id)) goto bad_line;
+        }
+        else if(command == "focus" || command == "close")
+        {
+            e.command = (command == "focus") ? SCRIPT_FOCUS : SCRIPT_CLOSE;
+            in >> e.id;
+        }
+        else if(command == "leave") e.command = SCRIPT_LEAVE;
+        else if(command == "quit") e.command = SCRIPT_QUIT;
+        else goto bad_line;
+
+        script.push_back(e);
+        continue;
+
+bad_line:
+        cerr << file << ":" << line_number << ": invalid event" << endl;
+        return -1;
+    }
+
+    stable_sort(script.begin(), script.end(), [](const script_event_t &a, const script_event_t &b) { return a.at_ms < b.at_ms; });
+    return 0;
+}
+
+static int handle_signal(int signal_number, void *data)
+{
+    compositor_t *c = (compositor_t*)data;
+    wl_display_terminate(c->display);
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    cout << name << " [-d display] [-r hz] [-s WxH] [-e script] [-l log]" << endl;
+    cout << "\t-d socket name in XDG_RUNTIME_DIR (default " << DEFAULT_DISPLAY_NAME << ")" << endl;
+    cout << "\t-r refresh rate (default 60)" << endl;
+    cout << "\t-s output size (default 720x1280)" << endl;
+    cout << "\t-e script of touch and focus events, see load_script()" << endl;
+    cout << "\t-l log file (default stdout)" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int err = 0;
+    const char *display_name = DEFAULT_DISPLAY_NAME;
+    const char *script_file = NULL;
+    const char *log_file = NULL;
+    ofstream log;
+    compositor_t c;
+    struct wl_event_loop *loop;
+    struct wl_event_source *sigint_source = NULL, *sigterm_source = NULL;
+    struct itimerspec period;
+    int64_t interval_ns;
+    int opt;
+
+    c.display = NULL;
+    c.refresh_source = NULL;
+    c.script_source = NULL;
+    c.timer_fd = -1;
+    c.width = 720;
+    c.height = 1280;
+    c.refresh_rate = 60.0;
+    c.log = &cout;
+    c.focus = NULL;
+    c.next_event = 0;
+    c.script_start_ns = 0;
+    c.commits = c.presents = 0;
+
+    while((opt = getopt(argc, argv, "d:r:s:e:l:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'd':
+                display_name = optarg;
+                break;
+            case 'r':
+                c.refresh_rate = atof(optarg);
+                break;
+            case 's':
+                if(sscanf(optarg, "%dx%d", &c.width, &c.height) != 2)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'e':
+                script_file = optarg;
+                break;
+            case 'l':
+                log_file = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(c.refresh_rate <= 0 || c.width < 1 || c.height < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(script_file != NULL && load_script(script_file, c.script) != 0) return 1;
+
+    if(log_file != NULL)
+    {
+        log.open(log_file, ios::out | ios::trunc);
+        if(!log.is_open())
+        {
+            cerr << "failed to open " << log_file << ": " << strerror(errno) << endl;
+            return 1;
+        }
+        c.log = &log;
+    }
+
+    c.display = wl_display_create();
+    if(c.display == NULL)
+    {
+        cerr << "failed to create display" << endl;
+        err = 2;
+        goto quit;
+    }
+
+    if(wl_display_add_socket(c.display, display_name) != 0)
+    {
+        cerr << "failed to add socket " << display_name << ": " << strerror(errno) << endl;
+        err = 2;
+        goto quit;
+    }
+
+    wl_global_create(c.display, &wl_compositor_interface, 3, &c, bind_compositor);
+    wl_global_create(c.display, &wl_shell_interface, 1, &c, bind_shell);
+    wl_global_create(c.display, &wl_output_interface, 2, &c, bind_output);
+    wl_global_create(c.display, &wl_seat_interface, 4, &c, bind_seat);
+    wl_global_create(c.display, &qt_surface_extension_interface, 1, &c, bind_surface_extension);
+    wl_global_create(c.display, &android_wlegl_interface, 1, &c, bind_wlegl);
+
+    // a timerfd because wl_event_loop timers only have millisecond resolution
+    c.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(c.timer_fd < 0)
+    {
+        cerr << "failed to create timerfd: " << strerror(errno) << endl;
+        err = 3;
+        goto quit;
+    }
+
+    interval_ns = (int64_t)(1e9 / c.refresh_rate);
+    period.it_interval.tv_sec = interval_ns / 1000000000LL;
+    period.it_interval.tv_nsec = interval_ns % 1000000000LL;
+    period.it_value = period.it_interval;
+    if(timerfd_settime(c.timer_fd, 0, &period, NULL) < 0)
+    {
+        cerr << "failed to arm timerfd: " << strerror(errno) << endl;
+        err = 3;
+        goto quit;
+    }
+
+    loop = wl_display_get_event_loop(c.display);
+    c.refresh_source = wl_event_loop_add_fd(loop, c.timer_fd, WL_EVENT_READABLE, handle_refresh, &c);
+    c.script_source = wl_event_loop_add_timer(loop, handle_script, &c);
+    sigint_source = wl_event_loop_add_signal(loop, SIGINT, handle_signal, &c);
+    sigterm_source = wl_event_loop_add_signal(loop, SIGTERM, handle_signal, &c);
+    if(c.refresh_source == NULL || c.script_source == NULL || sigint_source == NULL || sigterm_source == NULL)
+    {
+        cerr << "failed to set up the event loop" << endl;
+        err = 3;
+        goto quit;
+    }
+
+    cerr << "listening on WAYLAND_DISPLAY=" << display_name << ", " << c.width << "x" << c.height << "@" << c.refresh_rate << endl;
+
+    wl_display_run(c.display);
+
+    cerr << c.commits << " commits, " << c.presents << " presented" << endl;
+
+quit:
+    if(sigterm_source) wl_event_source_remove(sigterm_source);
+    if(sigint_source) wl_event_source_remove(sigint_source);
+    if(c.script_source) wl_event_source_remove(c.script_source);
+    if(c.refresh_source) wl_event_source_remove(c.refresh_source);
+    if(c.display)
+    {
+        wl_display_destroy_clients(c.display);
+        wl_display_destroy(c.display);
+    }
+    if(c.timer_fd >= 0) close(c.timer_fd);
+    return err;
+}
@@ -0,0 +1,253 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// feeds an input trace recorded with SFDROID_INPUT_TRACE (see input_trace.h)
+// through windowmanager_t's wayland input handlers, with uinput_t writing to
+// a file (SFDROID_UINPUT) instead of /dev/uinput. reports what the input path
+// costs and how much the delivery jitters. built against sfdroid's objects.
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <cstring>
+#include <cstdlib>
+
+#include <linux/input.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "sfdroid_defs.h"
+#include "windowmanager.h"
+#include "wayland_helper.h"
+#include "sfconnection.h"
+#include "input_trace.h"
+#include "utility.h"
+#include "bench.h"
+
+using namespace std;
+
+#define DEFAULT_SINK_FILE (SFDROID_ROOT "/uinput_sink")
+
+std::vector<sfdroid_event> sfdroid_events;
+std::mutex sfdroid_events_mutex;
+
+static void usage(const char *name)
+{
+    cout << name << " [-a] [-n loops] [-o sink] trace" << endl;
+    cout << "\t-a feed events as fast as possible instead of with the recorded timing" << endl;
+    cout << "\t-n play the trace this many times (default 1)" << endl;
+    cout << "\t-o file uinput writes to (default " << DEFAULT_SINK_FILE << ")" << endl;
+}
+
+static int load_trace(const char *path, input_trace_header_t &header, vector<input_trace_record_t> &records)
+{
+    ifstream in(path, ios::binary);
+    input_trace_record_t record;
+
+    if(!in)
+    {
+        cerr << "failed to open " << path << endl;
+        return -1;
+    }
+
+    if(!in.read((char*)&header, sizeof(header)) || header.magic != INPUT_TRACE_MAGIC || header.version != INPUT_TRACE_VERSION)
+    {
+        cerr << path << " is no input trace" << endl;
+        return -1;
+    }
+
+    // the trace may have been cut off by a crash
+    while(in.read((char*)&record, sizeof(record))) records.push_back(record);
+
+    return 0;
+}
+
+static bool is_touch(uint32_t type)
+{
+    return type == INPUT_TOUCH_DOWN || type == INPUT_TOUCH_UP || type == INPUT_TOUCH_MOTION;
+}
+
+static void dispatch(windowmanager_t &windowmanager, const input_trace_record_t &r)
+{
+    // the handlers measure their delay against the timestamp
+    uint32_t time = (uint32_t)(monotonic_ns() / 1000000);
+
+    switch(r.type)
+    {
+        case INPUT_TOUCH_DOWN:
+            windowmanager_t::touch_handle_down(&windowmanager, nullptr, 0, time, nullptr, r.id, r.x, r.y);
+            break;
+        case INPUT_TOUCH_UP:
+            windowmanager_t::touch_handle_up(&windowmanager, nullptr, 0, time, r.id);
+            break;
+        case INPUT_TOUCH_MOTION:
+            windowmanager_t::touch_handle_motion(&windowmanager, nullptr, time, r.id, r.x, r.y);
+            break;
+        case INPUT_TOUCH_FRAME:
+            windowmanager_t::touch_handle_frame(&windowmanager, nullptr);
+            break;
+        case INPUT_TOUCH_CANCEL:
+            windowmanager_t::touch_handle_cancel(&windowmanager, nullptr);
+            break;
+        case INPUT_KEYBOARD_ENTER:
+            windowmanager_t::keyboard_handle_enter(&windowmanager, nullptr, 0, nullptr, nullptr);
+            break;
+        case INPUT_KEYBOARD_LEAVE:
+            windowmanager_t::keyboard_handle_leave(&windowmanager, nullptr, 0, nullptr);
+            break;
+        default:
+            break;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int err = 0;
+    bool fast = false;
+    int loops = 1;
+    const char *sink = DEFAULT_SINK_FILE;
+    input_trace_header_t header;
+    vector<input_trace_record_t> records;
+    vector<int64_t> recorded_delay_ns, lateness_ns, handler_ns, cpu_ns, touch_dispatch_ns, uinput_ns;
+    sfconnection_t sfconnection;
+    windowmanager_t windowmanager;
+    int64_t start_ns, trace_ns;
+    uint64_t writes = 0, syns = 0;
+    ifstream sink_in;
+    struct input_event ev;
+    int opt;
+
+    while((opt = getopt(argc, argv, "an:o:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'a':
+                fast = true;
+                break;
+            case 'n':
+                loops = atoi(optarg);
+                break;
+            case 'o':
+                sink = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(optind != argc - 1 || loops < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(load_trace(argv[optind], header, records) != 0) return 2;
+    if(records.empty())
+    {
+        cerr << "nothing recorded" << endl;
+        return 2;
+    }
+
+    for(size_t i=0;i<records.size();i++)
+    {
+        uint32_t delay_ms = (uint32_t)(records[i].received_ns / 1000000) - records[i].time;
+
+        // same rule as the touch latency histogram, the clocks may differ
+        if(records[i].time != 0 && delay_ms < 1000) recorded_delay_ns.push_back((int64_t)delay_ms * 1000000);
+    }
+
+    // the replay shouldn't trace itself, and it never talks to a compositor
+    unsetenv("SFDROID_INPUT_TRACE");
+    setenv("SFDROID_UINPUT", sink, 1);
+    mkdir(SFDROID_ROOT, 0770);
+
+    wayland_helper::init(windowmanager, false);
+    wayland_helper::width = header.width;
+    wayland_helper::height = header.height;
+    if(windowmanager.init(sfconnection) != 0)
+    {
+        err = 3;
+        goto quit;
+    }
+
+    trace_ns = records.back().received_ns - records.front().received_ns;
+    start_ns = monotonic_ns();
+
+    for(int loop=0;loop<loops;loop++)
+    {
+        for(size_t i=0;i<records.size();i++)
+        {
+            int64_t scheduled_ns = start_ns + loop * trace_ns + (records[i].received_ns - records.front().received_ns);
+            int64_t t0, t1, c0, c1;
+
+            if(!fast)
+            {
+                struct timespec ts;
+                ts.tv_sec = scheduled_ns / 1000000000LL;
+                ts.tv_nsec = scheduled_ns % 1000000000LL;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            }
+
+            c0 = thread_cpu_ns();
+            t0 = monotonic_ns();
+            dispatch(windowmanager, records[i]);
+            t1 = monotonic_ns();
+            c1 = thread_cpu_ns();
+
+            if(!fast) lateness_ns.push_back(t0 - scheduled_ns);
+            if(is_touch(records[i].type))
+            {
+                handler_ns.push_back(t1 - t0);
+                cpu_ns.push_back(c1 - c0);
+                touch_dispatch_ns.push_back(t0);
+            }
+        }
+    }
+
+    // every touch ends with one SYN_REPORT, they come in the same order
+    sink_in.open(sink, ios::binary);
+    while(sink_in.read((char*)&ev, sizeof(ev)))
+    {
+        writes++;
+        if(ev.type == EV_SYN && ev.code == SYN_REPORT && syns < touch_dispatch_ns.size())
+        {
+            int64_t ev_ns = (int64_t)ev.time.tv_sec * 1000000000LL + (int64_t)ev.time.tv_usec * 1000;
+            uinput_ns.push_back(ev_ns - touch_dispatch_ns[syns]);
+            syns++;
+        }
+    }
+
+    cout << "replayed " << records.size() << " events " << loops << " times, " << touch_dispatch_ns.size() << " touches, " << writes << " uinput writes" << endl;
+    if(!touch_dispatch_ns.empty()) cout << "uinput writes per touch: " << fixed << setprecision(1) << writes / (double)touch_dispatch_ns.size() << endl;
+    print_percentiles("recorded compositor to sfdroid delay", recorded_delay_ns);
+    print_percentiles("dispatch lateness against the trace", lateness_ns);
+    print_percentiles("touch handler", handler_ns);
+    print_percentiles("touch handler cpu", cpu_ns);
+    print_percentiles("dispatch to SYN_REPORT", uinput_ns);
+
+    // no windowmanager.deinit(), it would overwrite the jank file of a running sfdroid
+quit:
+    return err;
+}
@@ -0,0 +1,452 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// microbenchmarks of what runs for every event: layer name parsing, touch
+// slot mapping, receiving a buffer's native handle and the event queue.
+// each one runs with warm caches (batches of back to back calls) and with
+// cold caches (one call after the data caches were flushed by sweeping a
+// buffer). results are written as JSON so runs of different commits can be
+// compared. built against sfdroid's objects.
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sfdroid_defs.h"
+#include "sharebuffer_protocol.h"
+#include "windowmanager.h"
+#include "utility.h"
+#include "bench.h"
+
+using namespace std;
+
+#define WARM_BATCH 64
+#define MAX_FINGERS 10
+// like a gralloc handle of libhybris: one fd and a dozen ints
+#define HANDLE_FDS 1
+#define HANDLE_INTS 12
+#define DEFAULT_FLUSH_BYTES (32 * 1024 * 1024)
+
+std::vector<sfdroid_event> sfdroid_events;
+std::mutex sfdroid_events_mutex;
+
+// keeps results alive so the calls aren't optimized away
+static volatile size_t sink;
+
+// prepare and finish run around every timed run and aren't measured
+struct microbench_t
+{
+    const char *name;
+    void (*prepare)(int ops);
+    void (*run)(int ops);
+    void (*finish)();
+};
+
+static void nothing(int ops) {}
+static void nothing_after() {}
+
+// what surfaceflinger's layers are called, see handle_layer_name_event
+static const char *layer_names[] = {
+    "com.android.systemui/com.android.systemui.recents.RecentsActivity",
+    "SurfaceView com.google.android.youtube/com.google.android.apps.youtube.app.WatchWhileActivity",
+    "Starting com.android.chrome",
+    "com.whatsapp/com.whatsapp.HomeActivity",
+    "com.cyanogenmod.trebuchet/com.android.launcher3.Launcher",
+    "android/com.android.internal.app.ResolverActivity",
+    "com.android.phasebeam.PhaseBeamWallpaper",
+    "Android is starting",
+    "BootAnimation",
+    "StatusBar",
+    "NavigationBar",
+    "PopupWindow:4a3c2e1",
+};
+#define NUM_LAYER_NAMES (sizeof(layer_names) / sizeof(layer_names[0]))
+
+static vector<vector<char> > layers;
+static size_t next_layer;
+
+static void prepare_layers()
+{
+    for(size_t i=0;i<NUM_LAYER_NAMES;i++)
+    {
+        layers.push_back(vector<char>(layer_names[i], layer_names[i] + strlen(layer_names[i]) + 1));
+    }
+}
+
+static void run_get_app_name(int ops)
+{
+    for(int i=0;i<ops;i++)
+    {
+        sink += get_app_name(layers[next_layer].data()).size();
+        next_layer = (next_layer + 1) % layers.size();
+    }
+}
+
+static void run_is_blacklisted(int ops)
+{
+    for(int i=0;i<ops;i++)
+    {
+        // like handle_layer_name_event, from the char array
+        sink += is_blacklisted(layers[next_layer].data());
+        next_layer = (next_layer + 1) % layers.size();
+    }
+}
+
+// multitouch churn: fingers go down, move and go up, at most MAX_FINGERS at once
+enum touch_op_t
+{
+    TOUCH_DOWN,
+    TOUCH_MOTION,
+    TOUCH_UP,
+};
+
+struct touch_step_t
+{
+    touch_op_t op;
+    int id;
+};
+
+static vector<touch_step_t> touch_steps;
+static size_t next_touch_step;
+static vector<int> slot_to_fingerId;
+
+static void prepare_touch_steps()
+{
+    vector<int> down;
+    int next_id = 0;
+
+    srand(1);
+    for(int i=0;i<4096;i++)
+    {
+        touch_step_t step;
+        int r = rand() % 10;
+
+        if(down.empty() || (r < 2 && down.size() < MAX_FINGERS))
+        {
+            // wayland hands out ids like the compositor's touch points, they get reused
+            step.op = TOUCH_DOWN;
+            step.id = next_id;
+            next_id = (next_id + 1) % (MAX_FINGERS * 2);
+            down.push_back(step.id);
+        }
+        else if(r < 4)
+        {
+            size_t which = rand() % down.size();
+            step.op = TOUCH_UP;
+            step.id = down[which];
+            down.erase(down.begin() + which);
+        }
+        else
+        {
+            step.op = TOUCH_MOTION;
+            step.id = down[rand() % down.size()];
+        }
+        touch_steps.push_back(step);
+    }
+
+    // the sequence repeats, it has to end without fingers down
+    for(size_t i=0;i<down.size();i++)
+    {
+        touch_step_t step = { TOUCH_UP, down[i] };
+        touch_steps.push_back(step);
+    }
+}
+
+static void run_slots(int ops)
+{
+    for(int i=0;i<ops;i++)
+    {
+        const touch_step_t &step = touch_steps[next_touch_step];
+
+        // what touch_handle_down, _motion and _up do with the slots
+        sink += find_slot(slot_to_fingerId, step.id);
+        if(step.op == TOUCH_UP) erase_slot(slot_to_fingerId, step.id);
+
+        next_touch_step = (next_touch_step + 1) % touch_steps.size();
+    }
+}
+
+// a sb_new_buffer_t with its handle over a socketpair, received like sfconnection_t does
+struct new_buffer_msg_t
+{
+    struct sb_new_buffer_t new_buffer;
+    int ints[HANDLE_INTS];
+};
+
+static int socket_fds[2] = {-1, -1};
+static int handle_fd = -1;
+static vector<int> received_fds;
+
+static int setup_socket()
+{
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, socket_fds) < 0)
+    {
+        cerr << "failed to create socketpair: " << strerror(errno) << endl;
+        return -1;
+    }
+
+    handle_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if(handle_fd < 0)
+    {
+        cerr << "failed to open /dev/null: " << strerror(errno) << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void prepare_handles(int ops)
+{
+    struct new_buffer_msg_t msg;
+    int fds[HANDLE_FDS];
+
+    memset(&msg, 0, sizeof(msg));
+    msg.new_buffer.header.type = SB_NEW_BUFFER;
+    msg.new_buffer.header.size = sizeof(msg);
+    msg.new_buffer.width = 720;
+    msg.new_buffer.height = 1280;
+    msg.new_buffer.stride = 720;
+    msg.new_buffer.pixel_format = 1;
+    msg.new_buffer.num_fds = HANDLE_FDS;
+    msg.new_buffer.num_ints = HANDLE_INTS;
+    msg.new_buffer.ints_offset = sizeof(msg.new_buffer);
+    for(int i=0;i<HANDLE_INTS;i++) msg.ints[i] = i;
+    for(int i=0;i<HANDLE_FDS;i++) fds[i] = handle_fd;
+
+    for(int i=0;i<ops;i++)
+    {
+        msg.new_buffer.index = i;
+        if(send_message(socket_fds[1], &msg, sizeof(msg), fds, HANDLE_FDS) < 0)
+        {
+            cerr << "failed to send: " << strerror(errno) << endl;
+            exit(3);
+        }
+    }
+}
+
+static void run_handles(int ops)
+{
+    char buffer[SB_MAX_DATAGRAM_SIZE];
+    char handle_buffer[sizeof(native_handle_t) + sizeof(int) * (MAX_NUM_FDS + MAX_NUM_INTS)];
+    native_handle_t *handle = (native_handle_t*)handle_buffer;
+    struct buffer_info_t info;
+    int fds[MAX_NUM_FDS];
+    int num_fds;
+
+    for(int i=0;i<ops;i++)
+    {
+        if(recv_message(socket_fds[0], buffer, sizeof(buffer), fds, &num_fds) < 0 ||
+            decode_new_buffer((const struct sb_new_buffer_t*)buffer, fds, handle, &info) != 0)
+        {
+            cerr << "failed to receive the native handle" << endl;
+            exit(3);
+        }
+        for(int j=0;j<num_fds;j++) received_fds.push_back(fds[j]);
+    }
+}
+
+static void finish_handles()
+{
+    for(size_t i=0;i<received_fds.size();i++) close(received_fds[i]);
+    received_fds.clear();
+}
+
+static void run_event_queue(int ops)
+{
+    sfdroid_event event;
+
+    event.type = BUFFER;
+    event.data.buffer.buffer = nullptr;
+    event.data.buffer.info = nullptr;
+    event.data.buffer.acquire_fence = -1;
+    event.data.buffer.post_ns = 0;
+    event.data.buffer.frame_id = 0;
+
+    for(int i=0;i<ops;i++)
+    {
+        // the sfconnection thread queues it
+        sfdroid_events_mutex.lock();
+        sfdroid_events.push_back(event);
+        sfdroid_events_mutex.unlock();
+
+        // the main loop handles everything queued and empties the queue
+        sfdroid_events_mutex.lock();
+        for(size_t j=0;j<sfdroid_events.size();j++) sink += sfdroid_events[j].type;
+        sfdroid_events.clear();
+        sfdroid_events_mutex.unlock();
+    }
+}
+
+static const microbench_t benchmarks[] = {
+    { "get_app_name", nothing, run_get_app_name, nothing_after },
+    { "is_blacklisted", nothing, run_is_blacklisted, nothing_after },
+    { "find_slot_erase_slot", nothing, run_slots, nothing_after },
+    { "recv_message_decode_new_buffer", prepare_handles, run_handles, finish_handles },
+    { "event_queue_push_pop", nothing, run_event_queue, nothing_after },
+};
+#define NUM_BENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static vector<char> flush_buffer;
+
+// touches every cache line of a buffer bigger than the caches
+static void flush_caches()
+{
+    for(size_t i=0;i<flush_buffer.size();i+=64) flush_buffer[i]++;
+    sink += flush_buffer[flush_buffer.size() / 2];
+}
+
+// ns per call of every sample, sorted
+static vector<int64_t> measure(const microbench_t &b, bool cold, int samples)
+{
+    int ops = cold ? 1 : WARM_BATCH;
+    vector<int64_t> per_op;
+
+    // the first run faults everything in
+    b.prepare(ops);
+    b.run(ops);
+    b.finish();
+
+    for(int i=0;i<samples;i++)
+    {
+        int64_t start_ns;
+
+        b.prepare(ops);
+        if(cold) flush_caches();
+        start_ns = monotonic_ns();
+        b.run(ops);
+        per_op.push_back((monotonic_ns() - start_ns) / ops);
+        b.finish();
+    }
+
+    sort(per_op.begin(), per_op.end());
+    return per_op;
+}
+
+static void write_result(ostream &out, const microbench_t &b, bool cold, vector<int64_t> &per_op, bool last)
+{
+    int64_t sum = 0;
+
+    for(size_t i=0;i<per_op.size();i++) sum += per_op[i];
+
+    out << "    {\"name\": \"" << b.name << "\", \"cache\": \"" << (cold ? "cold" : "warm") << "\", "
+        << "\"samples\": " << per_op.size() << ", \"calls_per_sample\": " << (cold ? 1 : WARM_BATCH) << ", "
+        << "\"mean_ns\": " << sum / (int64_t)per_op.size() << ", "
+        << "\"p50_ns\": " << percentile_ns(per_op, 0.5) << ", "
+        << "\"p90_ns\": " << percentile_ns(per_op, 0.9) << ", "
+        << "\"p99_ns\": " << percentile_ns(per_op, 0.99) << ", "
+        << "\"max_ns\": " << per_op.back() << "}" << (last ? "" : ",") << endl;
+}
+
+static void usage(const char *name)
+{
+    cout << name << " [-w samples] [-c samples] [-f MB] [-o file]" << endl;
+    cout << "\t-w samples with warm caches, " << WARM_BATCH << " calls each (default 2000)" << endl;
+    cout << "\t-c samples with cold caches, one call each (default 500)" << endl;
+    cout << "\t-f size of the buffer that flushes the caches (default " << DEFAULT_FLUSH_BYTES / (1024 * 1024) << ")" << endl;
+    cout << "\t-o write the JSON results to file instead of stdout" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int warm_samples = 2000;
+    int cold_samples = 500;
+    size_t flush_bytes = DEFAULT_FLUSH_BYTES;
+    const char *file = NULL;
+    ofstream out_file;
+    int64_t start_ns;
+    int opt;
+
+    while((opt = getopt(argc, argv, "w:c:f:o:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'w':
+                warm_samples = atoi(optarg);
+                break;
+            case 'c':
+                cold_samples = atoi(optarg);
+                break;
+            case 'f':
+                flush_bytes = (size_t)atoi(optarg) * 1024 * 1024;
+                break;
+            case 'o':
+                file = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(warm_samples < 1 || cold_samples < 1 || flush_bytes < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(file)
+    {
+        out_file.open(file);
+        if(!out_file.is_open())
+        {
+            cerr << "failed to open " << file << endl;
+            return 2;
+        }
+    }
+    ostream &out = file ? out_file : cout;
+
+    if(setup_socket() != 0) return 2;
+    prepare_layers();
+    prepare_touch_steps();
+    flush_buffer.resize(flush_bytes);
+
+    // what a timed call costs at least
+    start_ns = monotonic_ns();
+    for(int i=0;i<1000;i++) sink += monotonic_ns();
+
+    out << "{" << endl;
+    out << "  \"clock_overhead_ns\": " << (monotonic_ns() - start_ns) / 1001 << "," << endl;
+    out << "  \"flush_bytes\": " << flush_bytes << "," << endl;
+    out << "  \"results\": [" << endl;
+    for(size_t i=0;i<NUM_BENCHMARKS;i++)
+    {
+        vector<int64_t> warm = measure(benchmarks[i], false, warm_samples);
+        vector<int64_t> cold = measure(benchmarks[i], true, cold_samples);
+
+        write_result(out, benchmarks[i], false, warm, false);
+        write_result(out, benchmarks[i], true, cold, i == NUM_BENCHMARKS - 1);
+    }
+    out << "  ]" << endl;
+    out << "}" << endl;
+
+    close(socket_fds[0]);
+    close(socket_fds[1]);
+    close(handle_fd);
+    return 0;
+}
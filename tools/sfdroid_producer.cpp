@@ -0,0 +1,263 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// stands in for the sharebuffer module in android: registers memfd backed
+// buffers (see memfd_handle.h), posts them in a configurable pattern and
+// measures how long sfdroid takes to answer
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+#include <unistd.h>
+#include <time.h>
+
+#include "sb_client.h"
+#include "sfdroid_defs.h"
+
+using namespace std;
+
+// renderer is considered gone after this long without an answer
+#define ANSWER_TIMEOUT_MS 2000
+#define BURST_LENGTH 8
+#define LAYER_STORM_SIZE 16
+#define APP_SWITCH_SECONDS 2
+#define NUM_APPS 4
+
+enum pattern_t
+{
+    PATTERN_STEADY,
+    PATTERN_BURST,
+    PATTERN_LAYERS,
+    PATTERN_APPS,
+};
+
+static int64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void usage(const char *name)
+{
+    cout << name << " [-p pattern] [-r fps] [-n frames] [-b buffers] [-q depth] [-s WxH] [-R] [-f socket]" << endl;
+    cout << "\t-p steady, burst (" << BURST_LENGTH << " posts back to back), layers (" << LAYER_STORM_SIZE << " layer names per frame) or apps (switch app every " << APP_SWITCH_SECONDS << "s), default steady" << endl;
+    cout << "\t-r posts per second on average, 0 posts as fast as sfdroid answers (default 60)" << endl;
+    cout << "\t-n number of posts (default 600)" << endl;
+    cout << "\t-b number of buffers (default 3)" << endl;
+    cout << "\t-q posts that may wait for their status at the same time (default 1, like the sharebuffer module)" << endl;
+    cout << "\t-s buffer size (default 720x1280)" << endl;
+    cout << "\t-R ask for buffer releases and only reuse released buffers" << endl;
+    cout << "\t-f socket (default " << SHAREBUFFER_HANDLE_FILE << ")" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int err = 0;
+    const char *file = SHAREBUFFER_HANDLE_FILE;
+    pattern_t pattern = PATTERN_STEADY;
+    double rate = 60.0;
+    uint64_t frames = 600;
+    int num_buffers = 3;
+    size_t depth = 1;
+    bool want_release = false;
+    uint32_t width = 720, height = 1280;
+    sb_client_t p;
+    int64_t interval_ns, start_ns, next_ns;
+    uint64_t posted = 0;
+    int app = 0;
+    string layer_name;
+    int opt;
+
+    while((opt = getopt(argc, argv, "p:r:n:b:q:s:Rf:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'p':
+                if(strcmp(optarg, "steady") == 0) pattern = PATTERN_STEADY;
+                else if(strcmp(optarg, "burst") == 0) pattern = PATTERN_BURST;
+                else if(strcmp(optarg, "layers") == 0) pattern = PATTERN_LAYERS;
+                else if(strcmp(optarg, "apps") == 0) pattern = PATTERN_APPS;
+                else
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 'n':
+                frames = strtoull(optarg, NULL, 10);
+                break;
+            case 'b':
+                num_buffers = atoi(optarg);
+                break;
+            case 'q':
+                depth = atoi(optarg);
+                break;
+            case 's':
+                if(sscanf(optarg, "%ux%u", &width, &height) != 2)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'R':
+                want_release = true;
+                break;
+            case 'f':
+                file = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(num_buffers < 1 || num_buffers > MAX_NUM_BUFFERS || depth < 1 || rate < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(p.connect_to(file) != 0)
+    {
+        err = 2;
+        goto quit;
+    }
+
+    // no ring and no fences, everything goes through the socket
+    if(p.handshake(want_release ? SB_CAP_BUFFER_RELEASE : SB_CAP_NONE) != 0)
+    {
+        err = 3;
+        goto quit;
+    }
+
+    for(int i=0;i<num_buffers;i++)
+    {
+        // HAL_PIXEL_FORMAT_RGBA_8888
+        if(p.add_buffer(width, height, width, 1, 4) < 0)
+        {
+            err = 4;
+            goto quit;
+        }
+    }
+
+    layer_name = "com.example.sfdroid_producer0/com.example.sfdroid_producer0.MainActivity";
+    if(p.send_layer(SB_LAYER_NAME, layer_name, 1) < 0)
+    {
+        err = 5;
+        goto quit;
+    }
+
+    interval_ns = (rate > 0) ? (int64_t)(1e9 / rate) : 0;
+    start_ns = next_ns = monotonic_ns();
+
+    while(posted < frames)
+    {
+        int64_t now = monotonic_ns();
+        int index = -1;
+
+        // answers that came in while we waited for the next post
+        if(now < next_ns)
+        {
+            if(p.receive((next_ns - now + 999999) / 1000000) < 0)
+            {
+                err = 6;
+                goto quit;
+            }
+            continue;
+        }
+
+        while(p.outstanding.size() >= depth || (index = p.find_free_buffer()) < 0)
+        {
+            int r = p.receive(ANSWER_TIMEOUT_MS);
+            if(r <= 0)
+            {
+                if(r == 0) cerr << "sfdroid stopped answering" << endl;
+                err = 6;
+                goto quit;
+            }
+        }
+
+        if(pattern == PATTERN_LAYERS && p.send_layer(SB_LAYER_NAME, layer_name, LAYER_STORM_SIZE) < 0)
+        {
+            err = 5;
+            goto quit;
+        }
+
+        if(pattern == PATTERN_APPS && rate > 0 && posted > 0 && posted % (uint64_t)(rate * APP_SWITCH_SECONDS) == 0)
+        {
+            char name[256];
+
+            if(p.send_layer(SB_LAYER_CLOSE, layer_name, 1) < 0)
+            {
+                err = 5;
+                goto quit;
+            }
+            app = (app + 1) % NUM_APPS;
+            snprintf(name, sizeof(name), "com.example.sfdroid_producer%d/com.example.sfdroid_producer%d.MainActivity", app, app);
+            layer_name = name;
+            if(p.send_layer(SB_LAYER_NAME, layer_name, 1) < 0)
+            {
+                err = 5;
+                goto quit;
+            }
+        }
+
+        if(p.post(index) < 0)
+        {
+            err = 5;
+            goto quit;
+        }
+        posted++;
+
+        // bursts keep the average rate, they just come back to back
+        if(pattern == PATTERN_BURST)
+        {
+            if(posted % BURST_LENGTH == 0) next_ns += interval_ns * BURST_LENGTH;
+        }
+        else next_ns += interval_ns;
+
+        // don't try to catch up after sfdroid stalled us
+        if(next_ns < monotonic_ns() - interval_ns * BURST_LENGTH) next_ns = monotonic_ns();
+    }
+
+    while(!p.outstanding.empty())
+    {
+        int r = p.receive(ANSWER_TIMEOUT_MS);
+        if(r <= 0)
+        {
+            if(r == 0) cerr << "sfdroid stopped answering" << endl;
+            err = 6;
+            break;
+        }
+    }
+
+    p.print_results(posted, monotonic_ns() - start_ns);
+
+quit:
+    p.disconnect();
+    return err;
+}
@@ -0,0 +1,373 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// replays a session recorded with SFDROID_RECORD (see session_record.h)
+// against a running sfdroid. buffers are memfds, so sfdroid has to run with
+// SFDROID_GRALLOC=memfd. everything goes through the socket, posts that were
+// fenced or went through the ring are replayed as plain posts.
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+#include <unistd.h>
+#include <time.h>
+
+#include "sb_client.h"
+#include "session_record.h"
+#include "sfdroid_defs.h"
+
+using namespace std;
+
+// renderer is considered gone after this long without an answer
+#define ANSWER_TIMEOUT_MS 2000
+
+struct event_t
+{
+    session_record_t record;
+    vector<char> payload;
+    int snapshot; // for posts, the event holding the buffer's contents, -1 if none
+};
+
+static int64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void usage(const char *name)
+{
+    cout << name << " [-a] [-q depth] [-f socket] session" << endl;
+    cout << "\t-a post as fast as sfdroid answers instead of with the recorded timing" << endl;
+    cout << "\t-q posts that may wait for their status at the same time (default 1, like the sharebuffer module)" << endl;
+    cout << "\t-f socket (default " << SHAREBUFFER_HANDLE_FILE << ")" << endl;
+}
+
+static int load_session(const char *path, vector<event_t> &events)
+{
+    ifstream in(path, ios::binary);
+    session_file_header_t header;
+    vector<int> last_post(MAX_NUM_BUFFERS, -1);
+
+    if(!in)
+    {
+        cerr << "failed to open " << path << endl;
+        return -1;
+    }
+
+    if(!in.read((char*)&header, sizeof(header)) || header.magic != SESSION_MAGIC || header.version != SESSION_VERSION)
+    {
+        cerr << path << " is no session recording" << endl;
+        return -1;
+    }
+
+    while(true)
+    {
+        event_t e;
+
+        if(!in.read((char*)&e.record, sizeof(e.record))) break;
+        if(e.record.size < sizeof(e.record))
+        {
+            cerr << "invalid record size: " << e.record.size << endl;
+            return -1;
+        }
+
+        e.payload.resize(e.record.size - sizeof(e.record));
+        // the recording may have been cut off by a crash
+        if(!e.payload.empty() && !in.read(e.payload.data(), e.payload.size())) break;
+        e.snapshot = -1;
+
+        if(e.record.type == SESSION_CONNECT)
+        {
+            fill(last_post.begin(), last_post.end(), -1);
+        }
+        else if(e.record.type == SESSION_POST && e.payload.size() >= sizeof(session_post_t))
+        {
+            const session_post_t *post = (const session_post_t*)e.payload.data();
+            if(post->index < MAX_NUM_BUFFERS) last_post[post->index] = events.size();
+        }
+        else if(e.record.type == SESSION_SNAPSHOT && e.payload.size() >= sizeof(session_snapshot_t))
+        {
+            const session_snapshot_t *snapshot = (const session_snapshot_t*)e.payload.data();
+            // snapshots are taken when sfdroid picks the post up, the post came before
+            if(snapshot->index < MAX_NUM_BUFFERS && last_post[snapshot->index] >= 0) events[last_post[snapshot->index]].snapshot = events.size();
+        }
+
+        events.push_back(e);
+    }
+
+    return 0;
+}
+
+// scales the snapshot back up, every sampled pixel is repeated scale x scale times
+static void fill_buffer(sb_client_t &c, uint32_t index, const event_t &e)
+{
+    const session_snapshot_t *snapshot = (const session_snapshot_t*)e.payload.data();
+    const char *pixels = e.payload.data() + sizeof(session_snapshot_t);
+    sb_client_buffer_t &b = c.buffers[index];
+    uint32_t bpp = snapshot->bytes_per_pixel;
+    char *dst;
+
+    if(bpp != b.bytes_per_pixel || snapshot->width == 0 || snapshot->height == 0 || snapshot->scale == 0) return;
+    if(e.payload.size() < sizeof(session_snapshot_t) + (size_t)snapshot->width * snapshot->height * bpp) return;
+    if((dst = (char*)c.map_buffer(index)) == NULL) return;
+
+    for(uint32_t y=0;y<b.height;y++)
+    {
+        uint32_t sy = min(y / snapshot->scale, snapshot->height - 1);
+        const char *src = pixels + (size_t)sy * snapshot->width * bpp;
+        char *row = dst + (size_t)y * b.stride * bpp;
+
+        for(uint32_t x=0;x<b.width;x++)
+        {
+            uint32_t sx = min(x / snapshot->scale, snapshot->width - 1);
+            memcpy(row + (size_t)x * bpp, src + (size_t)sx * bpp, bpp);
+        }
+    }
+}
+
+// waits until index can be posted without more than depth posts in flight
+static int wait_for_buffer(sb_client_t &c, uint32_t index, size_t depth)
+{
+    while(c.outstanding.size() >= depth || c.buffers[index].busy)
+    {
+        int r = c.receive(ANSWER_TIMEOUT_MS);
+        if(r <= 0)
+        {
+            if(r == 0) cerr << "sfdroid stopped answering" << endl;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int drain(sb_client_t &c)
+{
+    while(!c.outstanding.empty())
+    {
+        int r = c.receive(ANSWER_TIMEOUT_MS);
+        if(r <= 0)
+        {
+            if(r == 0) cerr << "sfdroid stopped answering" << endl;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int err = 0;
+    const char *file = SHAREBUFFER_HANDLE_FILE;
+    bool fast = false;
+    size_t depth = 1;
+    vector<event_t> events;
+    vector<int64_t> lateness_ns;
+    sb_client_t c;
+    int64_t record_start_ns = 0, start_ns;
+    uint64_t posted = 0, connects = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "aq:f:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'a':
+                fast = true;
+                break;
+            case 'q':
+                depth = atoi(optarg);
+                break;
+            case 'f':
+                file = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(optind != argc - 1 || depth < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(load_session(argv[optind], events) != 0) return 2;
+    if(events.empty())
+    {
+        cerr << "nothing recorded" << endl;
+        return 2;
+    }
+
+    record_start_ns = events[0].record.timestamp_ns;
+    start_ns = monotonic_ns();
+
+    for(size_t i=0;i<events.size();i++)
+    {
+        const event_t &e = events[i];
+        int64_t scheduled_ns = start_ns + (e.record.timestamp_ns - record_start_ns);
+
+        // answers that came in while we waited for the next event
+        while(!fast && c.fd >= 0 && monotonic_ns() < scheduled_ns)
+        {
+            if(c.receive((scheduled_ns - monotonic_ns() + 999999) / 1000000) < 0)
+            {
+                err = 6;
+                goto quit;
+            }
+        }
+        if(!fast && c.fd < 0 && monotonic_ns() < scheduled_ns) usleep((scheduled_ns - monotonic_ns()) / 1000);
+
+        switch(e.record.type)
+        {
+            case SESSION_CONNECT:
+            {
+                const session_connect_t *connect = (const session_connect_t*)e.payload.data();
+
+                if(e.payload.size() < sizeof(session_connect_t)) break;
+                if(c.fd >= 0)
+                {
+                    if(drain(c) != 0)
+                    {
+                        err = 6;
+                        goto quit;
+                    }
+                    c.disconnect();
+                }
+
+                if(c.connect_to(file) != 0)
+                {
+                    err = 3;
+                    goto quit;
+                }
+                // no ring and no fences, everything goes through the socket
+                if(c.handshake(connect->capabilities) != 0)
+                {
+                    err = 3;
+                    goto quit;
+                }
+                connects++;
+                break;
+            }
+            case SESSION_LAYER_NAME:
+            case SESSION_LAYER_CLOSE:
+            {
+                const session_layer_t *layer = (const session_layer_t*)e.payload.data();
+
+                if(c.fd < 0 || e.payload.size() < sizeof(session_layer_t) || e.payload.size() - sizeof(session_layer_t) < layer->length) break;
+                if(c.send_layer(e.record.type == SESSION_LAYER_NAME ? SB_LAYER_NAME : SB_LAYER_CLOSE, string(e.payload.data() + sizeof(session_layer_t), layer->length), 1) < 0)
+                {
+                    err = 5;
+                    goto quit;
+                }
+                break;
+            }
+            case SESSION_NEW_BUFFER:
+            {
+                const session_new_buffer_t *new_buffer = (const session_new_buffer_t*)e.payload.data();
+                uint32_t bpp;
+                int r;
+
+                if(c.fd < 0 || e.payload.size() < sizeof(session_new_buffer_t)) break;
+                if(new_buffer->index > c.buffers.size())
+                {
+                    cerr << "unexpected buffer index in recording: " << new_buffer->index << endl;
+                    err = 4;
+                    goto quit;
+                }
+                // formats sfdroid couldn't read get a size anyway
+                bpp = new_buffer->bytes_per_pixel ? new_buffer->bytes_per_pixel : 4;
+                // an index registered again replaces its buffer
+                if(new_buffer->index < c.buffers.size()) r = c.replace_buffer(new_buffer->index, new_buffer->width, new_buffer->height, new_buffer->stride, new_buffer->pixel_format, bpp);
+                else r = c.add_buffer(new_buffer->width, new_buffer->height, new_buffer->stride, new_buffer->pixel_format, bpp);
+                if(r < 0 || c.register_buffer(new_buffer->index) < 0)
+                {
+                    err = 4;
+                    goto quit;
+                }
+                break;
+            }
+            case SESSION_POST:
+            {
+                const session_post_t *post = (const session_post_t*)e.payload.data();
+
+                if(c.fd < 0 || e.payload.size() < sizeof(session_post_t)) break;
+                if(post->index >= c.buffers.size())
+                {
+                    cerr << "post of unknown buffer in recording: " << post->index << endl;
+                    err = 4;
+                    goto quit;
+                }
+
+                if(wait_for_buffer(c, post->index, depth) != 0)
+                {
+                    err = 6;
+                    goto quit;
+                }
+                if(e.snapshot >= 0) fill_buffer(c, post->index, events[e.snapshot]);
+
+                if(!fast) lateness_ns.push_back(max<int64_t>(0, monotonic_ns() - scheduled_ns));
+                if(c.post(post->index) < 0)
+                {
+                    err = 5;
+                    goto quit;
+                }
+                posted++;
+                break;
+            }
+            case SESSION_DISCONNECT:
+                if(c.fd < 0) break;
+                if(drain(c) != 0)
+                {
+                    err = 6;
+                    goto quit;
+                }
+                c.disconnect();
+                break;
+            default:
+                // snapshots are applied with their post
+                break;
+        }
+    }
+
+    if(c.fd >= 0 && drain(c) != 0) err = 6;
+
+    cout << "replayed " << events.size() << " records, " << connects << " connections" << endl;
+    c.print_results(posted, monotonic_ns() - start_ns);
+    if(!lateness_ns.empty())
+    {
+        sort(lateness_ns.begin(), lateness_ns.end());
+        cout << "lateness against the recording (us): p50 " << sb_client_t::percentile_us(lateness_ns, 0.5)
+             << " p90 " << sb_client_t::percentile_us(lateness_ns, 0.9) << " p99 " << sb_client_t::percentile_us(lateness_ns, 0.99)
+             << " max " << lateness_ns.back() / 1000 << endl;
+    }
+
+quit:
+    c.disconnect();
+    return err;
+}
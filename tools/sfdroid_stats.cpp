@@ -0,0 +1,234 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// prints what sfdroid keeps in its stats file, see metrics_file.h
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "metrics_file.h"
+#include "sfdroid_defs.h"
+
+using namespace std;
+
+struct snapshot_t
+{
+    int64_t taken_ns;
+    vector<uint64_t> counters;
+    vector<int64_t> gauges;
+    vector<struct metrics_histogram_t> histograms;
+};
+
+static int64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void usage(const char *name)
+{
+    cout << name << " [-i seconds] [-f file]" << endl;
+    cout << "\t-i print what happened during every interval instead of everything since start" << endl;
+    cout << "\t-f stats file (default " << METRICS_FILE << ")" << endl;
+}
+
+static void take_snapshot(const char *map, const struct metrics_header_t *header, snapshot_t &s)
+{
+    const char *p = map + sizeof(struct metrics_header_t) + (header->num_counters + header->num_gauges + header->num_histograms) * METRICS_NAME_LENGTH;
+
+    s.taken_ns = monotonic_ns();
+    s.counters.resize(header->num_counters);
+    s.gauges.resize(header->num_gauges);
+    s.histograms.resize(header->num_histograms);
+
+    // torn reads only make single numbers a bit off
+    memcpy(s.counters.data(), p, header->num_counters * sizeof(uint64_t));
+    p += header->num_counters * sizeof(uint64_t);
+    memcpy(s.gauges.data(), p, header->num_gauges * sizeof(int64_t));
+    p += header->num_gauges * sizeof(int64_t);
+    memcpy(s.histograms.data(), p, header->num_histograms * sizeof(struct metrics_histogram_t));
+}
+
+static uint64_t percentile(const struct metrics_histogram_t &h, uint64_t count, double fraction)
+{
+    uint64_t rank = (uint64_t)(count * fraction);
+    uint64_t seen = 0;
+
+    for(unsigned int i = 0;i < METRICS_HISTOGRAM_BUCKETS;i++)
+    {
+        seen += h.buckets[i];
+        if(seen > rank) return metrics_bucket_start(i);
+    }
+
+    return h.max_us;
+}
+
+static void print(const char *map, const struct metrics_header_t *header, const snapshot_t &now, const snapshot_t *before)
+{
+    const char *names = map + sizeof(struct metrics_header_t);
+    double seconds = (double)(now.taken_ns - (before ? before->taken_ns : header->start_ns)) / 1e9;
+
+    cout << (before ? "last " : "since start, ") << fixed << setprecision(1) << seconds << "s:" << endl;
+
+    // cpu time and syscalls are most useful per shown frame
+    uint64_t frames = 0;
+    for(uint32_t i = 0;i < header->num_counters;i++)
+    {
+        if(strcmp(names + i * METRICS_NAME_LENGTH, "frames") == 0) frames = now.counters[i] - (before ? before->counters[i] : 0);
+    }
+
+    for(uint32_t i = 0;i < header->num_counters;i++, names += METRICS_NAME_LENGTH)
+    {
+        uint64_t value = now.counters[i] - (before ? before->counters[i] : 0);
+        cout << "  " << left << setw(26) << names << right << setw(12) << value << setw(12) << setprecision(1) << (seconds > 0 ? value / seconds : 0.0) << "/s";
+        if(frames > 0) cout << setw(12) << setprecision(2) << (double)value / frames << "/frame";
+        cout << endl;
+    }
+
+    for(uint32_t i = 0;i < header->num_gauges;i++, names += METRICS_NAME_LENGTH)
+    {
+        cout << "  " << left << setw(26) << names << right << setw(12) << now.gauges[i] << endl;
+    }
+
+    cout << "  " << left << setw(26) << "latency (us)" << right << setw(10) << "count" << setw(10) << "mean" << setw(10) << "p50" << setw(10) << "p90" << setw(10) << "p99" << setw(10) << "max" << endl;
+    for(uint32_t i = 0;i < header->num_histograms;i++, names += METRICS_NAME_LENGTH)
+    {
+        struct metrics_histogram_t h = now.histograms[i];
+
+        if(before)
+        {
+            h.count -= before->histograms[i].count;
+            h.sum_us -= before->histograms[i].sum_us;
+            for(unsigned int b = 0;b < METRICS_HISTOGRAM_BUCKETS;b++) h.buckets[b] -= before->histograms[i].buckets[b];
+        }
+
+        cout << "  " << left << setw(26) << names << right << setw(10) << h.count;
+        if(h.count == 0)
+        {
+            cout << endl;
+            continue;
+        }
+        // max is since start, intervals only know their highest bucket
+        cout << setw(10) << h.sum_us / h.count << setw(10) << percentile(h, h.count, 0.5) << setw(10) << percentile(h, h.count, 0.9) << setw(10) << percentile(h, h.count, 0.99) << setw(10) << (before ? percentile(h, h.count, 1.0) : h.max_us) << endl;
+    }
+
+    cout << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int err = 0;
+    const char *file = METRICS_FILE;
+    int interval = 0;
+    int fd = -1;
+    struct stat st;
+    char *map = (char*)MAP_FAILED;
+    const struct metrics_header_t *header;
+    snapshot_t before, now;
+    int opt;
+
+    while((opt = getopt(argc, argv, "i:f:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'i':
+                interval = atoi(optarg);
+                break;
+            case 'f':
+                file = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    fd = open(file, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        cerr << "failed to open " << file << ": " << strerror(errno) << endl;
+        err = 2;
+        goto quit;
+    }
+
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct metrics_header_t))
+    {
+        cerr << file << " is not a stats file" << endl;
+        err = 3;
+        goto quit;
+    }
+
+    map = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        cerr << "failed to map " << file << ": " << strerror(errno) << endl;
+        err = 4;
+        goto quit;
+    }
+
+    header = (const struct metrics_header_t*)map;
+    if(__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != METRICS_MAGIC || header->version != METRICS_VERSION)
+    {
+        cerr << file << " has an unknown format" << endl;
+        err = 5;
+        goto quit;
+    }
+
+    if(sizeof(struct metrics_header_t) + (header->num_counters + header->num_gauges + header->num_histograms) * METRICS_NAME_LENGTH
+        + header->num_counters * sizeof(uint64_t) + header->num_gauges * sizeof(int64_t)
+        + header->num_histograms * sizeof(struct metrics_histogram_t) > (size_t)st.st_size)
+    {
+        cerr << file << " is truncated" << endl;
+        err = 6;
+        goto quit;
+    }
+
+    take_snapshot(map, header, now);
+    if(interval <= 0)
+    {
+        print(map, header, now, nullptr);
+        goto quit;
+    }
+
+    while(true)
+    {
+        before = now;
+        sleep(interval);
+        take_snapshot(map, header, now);
+        print(map, header, now, &before);
+    }
+
+quit:
+    if(map != MAP_FAILED) munmap(map, st.st_size);
+    if(fd >= 0) close(fd);
+    return err;
+}
@@ -0,0 +1,103 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "sfdroid_defs.h"
+
+using namespace std;
+
+bool trace_t::enabled(false);
+int trace_t::fd_marker(-1);
+int trace_t::pid(0);
+
+int trace_t::init()
+{
+    const char *env = getenv("SFDROID_TRACE");
+
+    if(!env || strcmp(env, "1") != 0) return 0;
+
+    fd_marker = open(TRACE_MARKER_FILE, O_WRONLY | O_CLOEXEC);
+    if(fd_marker < 0) fd_marker = open(TRACE_MARKER_FILE_DEBUGFS, O_WRONLY | O_CLOEXEC);
+    if(fd_marker < 0)
+    {
+        cerr << "failed to open " << TRACE_MARKER_FILE << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    pid = getpid();
+    enabled = true;
+
+    return 0;
+}
+
+void trace_t::deinit()
+{
+    enabled = false;
+    if(fd_marker >= 0) close(fd_marker);
+    fd_marker = -1;
+}
+
+void trace_t::write_marker(const char *buffer, int length)
+{
+    if(length <= 0) return;
+    if(length > TRACE_MAX_MARKER_LENGTH) length = TRACE_MAX_MARKER_LENGTH;
+
+    // one write is one event, short writes can't be continued
+    if(write(fd_marker, buffer, length) < 0) {}
+}
+
+void trace_t::begin(const char *name)
+{
+    char buffer[TRACE_MAX_MARKER_LENGTH + 1];
+    write_marker(buffer, snprintf(buffer, sizeof(buffer), "B|%d|%s", pid, name));
+}
+
+void trace_t::end()
+{
+    char buffer[TRACE_MAX_MARKER_LENGTH + 1];
+    write_marker(buffer, snprintf(buffer, sizeof(buffer), "E|%d", pid));
+}
+
+void trace_t::async_begin(const char *name, int32_t cookie)
+{
+    char buffer[TRACE_MAX_MARKER_LENGTH + 1];
+    write_marker(buffer, snprintf(buffer, sizeof(buffer), "S|%d|%s|%d", pid, name, cookie));
+}
+
+void trace_t::async_end(const char *name, int32_t cookie)
+{
+    char buffer[TRACE_MAX_MARKER_LENGTH + 1];
+    write_marker(buffer, snprintf(buffer, sizeof(buffer), "F|%d|%s|%d", pid, name, cookie));
+}
+
+void trace_t::counter(const char *name, int64_t value)
+{
+    char buffer[TRACE_MAX_MARKER_LENGTH + 1];
+    write_marker(buffer, snprintf(buffer, sizeof(buffer), "C|%d|%s|%lld", pid, name, (long long)value));
+}
@@ -0,0 +1,51 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <cstdint>
+
+// atrace style markers for ftrace's trace_marker, so sfdroid shows up next to
+// surfaceflinger and the compositor in systrace and perfetto captures.
+// enabled with SFDROID_TRACE=1, otherwise every marker is one untaken branch.
+class trace_t {
+    public:
+        static int init();
+        static void deinit();
+
+        static void begin(const char *name);
+        static void end();
+        // async slices may start and end on different threads, cookie tells them apart
+        static void async_begin(const char *name, int32_t cookie);
+        static void async_end(const char *name, int32_t cookie);
+        static void counter(const char *name, int64_t value);
+
+        static bool enabled;
+
+    private:
+        static void write_marker(const char *buffer, int length);
+
+        static int fd_marker;
+        static int pid;
+};
+
+class trace_scope_t {
+    public:
+        trace_scope_t(const char *name) : active(trace_t::enabled) { if(active) trace_t::begin(name); }
+        ~trace_scope_t() { if(active) trace_t::end(); }
+    private:
+        bool active;
+};
+
+#define TRACE_ENABLED() __builtin_expect(trace_t::enabled, 0)
+
+#define TRACE_BEGIN(name) do { if(TRACE_ENABLED()) trace_t::begin(name); } while(0)
+#define TRACE_END() do { if(TRACE_ENABLED()) trace_t::end(); } while(0)
+#define TRACE_ASYNC_BEGIN(name, cookie) do { if(TRACE_ENABLED()) trace_t::async_begin(name, cookie); } while(0)
+#define TRACE_ASYNC_END(name, cookie) do { if(TRACE_ENABLED()) trace_t::async_end(name, cookie); } while(0)
+#define TRACE_COUNTER(name, value) do { if(TRACE_ENABLED()) trace_t::counter(name, value); } while(0)
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// until the end of the enclosing block
+#define TRACE_SCOPE(name) trace_scope_t TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#endif
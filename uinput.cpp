@@ -19,26 +19,44 @@
  */
 
 #include <iostream>
+#include <cstdlib>
 
 #include <linux/input.h>
 #include <linux/uinput.h>
 #include <sys/time.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include "sfdroid_defs.h"
 #include "uinput.h"
 #include "utility.h"
+#include "logger.h"
+#include "metrics.h"
 
 using namespace std;
 
 int uinput_t::init(int win_width, int win_height)
 {
     int err = 0;
+    const char *sink_file = getenv("SFDROID_UINPUT");
 #if DEBUG
     cout << "setting up uinput" << endl;
 #endif
     // try different uinput device nodes
     int errnos[3];
+
+    if(sink_file)
+    {
+        fd_uinput = open(sink_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd_uinput < 0)
+        {
+            cerr << "failed to open " << sink_file << ": " << strerror(errno) << endl;
+            err = 17;
+        }
+        sink = true;
+        goto quit;
+    }
+
     fd_uinput = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
     errnos[0] = errno;
     if(fd_uinput < 0)
@@ -168,12 +186,23 @@ int uinput_t::send_event(int type, int code, int value)
 {
     struct input_event ev;
 
-    gettimeofday(&ev.time, NULL);
+    if(sink)
+    {
+        // the kernel stamps events itself, the sink is read by sfdroid_input_replay
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ev.time.tv_sec = ts.tv_sec;
+        ev.time.tv_usec = ts.tv_nsec / 1000;
+    }
+    else gettimeofday(&ev.time, NULL);
 
     ev.type = type;
     ev.code = code;
     ev.value = value;
 
+    LOG_D(LOG_UINPUT, "event type %d code %d value %d", type, code, value);
+
+    metrics_t::count(COUNTER_SYSCALLS_UINPUT);
     if(write(fd_uinput, &ev, sizeof(ev)) < 0)
     {
         return 0;
@@ -8,7 +8,7 @@
 class uinput_t
 {
     public:
-        uinput_t() : fd_uinput(-1), uinput_dev_created(0) { }
+        uinput_t() : fd_uinput(-1), uinput_dev_created(0), sink(false) { }
         int init(int win_width, int win_height);
         int send_event(int type, int code, int value);
         void deinit();
@@ -16,6 +16,8 @@ class uinput_t
         int fd_uinput;
         int uinput_dev_created;
         struct uinput_user_dev uidev;
+        // SFDROID_UINPUT, events go to a file stamped with CLOCK_MONOTONIC
+        bool sink;
 };
 
 #endif
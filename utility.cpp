@@ -26,6 +26,7 @@
 #include <string>
 #include <unistd.h>
 #include <cstring>
+#include <time.h>
 
 using namespace std;
 
@@ -170,3 +171,10 @@ void stop_app(const char *appandactivity)
     system(buff);
 }
 
+
+int64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
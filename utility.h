@@ -2,6 +2,7 @@
 #define __UTILITY_H__
 
 #include <string>
+#include <cstdint>
 
 void touch(const char *fname);
 void wakeup_android();
@@ -14,5 +15,8 @@ void stop_app(const char *appandactivity);
 bool is_blacklisted(std::string app);
 std::string get_app_name(char *layer_name);
 
+// CLOCK_MONOTONIC, the clock timestamps in the sharebuffer protocol use
+int64_t monotonic_ns();
+
 #endif
 
@@ -0,0 +1,96 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "vsync_estimator.h"
+
+// plausible refresh periods, 20Hz to 250Hz
+#define MIN_PERIOD_NS 4000000LL
+#define MAX_PERIOD_NS 50000000LL
+// missed refreshes between two samples we still learn from
+#define MAX_SKIPPED_REFRESHES 8
+
+void vsync_estimator_t::set_refresh(int32_t refresh_mhz)
+{
+    int64_t period;
+
+    if(refresh_mhz <= 0 || exact) return;
+
+    period = 1000000000000LL / refresh_mhz;
+    if(period >= MIN_PERIOD_NS && period <= MAX_PERIOD_NS) period_ns = period;
+}
+
+void vsync_estimator_t::add_sample(int64_t timestamp_ns, int64_t refresh_ns)
+{
+    int64_t dt, n, predicted;
+
+    if(refresh_ns >= MIN_PERIOD_NS && refresh_ns <= MAX_PERIOD_NS)
+    {
+        // presentation feedback is exact, nothing to estimate
+        exact = true;
+        period_ns = refresh_ns;
+        phase_ns = timestamp_ns;
+        return;
+    }
+
+    if(phase_ns == 0 || timestamp_ns <= phase_ns)
+    {
+        phase_ns = timestamp_ns;
+        return;
+    }
+
+    dt = timestamp_ns - phase_ns;
+
+    if(period_ns == 0)
+    {
+        if(dt >= MIN_PERIOD_NS && dt <= MAX_PERIOD_NS) period_ns = dt;
+        phase_ns = timestamp_ns;
+        return;
+    }
+
+    // frames that weren't ready skip refreshes, count them
+    n = (dt + period_ns / 2) / period_ns;
+    if(n < 1 || n > MAX_SKIPPED_REFRESHES)
+    {
+        phase_ns = timestamp_ns;
+        return;
+    }
+
+    predicted = phase_ns + n * period_ns;
+
+    if(timestamp_ns - predicted > period_ns / 2 || predicted - timestamp_ns > period_ns / 2)
+    {
+        // lost track, start over from here
+        phase_ns = timestamp_ns;
+        return;
+    }
+
+    // frame callbacks jitter with the scheduling of the compositor,
+    // a slow moving average keeps that out of the period
+    if(!exact) period_ns += (dt / n - period_ns) / 16;
+    phase_ns = predicted + (timestamp_ns - predicted) / 4;
+}
+
+int64_t vsync_estimator_t::next_vsync(int64_t now_ns)
+{
+    if(!is_valid()) return now_ns;
+    if(now_ns < phase_ns) return phase_ns;
+
+    return phase_ns + ((now_ns - phase_ns) / period_ns + 1) * period_ns;
+}
@@ -0,0 +1,28 @@
+#ifndef __VSYNC_ESTIMATOR_H__
+#define __VSYNC_ESTIMATOR_H__
+
+#include <cstdint>
+
+// follows the refresh of the output from frame callbacks or presentation
+// feedback, all timestamps are CLOCK_MONOTONIC nanoseconds
+class vsync_estimator_t {
+    public:
+        vsync_estimator_t() : period_ns(0), phase_ns(0), exact(false) {}
+        // refresh rate of the output in mHz as wl_output reports it
+        void set_refresh(int32_t refresh_mhz);
+        // refresh_ns is 0 if the source doesn't know the period (frame callbacks)
+        void add_sample(int64_t timestamp_ns, int64_t refresh_ns);
+        bool is_valid() { return period_ns > 0 && phase_ns > 0; }
+        int64_t get_period() { return period_ns; }
+        // the last vsync seen
+        int64_t get_phase() { return phase_ns; }
+        // the first vsync after now
+        int64_t next_vsync(int64_t now_ns);
+
+    private:
+        int64_t period_ns;
+        int64_t phase_ns;
+        bool exact; // the period came from presentation feedback
+};
+
+#endif
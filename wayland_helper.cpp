@@ -22,10 +22,15 @@
 
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
 
 #include <poll.h>
+#include <time.h>
 
 #include "wayland-android-client-protocol.h"
+#include "linux-explicit-synchronization-unstable-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+#include "metrics.h"
 
 using namespace std;
 
@@ -38,16 +43,30 @@ const struct wl_registry_listener wayland_helper::registry_listener = {&wayland_
 const struct wl_output_listener wayland_helper::output_listener = {&wayland_helper::output_handle_geometry, &wayland_helper::output_handle_mode, &wayland_helper::output_handle_done, &wayland_helper::output_handle_scale};
 int32_t wayland_helper::width;
 int32_t wayland_helper::height;
+int32_t wayland_helper::refresh(0);
 struct wl_output *wayland_helper::output;
 struct wl_seat *wayland_helper::seat;
 struct windowmanager_t *wayland_helper::windowmanager;
 struct qt_surface_extension *wayland_helper::q_surface_extension;
 struct android_wlegl *wayland_helper::a_android_wlegl;
+struct zwp_linux_explicit_synchronization_v1 *wayland_helper::explicit_sync(nullptr);
+struct wp_presentation *wayland_helper::presentation(nullptr);
+uint32_t wayland_helper::presentation_clock(CLOCK_MONOTONIC);
+const struct wp_presentation_listener wayland_helper::presentation_listener = {&wayland_helper::presentation_clock_id};
 
-int wayland_helper::init(windowmanager_t &wm)
+int wayland_helper::init(windowmanager_t &wm, bool connect)
 {
     windowmanager = &wm;
 
+    if(!connect)
+    {
+        // no compositor, the output is made up
+        width = HEADLESS_WIDTH;
+        height = HEADLESS_HEIGHT;
+        refresh = HEADLESS_REFRESH;
+        return 0;
+    }
+
     display = wl_display_connect(0);
     if(!display) return 1;
 
@@ -80,12 +99,18 @@ void wayland_helper::dispatch()
 {
     struct pollfd pfd[1];
 
+    if(!display) return;
+
     pfd[0].fd = wl_display_get_fd(display);
     pfd[0].events = POLLIN;
+    metrics_t::count(COUNTER_SYSCALLS_WAYLAND);
     poll(pfd, 1, 0);
 
     if (pfd[0].revents & POLLIN)
+    {
+        metrics_t::count(COUNTER_SYSCALLS_WAYLAND);
         wl_display_dispatch(display);
+    }
     else
         wl_display_dispatch_pending(display);
 }
@@ -121,6 +146,20 @@ void wayland_helper::registry_add_object(void *data, struct wl_registry *registr
     {
         a_android_wlegl = static_cast<struct android_wlegl*>(wl_registry_bind(registry, name, &android_wlegl_interface, 1));
     }
+    else if(strcmp(interface, "zwp_linux_explicit_synchronization_v1") == 0)
+    {
+        const char *env = getenv("SFDROID_EXPLICIT_SYNC");
+
+        // opt-in, most compositors only take fences for dmabuf buffers and
+        // fail android_wlegl ones with the fatal unsupported_buffer error
+        if(!env || strcmp(env, "1") != 0) return;
+        explicit_sync = static_cast<struct zwp_linux_explicit_synchronization_v1*>(wl_registry_bind(registry, name, &zwp_linux_explicit_synchronization_v1_interface, version < 2 ? version : 2));
+    }
+    else if(strcmp(interface, "wp_presentation") == 0)
+    {
+        presentation = static_cast<struct wp_presentation*>(wl_registry_bind(registry, name, &wp_presentation_interface, 1));
+        wp_presentation_add_listener(presentation, &presentation_listener, 0);
+    }
     else
     {
 #if DEBUG
@@ -150,6 +189,7 @@ void wayland_helper::output_handle_mode(void *data, struct wl_output *wl_output,
 #endif
     wayland_helper::width = width;
     wayland_helper::height = height;
+    wayland_helper::refresh = refresh;
 }
 
 void wayland_helper::output_handle_done(void *data, struct wl_output *wl_output)
@@ -166,10 +206,21 @@ void wayland_helper::output_handle_scale(void *data, struct wl_output *wl_output
 #endif
 }
 
+void wayland_helper::presentation_clock_id(void *data, struct wp_presentation *presentation, uint32_t clk_id)
+{
+#if DEBUG
+    cout << "presentation clock id: " << clk_id << endl;
+#endif
+    presentation_clock = clk_id;
+}
+
 void wayland_helper::deinit()
 {
+    if(!display) return;
     eglTerminate(egl_display);
     android_wlegl_destroy(a_android_wlegl);
+    if(explicit_sync) zwp_linux_explicit_synchronization_v1_destroy(explicit_sync);
+    if(presentation) wp_presentation_destroy(presentation);
     wl_display_disconnect(display);
 }
 
@@ -9,10 +9,13 @@
 #include "windowmanager.h"
 
 struct qt_surface_extension;
+struct zwp_linux_explicit_synchronization_v1;
+struct wp_presentation;
 
 class wayland_helper {
     public:
-        static int init(windowmanager_t &windowmanager);
+        // without connect nothing is shown, the output gets the HEADLESS_* size
+        static int init(windowmanager_t &windowmanager, bool connect);
         static void dispatch();
         static void roundtrip();
         static void deinit();
@@ -26,10 +29,12 @@ class wayland_helper {
         static void output_handle_done(void *data, struct wl_output *wl_output);
         static void output_handle_scale(void *data, struct wl_output *wl_output, int32_t factor);
 
+        static void presentation_clock_id(void *data, struct wp_presentation *presentation, uint32_t clk_id);
+
     public:
         static EGLDisplay egl_display;
 
-        static struct wl_display *display;
+        static struct wl_display *display; // nullptr when headless
         static struct wl_compositor *compositor;
         static struct wl_shell *shell;
         static struct wl_seat *seat;
@@ -37,10 +42,17 @@ class wayland_helper {
         static const struct wl_registry_listener registry_listener;
         static struct wl_output *output;
         static const struct wl_output_listener output_listener;
+        static const struct wp_presentation_listener presentation_listener;
         static struct android_wlegl *a_android_wlegl;
+        // nullptr if the compositor can't wait on fences itself
+        static struct zwp_linux_explicit_synchronization_v1 *explicit_sync;
+        // nullptr if the compositor doesn't tell when frames were shown
+        static struct wp_presentation *presentation;
+        static uint32_t presentation_clock;
 
         static int32_t width;
         static int32_t height;
+        static int32_t refresh; // mHz
 
         static windowmanager_t *windowmanager;
 
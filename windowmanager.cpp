@@ -20,13 +20,28 @@
 
 #include <iostream>
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
 
 #include "wayland_helper.h"
 #include "windowmanager.h"
 #include "utility.h"
+#include "metrics.h"
+#include "trace.h"
+#include "logger.h"
 
 using namespace std;
 
+// wayland input timestamps are milliseconds of an unspecified clock,
+// compositors use CLOCK_MONOTONIC in practice
+static void record_touch_latency(uint32_t time)
+{
+    uint32_t delay_ms = (uint32_t)(monotonic_ns() / 1000000) - time;
+
+    metrics_t::count(COUNTER_TOUCH_EVENTS);
+    if(delay_ms < 1000) metrics_t::record(HISTOGRAM_TOUCH_TO_UINPUT, (int64_t)delay_ms * 1000000);
+}
+
 int find_slot(vector<int> &slot_to_fingerId, int fingerId)
 {
     // find the slot
@@ -82,8 +97,16 @@ void erase_slot(vector<int> &slot_to_fingerId, int fingerId)
 
 int windowmanager_t::init(sfconnection_t &sfc)
 {
+    const char *env;
+
     sfconnection = &sfc;
 
+    vsync.set_refresh(wayland_helper::refresh);
+
+    // without presentation feedback there is no way to tell where the deadline is
+    env = getenv("SFDROID_LATE_LATCH");
+    scheduler.set_enabled(wayland_helper::presentation && !(env && strcmp(env, "0") == 0));
+
     swipe_hack_dist_x = (SWIPE_HACK_PIXEL_PERCENT * wayland_helper::width) / 100;
     swipe_hack_dist_y = (SWIPE_HACK_PIXEL_PERCENT * wayland_helper::height) / 100;
 
@@ -91,6 +114,10 @@ int windowmanager_t::init(sfconnection_t &sfc)
     cout << "swipe hack dist (x,y): (" << swipe_hack_dist_x << "," << swipe_hack_dist_y << ")" << endl;
 #endif
 
+    // not fatal, input works without the trace
+    env = getenv("SFDROID_INPUT_TRACE");
+    if(env) input_trace.init(env, wayland_helper::width, wayland_helper::height);
+
     return uinput.init(wayland_helper::width, wayland_helper::height);
 }
 
@@ -103,6 +130,22 @@ void windowmanager_t::deinit()
         it->second->deinit();
         delete it->second;
     }
+
+    jank.write_summaries(JANK_FILE);
+    input_trace.deinit();
+    uinput.deinit();
+}
+
+size_t windowmanager_t::wayland_objects()
+{
+    size_t count = 0;
+
+    for(map<string, renderer_t*>::iterator wit = windows.begin();wit != windows.end();wit++)
+    {
+        count += wit->second->wayland_objects();
+    }
+
+    return count;
 }
 
 void windowmanager_t::take_focus()
@@ -140,9 +183,7 @@ void windowmanager_t::seat_handle_capabilities(void *data, struct wl_seat *seat,
 
 void windowmanager_t::handle_layer_name_event(char *layer_name)
 {
-#if DEBUG
-    cout << "handle layer name event " << layer_name << endl;
-#endif
+    LOG_D(LOG_WINDOWMANAGER, "handle layer name event %s", layer_name);
 
     if(is_blacklisted(layer_name))
     {
@@ -197,9 +238,7 @@ void windowmanager_t::handle_layer_name_event(char *layer_name)
 
 void windowmanager_t::handle_layer_close_event(char *layer_name)
 {
-#if DEBUG
-    cout << "handle layer close event " << layer_name << endl;
-#endif
+    LOG_D(LOG_WINDOWMANAGER, "handle layer close event %s", layer_name);
 
     if(is_blacklisted(layer_name))
     {
@@ -236,17 +275,16 @@ void windowmanager_t::handle_layer_close_event(char *layer_name)
     }
 }
 
-bool windowmanager_t::handle_buffer_event(ANativeWindowBuffer *buffer, buffer_info_t &info)
+bool windowmanager_t::handle_buffer_event(ANativeWindowBuffer *buffer, buffer_info_t &info, int acquire_fence, int32_t frame_id)
 {
-#if DEBUG
-    cout << "handle buffer event" << endl;
-#endif
+    TRACE_SCOPE("handle_buffer_event");
+    LOG_D(LOG_WINDOWMANAGER, "handle buffer event");
 
     for(map<string, renderer_t*>::iterator wit = windows.begin();wit != windows.end();wit++)
     {
         if(wit->second->is_active() && !wait_for_next_layer_name)
         {
-            if(wit->second->render_buffer(buffer, info) != 0)
+            if(wit->second->render_buffer(buffer, info, acquire_fence, frame_id) != 0)
             {
                 return false;
             }
@@ -260,15 +298,14 @@ bool windowmanager_t::handle_buffer_event(ANativeWindowBuffer *buffer, buffer_in
 
 bool windowmanager_t::handle_no_buffer_event(ANativeWindowBuffer *old_buffer, buffer_info_t &info)
 {
-#if DEBUG
-    cout << "handle no buffer event" << endl;
-#endif
+    LOG_D(LOG_WINDOWMANAGER, "handle no buffer event");
+    jank.add_no_buffer();
 
     for(map<string, renderer_t*>::iterator wit = windows.begin();wit != windows.end();wit++)
     {
         if(wit->second->is_active())
         {
-            wit->second->render_buffer(old_buffer, info);
+            wit->second->render_buffer(old_buffer, info, -1, 0);
             return true;
         }
     }
@@ -276,6 +313,145 @@ bool windowmanager_t::handle_no_buffer_event(ANativeWindowBuffer *old_buffer, bu
     return false;
 }
 
+void windowmanager_t::handle_buffers_removed_event()
+{
+    LOG_D(LOG_WINDOWMANAGER, "handle buffers removed event");
+
+    for(map<string, renderer_t*>::iterator wit = windows.begin();wit != windows.end();wit++)
+    {
+        wit->second->forget_buffers();
+    }
+}
+
+void windowmanager_t::handle_buffer_replaced_event(ANativeWindowBuffer *buffer)
+{
+    LOG_D(LOG_WINDOWMANAGER, "handle buffer replaced event");
+
+    for(map<string, renderer_t*>::iterator wit = windows.begin();wit != windows.end();wit++)
+    {
+        wit->second->forget_buffer(buffer);
+    }
+}
+
+void windowmanager_t::handle_buffer_release(ANativeWindowBuffer *buffer, int release_fence)
+{
+    sfconnection->notify_buffer_released(buffer, release_fence);
+}
+
+void windowmanager_t::handle_vsync(int64_t timestamp_ns, int64_t refresh_ns, bool exact)
+{
+    vsync.add_sample(timestamp_ns, exact ? refresh_ns : 0);
+    metrics_t::set(GAUGE_VSYNC_PERIOD_US, vsync.get_period() / 1000);
+
+    if(vsync.is_valid())
+    {
+        sfconnection->notify_vsync(vsync.get_phase(), vsync.get_period(), exact ? SB_VSYNC_EXACT : 0);
+    }
+}
+
+int64_t windowmanager_t::commit_due_frames(int64_t now_ns)
+{
+    int64_t next = 0;
+
+    for(map<string, renderer_t*>::iterator wit = windows.begin();wit != windows.end();wit++)
+    {
+        int64_t deadline;
+
+        if(!wit->second->has_pending()) continue;
+
+        deadline = scheduler.deadline(wit->second->get_pending_target());
+        if(deadline <= now_ns)
+        {
+            wit->second->commit_pending();
+        }
+        else if(next == 0 || deadline < next)
+        {
+            next = deadline;
+        }
+    }
+
+    return next;
+}
+
+renderer_t *windowmanager_t::get_window(const std::string &app)
+{
+    map<string, renderer_t*>::iterator wit = windows.find(app);
+
+    return (wit != windows.end()) ? wit->second : nullptr;
+}
+
+int windowmanager_t::handle_sfdroid_events(bool multiwindow)
+{
+    if(sfdroid_events.size() > 0)
+    {
+        for(vector<sfdroid_event>::size_type i = 0;i < sfdroid_events.size();i++)
+        {
+            switch(sfdroid_events[i].type)
+            {
+                case LAST_WINDOW_CLOSED:
+                    return 1;
+                case LAYER_NAME:
+                    if(multiwindow) handle_layer_name_event(sfdroid_events[i].data.layer_name);
+                    break;
+                case LAYER_CLOSE:
+                    if(multiwindow) handle_layer_close_event(sfdroid_events[i].data.layer_name);
+                    break;
+                case BUFFERS_REMOVED:
+                    handle_buffers_removed_event();
+                    break;
+                case BUFFER_REPLACED:
+                    handle_buffer_replaced_event(sfdroid_events[i].data.buffer.buffer);
+                    break;
+                case BUFFER:
+                    metrics_t::record(HISTOGRAM_POST_TO_DEQUEUE, monotonic_ns() - sfdroid_events[i].data.buffer.post_ns);
+                    TRACE_ASYNC_END("queued", sfdroid_events[i].data.buffer.frame_id);
+                    jank.add_post(sfdroid_events[i].data.buffer.post_ns);
+                    if(to_front_still_processing())
+                    {
+                        jank.add_suppressed();
+                        metrics_t::count(COUNTER_FAILED_FRAMES);
+                        sfconnection->notify_buffer_done(1);
+                    }
+                    // failed means the buffer never reached the compositor
+                    else if(handle_buffer_event(sfdroid_events[i].data.buffer.buffer, *sfdroid_events[i].data.buffer.info, sfdroid_events[i].data.buffer.acquire_fence, sfdroid_events[i].data.buffer.frame_id))
+                    {
+                        metrics_t::count(COUNTER_FRAMES);
+                        sfconnection->notify_buffer_shown(sfdroid_events[i].data.buffer.buffer);
+                        sfconnection->notify_buffer_done(0);
+                    }
+                    else
+                    {
+                        metrics_t::count(COUNTER_FAILED_FRAMES);
+                        sfconnection->notify_buffer_done(1);
+                    }
+                    if(sfdroid_events[i].data.buffer.acquire_fence >= 0) close(sfdroid_events[i].data.buffer.acquire_fence);
+                    break;
+                case NO_BUFFER:
+                    if(!to_front_still_processing())
+                    {
+                        if(!handle_no_buffer_event(sfdroid_events[i].data.buffer.buffer, *sfdroid_events[i].data.buffer.info))
+                        {
+                            metrics_t::count(COUNTER_FAILED_DUMMY_FRAMES);
+                            sfconnection->notify_buffer_done(0);
+                            break;
+                        }
+                        metrics_t::count(COUNTER_DUMMY_FRAMES);
+                    }
+                    else
+                    {
+                        metrics_t::count(COUNTER_FAILED_DUMMY_FRAMES);
+                    }
+                    sfconnection->notify_buffer_done(0);
+                    break;
+            }
+        }
+
+        sfdroid_events.clear();
+    }
+
+    return 0;
+}
+
 void windowmanager_t::handle_close(struct wl_surface *surface)
 {
 #if DEBUG
@@ -305,9 +481,7 @@ void windowmanager_t::handle_close(struct wl_surface *surface)
 
 void windowmanager_t::touch_handle_down(void *data, struct wl_touch *wl_touch, uint32_t serial, uint32_t time, struct wl_surface *surface, int32_t id, wl_fixed_t w_x, wl_fixed_t w_y)
 {
-#if DEBUG
-    cout << "handle touch down event" << endl;
-#endif
+    LOG_D(LOG_UINPUT, "handle touch down event %d at %d,%d", id, wl_fixed_to_int(w_x), wl_fixed_to_int(w_y));
 
     windowmanager_t *windowmanager = (windowmanager_t*)data;
     int x, y;
@@ -315,6 +489,8 @@ void windowmanager_t::touch_handle_down(void *data, struct wl_touch *wl_touch, u
     int touch_y = wl_fixed_to_int(w_y);
     int slot;
 
+    windowmanager->input_trace.record(INPUT_TOUCH_DOWN, time, id, w_x, w_y);
+
     slot = find_slot(windowmanager->slot_to_fingerId, id);
 
     windowmanager->uinput.send_event(EV_ABS, ABS_MT_SLOT, slot);
@@ -324,16 +500,12 @@ void windowmanager_t::touch_handle_down(void *data, struct wl_touch *wl_touch, u
 
     if(touch_x <= windowmanager->swipe_hack_dist_x)
     {
-#if DEBUG
-        cout << "swipe hack x" << endl;
-#endif
+        LOG_D(LOG_UINPUT, "swipe hack x");
         x = 0;
     }
     if(touch_x >= wayland_helper::width - windowmanager->swipe_hack_dist_x)
     {
-#if DEBUG
-        cout << "swipe hack x" << endl;
-#endif
+        LOG_D(LOG_UINPUT, "swipe hack x");
         x = wayland_helper::width;
     }
 
@@ -341,16 +513,12 @@ void windowmanager_t::touch_handle_down(void *data, struct wl_touch *wl_touch, u
 
     if(touch_y <= windowmanager->swipe_hack_dist_y)
     {
-#if DEBUG
-        cout << "swipe hack y" << endl;
-#endif
+        LOG_D(LOG_UINPUT, "swipe hack y");
         y = 0;
     }
     if(touch_y >= wayland_helper::height - windowmanager->swipe_hack_dist_y)
     {
-#if DEBUG
-        cout << "swipe hack y" << endl;
-#endif
+        LOG_D(LOG_UINPUT, "swipe hack y");
         y = wayland_helper::height;
     }
 
@@ -358,37 +526,41 @@ void windowmanager_t::touch_handle_down(void *data, struct wl_touch *wl_touch, u
     windowmanager->uinput.send_event(EV_ABS, ABS_MT_POSITION_Y, y);
     windowmanager->uinput.send_event(EV_ABS, ABS_MT_PRESSURE, MAX_PRESSURE);
     windowmanager->uinput.send_event(EV_SYN, SYN_REPORT, 0);
+
+    record_touch_latency(time);
 }
 
 void windowmanager_t::touch_handle_up(void *data, struct wl_touch *wl_touch, uint32_t serial, uint32_t time, int32_t id)
 {
-#if DEBUG
-    cout << "handle touch up event" << endl;
-#endif
+    LOG_D(LOG_UINPUT, "handle touch up event %d", id);
 
     windowmanager_t *windowmanager = (windowmanager_t*)data;
     int slot;
 
+    windowmanager->input_trace.record(INPUT_TOUCH_UP, time, id, 0, 0);
+
     slot = find_slot(windowmanager->slot_to_fingerId, id);
 
     windowmanager->uinput.send_event(EV_ABS, ABS_MT_SLOT, slot);
     windowmanager->uinput.send_event(EV_ABS, ABS_MT_TRACKING_ID, -1);
     windowmanager->uinput.send_event(EV_SYN, SYN_REPORT, 0);
 
+    record_touch_latency(time);
+
     erase_slot(windowmanager->slot_to_fingerId, id);
 }
 
 void windowmanager_t::touch_handle_motion(void *data, struct wl_touch *wl_touch, uint32_t time, int32_t id, wl_fixed_t w_x, wl_fixed_t w_y)
 {
-#if DEBUG
-    cout << "handle touch motion event" << endl;
-#endif
+    LOG_D(LOG_UINPUT, "handle touch motion event %d at %d,%d", id, wl_fixed_to_int(w_x), wl_fixed_to_int(w_y));
 
     windowmanager_t *windowmanager = (windowmanager_t*)data;
     int touch_x = wl_fixed_to_int(w_x);
     int touch_y = wl_fixed_to_int(w_y);
     int slot;
 
+    windowmanager->input_trace.record(INPUT_TOUCH_MOTION, time, id, w_x, w_y);
+
     slot = find_slot(windowmanager->slot_to_fingerId, id);
 
     windowmanager->uinput.send_event(EV_ABS, ABS_MT_SLOT, slot);
@@ -397,37 +569,40 @@ void windowmanager_t::touch_handle_motion(void *data, struct wl_touch *wl_touch,
     windowmanager->uinput.send_event(EV_ABS, ABS_MT_POSITION_Y, touch_y);
     windowmanager->uinput.send_event(EV_ABS, ABS_MT_PRESSURE, MAX_PRESSURE);
     windowmanager->uinput.send_event(EV_SYN, SYN_REPORT, 0);
+
+    record_touch_latency(time);
 }
 
 void windowmanager_t::touch_handle_frame(void *data, struct wl_touch *wl_touch)
 {
-#if DEBUG
-    cout << "handle touch frame event" << endl;
-#endif
+    LOG_D(LOG_UINPUT, "handle touch frame event");
+
+    windowmanager_t *windowmanager = (windowmanager_t*)data;
+    windowmanager->input_trace.record(INPUT_TOUCH_FRAME, 0, 0, 0, 0);
 }
 
 void windowmanager_t::touch_handle_cancel(void *data, struct wl_touch *wl_touch)
 {
-#if DEBUG
-    cout << "handle keyboard cancel event" << endl;
-#endif
+    LOG_D(LOG_UINPUT, "handle touch cancel event");
+
+    windowmanager_t *windowmanager = (windowmanager_t*)data;
+    windowmanager->input_trace.record(INPUT_TOUCH_CANCEL, 0, 0, 0, 0);
 }
 
 void windowmanager_t::keyboard_handle_keymap(void *data, struct wl_keyboard *wl_keyboard, uint32_t format, int32_t fd, uint32_t size)
 {
-#if DEBUG
-    cout << "handle keyboard keymap event" << endl;
-#endif
+    LOG_D(LOG_WINDOWMANAGER, "handle keyboard keymap event");
 }
 
 void windowmanager_t::keyboard_handle_enter(void *data, struct wl_keyboard *wl_keyboard, uint32_t serial, struct wl_surface *surface, struct wl_array *keys)
 {
-#if DEBUG
-    cout << "handle keyboard enter event" << endl;
-#endif
+    LOG_D(LOG_WINDOWMANAGER, "handle keyboard enter event");
 
     windowmanager_t *windowmanager = (windowmanager_t*)data;
 
+    windowmanager->input_trace.record(INPUT_KEYBOARD_ENTER, 0, 0, 0, 0);
+    windowmanager->input_trace.flush();
+
     for(map<string, renderer_t*>::iterator wit = windowmanager->windows.begin();wit != windowmanager->windows.end();wit++)
     {
         if(wit->second->get_surface() == surface)
@@ -450,18 +625,23 @@ void windowmanager_t::keyboard_handle_enter(void *data, struct wl_keyboard *wl_k
 
 void windowmanager_t::keyboard_handle_leave(void *data, struct wl_keyboard *wl_keyboard, uint32_t serial, struct wl_surface *surface)
 {
-#if DEBUG
-    cout << "handle keyboard leave event" << endl;
-#endif
+    LOG_D(LOG_WINDOWMANAGER, "handle keyboard leave event");
 
     windowmanager_t *windowmanager = (windowmanager_t*)data;
 
+    windowmanager->input_trace.record(INPUT_KEYBOARD_LEAVE, 0, 0, 0, 0);
+    windowmanager->input_trace.flush();
+
     for(map<string, renderer_t*>::iterator wit = windowmanager->windows.begin();wit != windowmanager->windows.end();wit++)
     {
         if(wit->second->get_surface() == surface)
         {
             if(wit->second->is_active())
             {
+                const jank_summary_t &summary = windowmanager->jank.get_summary(wit->second->get_package());
+
+                // the file is written at deinit, not on the input path
+                LOG_I(LOG_WINDOWMANAGER, "%s: %llu frames, %llu missed refreshes", wit->second->get_package().c_str(), (unsigned long long)summary.frames, (unsigned long long)summary.missed);
                 wit->second->lost_focus();
                 break;
             }
@@ -473,22 +653,16 @@ void windowmanager_t::keyboard_handle_leave(void *data, struct wl_keyboard *wl_k
 
 void windowmanager_t::keyboard_handle_key(void *data, struct wl_keyboard *wl_keyboard, uint32_t serial, uint32_t time, uint32_t key, uint32_t state)
 {
-#if DEBUG
-    cout << "handle keyboard key event" << endl;
-#endif
+    LOG_D(LOG_WINDOWMANAGER, "handle keyboard key event %u %u", key, state);
 }
 
 void windowmanager_t::keyboard_handle_modifiers(void *data, struct wl_keyboard *wl_keyboard, uint32_t serial, uint32_t mods_depressed, uint32_t mods_latched, uint32_t mods_locked, uint32_t group)
 {
-#if DEBUG
-    cout << "handle keyboard modifier event" << endl;
-#endif
+    LOG_D(LOG_WINDOWMANAGER, "handle keyboard modifier event");
 }
  
 void windowmanager_t::keyboard_handle_repeat_info(void *data, struct wl_keyboard *wl_keyboard, int32_t rate, int32_t delay)
 {
-#if DEBUG
-    cout << "handle keyboard repeat info event" << endl;
-#endif
+    LOG_D(LOG_WINDOWMANAGER, "handle keyboard repeat info event");
 }
 
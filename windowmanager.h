@@ -11,12 +11,20 @@
 #include "sfdroid_defs.h"
 #include "renderer.h"
 #include "uinput.h"
+#include "input_trace.h"
 #include "wayland_helper.h"
 #include "sfconnection.h"
+#include "vsync_estimator.h"
+#include "commit_scheduler.h"
+#include "jank_detector.h"
+
+// uinput multitouch slots of wayland touch ids, -1 marks a free slot
+int find_slot(std::vector<int> &slot_to_fingerId, int fingerId);
+void erase_slot(std::vector<int> &slot_to_fingerId, int fingerId);
 
 class windowmanager_t {
     public:
-        windowmanager_t() : sfconnection(nullptr), w_touch(nullptr), w_keyboard(nullptr), swipe_hack_dist_x(0), swipe_hack_dist_y(0), taken_focus(nullptr), wait_for_next_layer_name(false) {}
+        windowmanager_t() : sfconnection(nullptr), w_touch(nullptr), w_keyboard(nullptr), swipe_hack_dist_x(0), swipe_hack_dist_y(0), taken_focus(nullptr), wait_for_next_layer_name(false), scheduler(vsync), jank(vsync) {}
         int init(sfconnection_t &sfconnection);
         void deinit();
 
@@ -37,9 +45,29 @@ class windowmanager_t {
 
         void handle_layer_name_event(char *layer_name);
         void handle_layer_close_event(char *layer_name);
-        bool handle_buffer_event(ANativeWindowBuffer *buffer, buffer_info_t &info);
+        bool handle_buffer_event(ANativeWindowBuffer *buffer, buffer_info_t &info, int acquire_fence, int32_t frame_id);
         bool handle_no_buffer_event(ANativeWindowBuffer *old_buffer, buffer_info_t &info);
+        void handle_buffers_removed_event();
+        void handle_buffer_replaced_event(ANativeWindowBuffer *buffer);
+        // takes over release_fence
+        void handle_buffer_release(ANativeWindowBuffer *buffer, int release_fence);
         void handle_close(struct wl_surface *surface);
+        // exact if the timestamp is from presentation feedback of a vsynced refresh
+        void handle_vsync(int64_t timestamp_ns, int64_t refresh_ns, bool exact);
+        vsync_estimator_t &get_vsync() { return vsync; }
+        commit_scheduler_t &get_scheduler() { return scheduler; }
+        jank_detector_t &get_jank() { return jank; }
+        // commits held frames whose deadline passed, returns the next deadline or 0.
+        // the caller holds sfdroid_events_mutex and handled the queued events first
+        int64_t commit_due_frames(int64_t now_ns);
+        // handles everything the sfconnection thread queued, returns 1 once the last window closed.
+        // without multiwindow all apps share one window. the caller holds sfdroid_events_mutex
+        int handle_sfdroid_events(bool multiwindow);
+        // nullptr if the app has no window
+        renderer_t *get_window(const std::string &app);
+        size_t window_count() { return windows.size(); }
+        // held by all windows together
+        size_t wayland_objects();
 
         const struct wl_seat_listener w_seat_listener = {
             seat_handle_capabilities,
@@ -52,6 +80,8 @@ class windowmanager_t {
         wl_keyboard *w_keyboard;
 
         uinput_t uinput;
+        input_trace_t input_trace; // SFDROID_INPUT_TRACE
+        vsync_estimator_t vsync;
 
         std::map<std::string, renderer_t*> windows;
         std::vector<int> slot_to_fingerId;
@@ -77,6 +107,8 @@ class windowmanager_t {
 
         renderer_t *taken_focus;
         bool wait_for_next_layer_name;
+        commit_scheduler_t scheduler;
+        jank_detector_t jank;
         std::string last_layer;
 };
 
@@ -0,0 +1,599 @@
+/*
+ *  this file is part of sfdroid
+ *  Copyright (C) 2015, Franz-Josef Haider <f_haider@gmx.at>
+ *  based on harmattandroid by Thomas Perl
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+
+#include <GLES/gl.h>
+#include <wayland-egl.h>
+
+#include <unistd.h>
+#include <time.h>
+
+#include "wayland-android-client-protocol.h"
+
+#include "wlegl_backend.h"
+#include "renderer.h"
+#include "wayland_helper.h"
+#include "utility.h"
+#include "metrics.h"
+#include "trace.h"
+#include "logger.h"
+
+using namespace std;
+
+#define QT_SURFACE_EXTENSION_GET_EXTENDED_SURFACE 0
+
+int wlegl_backend_t::init(renderer_t &r)
+{
+    int err = 0;
+
+    frame_callback_ptr = 0;
+
+    GLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES_BIT,
+        EGL_NONE
+    };
+    EGLConfig egl_cfg;
+    EGLint contextParams[] = {EGL_CONTEXT_CLIENT_VERSION, 1, EGL_NONE};
+    EGLint numConfigs;
+
+    renderer = &r;
+
+#if DEBUG
+    cout << "choosing egl config" << endl;
+#endif
+    if(eglChooseConfig(wayland_helper::egl_display, configAttribs, &egl_cfg, 1, &numConfigs) != EGL_TRUE || numConfigs != 1)
+    {
+        cerr << "unable to find an EGL Config" << endl;
+        err = 7;
+        goto quit;
+    }
+
+#if DEBUG
+    cout << "creating GLES context" << endl;
+#endif
+    eglBindAPI(EGL_OPENGL_ES_API);
+    egl_ctx = eglCreateContext(wayland_helper::egl_display, egl_cfg, NULL, contextParams);
+    if(egl_ctx == EGL_NO_CONTEXT)
+    {
+        cerr << "unable to create GLES context" << endl;
+        err = 9;
+        goto quit;
+    }
+
+#if DEBUG
+    cout << "creating surface" << endl;
+#endif
+    w_surface = wl_compositor_create_surface(wayland_helper::compositor);
+
+#if DEBUG
+    cout << "creating shell surface" << endl;
+#endif
+    w_shell_surface = wl_shell_get_shell_surface(wayland_helper::shell, w_surface);
+
+    if(wayland_helper::explicit_sync)
+    {
+#if DEBUG
+        cout << "getting surface synchronization" << endl;
+#endif
+        w_sync = zwp_linux_explicit_synchronization_v1_get_synchronization(wayland_helper::explicit_sync, w_surface);
+    }
+
+#if DEBUG
+    cout << "getting qt extended surface" << endl;
+#endif
+
+    q_extended_surface = (struct qt_extended_surface*)wl_proxy_create((struct wl_proxy *)wayland_helper::q_surface_extension, &wayland_helper::qt_extended_surface_interface);
+    if(!q_extended_surface)
+    {
+        err = 17;
+        goto quit;
+    }
+
+    wl_proxy_marshal((struct wl_proxy*)wayland_helper::q_surface_extension, QT_SURFACE_EXTENSION_GET_EXTENDED_SURFACE, q_extended_surface, w_surface);
+
+    wl_proxy_add_listener((struct wl_proxy*)q_extended_surface, (void (**)(void))&extended_surface_listener, this);
+    wayland_helper::roundtrip();
+
+    wl_shell_surface_add_listener(w_shell_surface, &shell_surface_listener, this);
+
+    wl_shell_surface_set_toplevel(w_shell_surface);
+
+    struct wl_region *region;
+    region = wl_compositor_create_region(wayland_helper::compositor);
+    wl_region_add(region, 0, 0,
+                  wayland_helper::width,
+                  wayland_helper::height);
+    wl_surface_set_opaque_region(w_surface, region);
+    wl_region_destroy(region);
+
+#if DEBUG
+    cout << "creating wl egl window" << endl;
+#endif
+    w_egl_window = wl_egl_window_create(w_surface, wayland_helper::width, wayland_helper::height);
+    if(w_egl_window == NULL)
+    {
+        cerr << "unable to create an egl window" << endl;
+        err = 16;
+        goto quit;
+    }
+
+#if DEBUG
+    cout << "creating egl window surface" << endl;
+#endif
+    egl_surf = eglCreateWindowSurface(wayland_helper::egl_display, egl_cfg, (EGLNativeWindowType)w_egl_window, 0);
+    if(egl_surf == EGL_NO_SURFACE)
+    {
+        cerr << "unable to create an EGLSurface" << endl;
+        err = 8;
+        goto quit;
+    }
+
+#if DEBUG
+    cout << "making GLES context current" << endl;
+#endif
+    if(eglMakeCurrent(wayland_helper::egl_display, egl_surf, egl_surf, egl_ctx) == EGL_FALSE)
+    {
+        cerr << "unable to make GLES context current" << endl;
+        err = 10;
+        goto quit;
+    }
+
+#if DEBUG
+    cout << "setting up gl" << endl;
+#endif
+    glViewport(0, 0, wayland_helper::width, wayland_helper::height);
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrthof(0, wayland_helper::width, wayland_helper::height, 0, 0, 1);
+
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    glEnable(GL_TEXTURE_2D);
+    glColor4f(1.f, 1.f, 1.f, 1.f);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+    glGenTextures(1, &dummy_tex);
+    glBindTexture(GL_TEXTURE_2D, dummy_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+#if DEBUG
+    // this might even crash if the patch is missing:
+    cout << "WARNING: if i crash now the patch is missing, look at " << __FILE__ << "@" << __LINE__ << endl;
+    if(glGetString(GL_VERSION) == 0)
+    {
+        cout << "oh no, gles v1 not working, do you have this patch: https://github.com/mer-hybris/android_frameworks_native/pull/3/files ?" << endl;
+        err = 3843;
+        goto quit;
+    }
+#endif
+
+quit:
+    return err;
+}
+
+void wlegl_backend_t::deinit()
+{
+    for(map<ANativeWindowBuffer*, struct wl_buffer*>::iterator it = buffer_map.begin();it != buffer_map.end();it++)
+    {
+        wl_buffer_destroy(it->second);
+    }
+    buffer_map.clear();
+    if(retired_buffer) wl_buffer_destroy(retired_buffer);
+    retired_buffer = nullptr;
+
+    for(map<struct zwp_linux_buffer_release_v1*, ANativeWindowBuffer*>::iterator it = release_map.begin();it != release_map.end();it++)
+    {
+        zwp_linux_buffer_release_v1_destroy(it->first);
+    }
+    release_map.clear();
+    if(w_sync) zwp_linux_surface_synchronization_v1_destroy(w_sync);
+    w_sync = nullptr;
+
+    for(map<struct wp_presentation_feedback*, feedback_info_t>::iterator it = feedbacks.begin();it != feedbacks.end();it++)
+    {
+        wp_presentation_feedback_destroy(it->first);
+    }
+    feedbacks.clear();
+
+    glDeleteTextures(1, &dummy_tex);
+    eglMakeCurrent(wayland_helper::egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroySurface(wayland_helper::egl_display, egl_surf);
+    wl_egl_window_destroy(w_egl_window);
+    wl_proxy_destroy((struct wl_proxy *)q_extended_surface);
+    wl_shell_surface_destroy(w_shell_surface);
+    wl_surface_destroy(w_surface);
+    eglDestroyContext(wayland_helper::egl_display, egl_ctx);
+}
+
+int wlegl_backend_t::draw_raw(void *data, int width, int height, int pixel_format)
+{
+    LOG_D(LOG_RENDERER, "draw raw: %d %d %d", width, height, pixel_format);
+    int err = 0;
+
+    GLuint gl_err = 0;
+
+    float xf = (float)wayland_helper::width / (float)width;
+    float yf = 1.f;
+    float texcoords[] = {
+        0.f, 0.f,
+        xf, 0.f,
+        0.f, yf,
+        xf, yf,
+    };
+
+    float vtxcoords[] = {
+        0.f, 0.f,
+        (float)wayland_helper::width, 0.f,
+        0.f, (float)wayland_helper::height,
+        (float)wayland_helper::width, (float)wayland_helper::height,
+    };
+
+    glVertexPointer(2, GL_FLOAT, 0, &vtxcoords);
+    glTexCoordPointer(2, GL_FLOAT, 0, &texcoords);
+
+    glBindTexture(GL_TEXTURE_2D, dummy_tex);
+
+    if(pixel_format == HAL_PIXEL_FORMAT_RGBA_8888 || pixel_format == HAL_PIXEL_FORMAT_RGBX_8888)
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+                GL_RGBA, GL_UNSIGNED_BYTE, data);
+    }
+    else if(pixel_format == HAL_PIXEL_FORMAT_RGB_565)
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0,
+                GL_RGB, GL_UNSIGNED_SHORT_5_6_5, data);
+    }
+    else
+    {
+        cerr << "unhandled pixel format: " << pixel_format << endl;
+        err = 3;
+        goto quit;
+    }
+    gl_err = glGetError();
+    if(gl_err != GL_NO_ERROR) cerr << "glGetError(): " << gl_err << endl;
+
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+    eglSwapBuffers(wayland_helper::egl_display, egl_surf);
+
+quit:
+    return err;
+}
+
+void wlegl_backend_t::lost_focus()
+{
+    eglMakeCurrent(wayland_helper::egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+void wlegl_backend_t::gained_focus()
+{
+    wl_shell_surface_set_toplevel(w_shell_surface);
+    eglMakeCurrent(wayland_helper::egl_display, egl_surf, egl_surf, egl_ctx);
+}
+
+size_t wlegl_backend_t::wayland_objects()
+{
+    size_t count = buffer_map.size() + release_map.size() + feedbacks.size();
+
+    if(w_surface) count++;
+    if(w_shell_surface) count++;
+    if(q_extended_surface) count++;
+    if(w_sync) count++;
+    if(frame_callback_ptr) count++;
+    if(retired_buffer) count++;
+
+    return count;
+}
+
+int wlegl_backend_t::wait_frame()
+{
+    int ret = 0;
+
+    while(frame_callback_ptr && ret != -1)
+    {
+        metrics_t::count(COUNTER_SYSCALLS_WAYLAND);
+        ret = wl_display_dispatch(wayland_helper::display);
+    }
+
+    return (ret == -1) ? -1 : 0;
+}
+
+int wlegl_backend_t::present(ANativeWindowBuffer *the_buffer, buffer_info_t &info, int acquire_fence, int64_t target_ns, bool latched, int32_t frame_id)
+{
+    if(buffer_map.find(the_buffer) == buffer_map.end())
+    {
+        struct wl_buffer *w_buffer;
+        struct wl_array ints;
+        int *the_ints;
+        struct android_wlegl_handle *wlegl_handle;
+
+        wl_array_init(&ints);
+        the_ints = (int*)wl_array_add(&ints, the_buffer->handle->numInts * sizeof(int));
+        memcpy(the_ints, the_buffer->handle->data + the_buffer->handle->numFds, the_buffer->handle->numInts * sizeof(int));
+        wlegl_handle = android_wlegl_create_handle(wayland_helper::a_android_wlegl, the_buffer->handle->numFds, &ints);
+        wl_array_release(&ints);
+
+        for (int i = 0; i < the_buffer->handle->numFds; i++)
+        {
+            android_wlegl_handle_add_fd(wlegl_handle, the_buffer->handle->data[i]);
+        }
+
+        w_buffer = android_wlegl_create_buffer(wayland_helper::a_android_wlegl, info.width, info.height, info.stride, info.pixel_format, GRALLOC_USAGE_HW_RENDER, wlegl_handle);
+        android_wlegl_handle_destroy(wlegl_handle);
+
+        wl_buffer_add_listener(w_buffer, &w_buffer_listener, this);
+
+        buffer_map[the_buffer] = w_buffer;
+    }
+
+    if(!w_sync && acquire_fence >= 0)
+    {
+        // the compositor would read what the gpu might still be writing
+        TRACE_SCOPE("wait_fence");
+        wait_fence(acquire_fence, FENCE_WAIT_TIMEOUT_MS);
+    }
+
+    frame_callback_ptr = wl_surface_frame(w_surface);
+    wl_callback_add_listener(frame_callback_ptr, &w_frame_listener, this);
+
+    wl_surface_attach(w_surface, buffer_map[the_buffer], 0, 0);
+    wl_surface_damage(w_surface, 0, 0, info.width, info.height);
+    if(w_sync)
+    {
+        struct zwp_linux_buffer_release_v1 *release;
+
+        // the fd is duplicated when the request is marshalled
+        if(acquire_fence >= 0) zwp_linux_surface_synchronization_v1_set_acquire_fence(w_sync, acquire_fence);
+
+        release = zwp_linux_surface_synchronization_v1_get_release(w_sync);
+        zwp_linux_buffer_release_v1_add_listener(release, &w_release_listener, this);
+        release_map[release] = the_buffer;
+    }
+    if(wayland_helper::presentation)
+    {
+        struct wp_presentation_feedback *feedback = wp_presentation_feedback(wayland_helper::presentation, w_surface);
+        wp_presentation_feedback_add_listener(feedback, &w_feedback_listener, this);
+        feedbacks[feedback] = feedback_info_t(target_ns, latched);
+    }
+    wl_surface_commit(w_surface);
+
+    if(retired_buffer) wl_buffer_destroy(retired_buffer);
+    retired_buffer = nullptr;
+
+    return 0;
+}
+
+void wlegl_backend_t::forget_buffers(ANativeWindowBuffer *shown)
+{
+    for(map<ANativeWindowBuffer*, struct wl_buffer*>::iterator it = buffer_map.begin();it != buffer_map.end();it++)
+    {
+        // the surface keeps showing the last one until something else is attached
+        if(it->first == shown && !retired_buffer) retired_buffer = it->second;
+        else wl_buffer_destroy(it->second);
+    }
+    buffer_map.clear();
+
+    // the slots get reused, late releases must not hit their new buffers
+    for(map<struct zwp_linux_buffer_release_v1*, ANativeWindowBuffer*>::iterator it = release_map.begin();it != release_map.end();it++)
+    {
+        zwp_linux_buffer_release_v1_destroy(it->first);
+    }
+    release_map.clear();
+}
+
+void wlegl_backend_t::forget_buffer(ANativeWindowBuffer *buffer, bool shown)
+{
+    map<ANativeWindowBuffer*, struct wl_buffer*>::iterator it = buffer_map.find(buffer);
+    map<struct zwp_linux_buffer_release_v1*, ANativeWindowBuffer*>::iterator rit = release_map.begin();
+
+    if(it != buffer_map.end())
+    {
+        // the surface keeps showing it until something else is attached
+        if(shown)
+        {
+            if(retired_buffer) wl_buffer_destroy(retired_buffer);
+            retired_buffer = it->second;
+        }
+        else wl_buffer_destroy(it->second);
+        buffer_map.erase(it);
+    }
+
+    while(rit != release_map.end())
+    {
+        if(rit->second == buffer)
+        {
+            zwp_linux_buffer_release_v1_destroy(rit->first);
+            release_map.erase(rit++);
+        }
+        else rit++;
+    }
+}
+
+void wlegl_backend_t::buffer_release(void *data, struct wl_buffer *w_buffer)
+{
+    LOG_D(LOG_RENDERER, "buffer release");
+    wlegl_backend_t *backend = (wlegl_backend_t*)data;
+
+    // the wl_buffers themselves are cleaned in deinit(), just let android reuse the buffer
+    for(map<ANativeWindowBuffer*, struct wl_buffer*>::iterator it = backend->buffer_map.begin();it != backend->buffer_map.end();it++)
+    {
+        if(it->second == w_buffer)
+        {
+            // the explicit release of the last commit comes with the fence
+            for(map<struct zwp_linux_buffer_release_v1*, ANativeWindowBuffer*>::iterator rit = backend->release_map.begin();rit != backend->release_map.end();rit++)
+            {
+                if(rit->second == it->first) return;
+            }
+
+            backend->renderer->buffer_released(it->first, -1);
+            break;
+        }
+    }
+}
+
+void wlegl_backend_t::fenced_release(void *data, struct zwp_linux_buffer_release_v1 *release, int32_t fence)
+{
+    LOG_D(LOG_RENDERER, "fenced release");
+    wlegl_backend_t *backend = (wlegl_backend_t*)data;
+    backend->explicit_release(release, fence);
+}
+
+void wlegl_backend_t::immediate_release(void *data, struct zwp_linux_buffer_release_v1 *release)
+{
+    LOG_D(LOG_RENDERER, "immediate release");
+    wlegl_backend_t *backend = (wlegl_backend_t*)data;
+    backend->explicit_release(release, -1);
+}
+
+void wlegl_backend_t::explicit_release(struct zwp_linux_buffer_release_v1 *release, int fence)
+{
+    map<struct zwp_linux_buffer_release_v1*, ANativeWindowBuffer*>::iterator it = release_map.find(release);
+    ANativeWindowBuffer *released;
+
+    zwp_linux_buffer_release_v1_destroy(release);
+    if(it == release_map.end())
+    {
+        if(fence >= 0) close(fence);
+        return;
+    }
+
+    released = it->second;
+    release_map.erase(it);
+
+    // still used by a later commit (dummy frames attach the same buffer again)
+    for(it = release_map.begin();it != release_map.end();it++)
+    {
+        if(it->second == released)
+        {
+            if(fence >= 0) close(fence);
+            return;
+        }
+    }
+
+    renderer->buffer_released(released, fence);
+}
+
+void wlegl_backend_t::shell_surface_ping(void *data, struct wl_shell_surface *shell_surface, uint32_t serial)
+{
+#if DEBUG
+    cout << "shell surface ping " << endl;
+#endif
+    wl_shell_surface_pong(shell_surface, serial);
+}
+
+void wlegl_backend_t::shell_surface_configure(void *data, struct wl_shell_surface *shell_surface, uint32_t edges, int32_t width, int32_t height)
+{
+#if DEBUG
+    cout << "shell surface configure " << endl;
+#endif
+    wlegl_backend_t *self = (wlegl_backend_t*)data;
+    wl_egl_window_resize(self->w_egl_window, width, height, 0, 0);
+}
+
+void wlegl_backend_t::shell_surface_popup_done(void *data, struct wl_shell_surface *shell_surface)
+{
+#if DEBUG
+    cout << "shell surface popup done" << endl;
+#endif
+}
+
+void wlegl_backend_t::handle_onscreen_visibility(void *data, struct qt_extended_surface *qt_extended_surface, int32_t visible)
+{
+#if DEBUG
+    wlegl_backend_t *backend = (wlegl_backend_t*)data;
+    cout << "qt_extended_surface handle onscreen visibility @ "<< backend->renderer->get_package() << endl;
+#endif
+    // handled in keyboard leave/enter
+}
+
+void wlegl_backend_t::handle_set_generic_property(void *data, struct qt_extended_surface *qt_extended_surface, const char *name, struct wl_array *value)
+{
+#if DEBUG
+    cout << "qt_extended_surface handle set generic property" << endl;
+#endif
+}
+
+void wlegl_backend_t::handle_close(void *data, struct qt_extended_surface *qt_extended_surface)
+{
+#if DEBUG
+    cout << "qt_extended_surface handle close" << endl;
+#endif
+
+    wlegl_backend_t *backend = (wlegl_backend_t*)data;
+    backend->renderer->close_requested();
+}
+
+void wlegl_backend_t::frame_callback(void *data, struct wl_callback *callback, uint32_t time)
+{
+    wlegl_backend_t *backend = (wlegl_backend_t*)data;
+    backend->frame_callback_ptr = 0;
+    wl_callback_destroy(callback);
+
+    backend->renderer->frame_done();
+
+    // the time argument has no defined base, the compositor sends these right after a refresh
+    if(!wayland_helper::presentation) backend->renderer->presented(monotonic_ns(), 0, false, 0, false);
+}
+
+void wlegl_backend_t::feedback_sync_output(void *data, struct wp_presentation_feedback *feedback, struct wl_output *output)
+{
+}
+
+void wlegl_backend_t::feedback_presented(void *data, struct wp_presentation_feedback *feedback, uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec, uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo, uint32_t flags)
+{
+    wlegl_backend_t *backend = (wlegl_backend_t*)data;
+    int64_t timestamp = (int64_t)(((uint64_t)tv_sec_hi << 32) | tv_sec_lo) * 1000000000LL + tv_nsec;
+    map<struct wp_presentation_feedback*, feedback_info_t>::iterator it = backend->feedbacks.find(feedback);
+    feedback_info_t info;
+
+    if(it != backend->feedbacks.end())
+    {
+        info = it->second;
+        backend->feedbacks.erase(it);
+    }
+    wp_presentation_feedback_destroy(feedback);
+
+    if(wayland_helper::presentation_clock != CLOCK_MONOTONIC)
+    {
+        struct timespec ts;
+        clock_gettime(wayland_helper::presentation_clock, &ts);
+        timestamp -= (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec - monotonic_ns();
+    }
+
+    LOG_D(LOG_RENDERER, "presented at %lld refresh %u", (long long)timestamp, refresh);
+    backend->renderer->presented(timestamp, refresh, (flags & WP_PRESENTATION_FEEDBACK_KIND_VSYNC) != 0, info.target_ns, info.latched);
+}
+
+void wlegl_backend_t::feedback_discarded(void *data, struct wp_presentation_feedback *feedback)
+{
+    wlegl_backend_t *backend = (wlegl_backend_t*)data;
+
+    backend->feedbacks.erase(feedback);
+    wp_presentation_feedback_destroy(feedback);
+}
@@ -0,0 +1,122 @@
+#ifndef __WLEGL_BACKEND_H__
+#define __WLEGL_BACKEND_H__
+
+#include <GLES/gl.h>
+
+#include "presentbackend.h"
+
+#include <map>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES/glext.h>
+
+#include <wayland-client.h>
+
+#include "linux-explicit-synchronization-unstable-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+
+struct qt_extended_surface_listener {
+    void (*onscreen_visibility)(void *data, struct qt_extended_surface *qt_extended_surface, int32_t visible);
+    void (*set_generic_property)(void *data, struct qt_extended_surface *qt_extended_surface, const char *name, struct wl_array *value);
+    void (*close)(void *data, struct qt_extended_surface *qt_extended_surface);
+};
+
+// a toplevel wayland surface, buffers go to the compositor through android_wlegl
+class wlegl_backend_t : public presentbackend_t {
+    public:
+        wlegl_backend_t() : egl_surf(EGL_NO_SURFACE), egl_ctx(EGL_NO_CONTEXT), w_shell_surface(nullptr), w_surface(nullptr), w_egl_window(nullptr), w_sync(nullptr), q_extended_surface(nullptr), frame_callback_ptr(nullptr), retired_buffer(nullptr), renderer(nullptr) { }
+        const char *name() { return "wlegl"; }
+        int init(renderer_t &renderer);
+        void deinit();
+        int wait_frame();
+        int present(ANativeWindowBuffer *buffer, buffer_info_t &info, int acquire_fence, int64_t target_ns, bool latched, int32_t frame_id);
+        bool immediate() { return false; }
+        void forget_buffers(ANativeWindowBuffer *shown);
+        void forget_buffer(ANativeWindowBuffer *buffer, bool shown);
+        void gained_focus();
+        void lost_focus();
+        int draw_raw(void *data, int width, int height, int pixel_format);
+        struct wl_surface *get_surface() { return w_surface; }
+        size_t wayland_objects();
+
+    private:
+        static void shell_surface_ping(void *data, struct wl_shell_surface *shell_surface, uint32_t serial);
+        static void shell_surface_configure(void *data, struct wl_shell_surface *shell_surface, uint32_t edges, int32_t width, int32_t height);
+        static void shell_surface_popup_done(void *data, struct wl_shell_surface *shell_surface);
+
+        GLuint dummy_tex;
+
+        EGLSurface egl_surf;
+        EGLContext egl_ctx;
+
+        struct wl_shell_surface *w_shell_surface;
+        struct wl_surface *w_surface;
+        struct wl_egl_window *w_egl_window;
+        struct zwp_linux_surface_synchronization_v1 *w_sync;
+
+        struct wl_shell_surface_listener shell_surface_listener = {&shell_surface_ping, &shell_surface_configure, &shell_surface_popup_done};
+
+        struct qt_extended_surface *q_extended_surface;
+
+        static void handle_onscreen_visibility(void *data, struct qt_extended_surface *qt_extended_surface, int32_t visible);
+        static void handle_set_generic_property(void *data, struct qt_extended_surface *qt_extended_surface, const char *name, struct wl_array *value);
+        static void handle_close(void *data, struct qt_extended_surface *qt_extended_surface);
+
+        static void buffer_release(void *data, struct wl_buffer *buffer);
+        static void fenced_release(void *data, struct zwp_linux_buffer_release_v1 *release, int32_t fence);
+        static void immediate_release(void *data, struct zwp_linux_buffer_release_v1 *release);
+        void explicit_release(struct zwp_linux_buffer_release_v1 *release, int fence);
+
+        static void frame_callback(void *data, struct wl_callback *callback, uint32_t time);
+
+        static void feedback_sync_output(void *data, struct wp_presentation_feedback *feedback, struct wl_output *output);
+        static void feedback_presented(void *data, struct wp_presentation_feedback *feedback, uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec, uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo, uint32_t flags);
+        static void feedback_discarded(void *data, struct wp_presentation_feedback *feedback);
+
+        const struct qt_extended_surface_listener extended_surface_listener = { 
+            &handle_onscreen_visibility,
+            &handle_set_generic_property,
+            &handle_close,
+        };
+
+        const struct wl_buffer_listener w_buffer_listener = {
+            buffer_release
+        };
+
+        const struct wl_callback_listener w_frame_listener = {
+            frame_callback
+        };
+
+        const struct wp_presentation_feedback_listener w_feedback_listener = {
+            feedback_sync_output,
+            feedback_presented,
+            feedback_discarded
+        };
+
+        const struct zwp_linux_buffer_release_v1_listener w_release_listener = {
+            fenced_release,
+            immediate_release
+        };
+
+        struct wl_callback *frame_callback_ptr;
+        struct feedback_info_t
+        {
+            feedback_info_t() : target_ns(0), latched(false) {}
+            feedback_info_t(int64_t t, bool l) : target_ns(t), latched(l) {}
+            int64_t target_ns; // 0 if the vsync wasn't known at commit time
+            bool latched;
+        };
+
+        std::map<struct wp_presentation_feedback*, feedback_info_t> feedbacks;
+
+        std::map<ANativeWindowBuffer*, struct wl_buffer*> buffer_map;
+        // still attached to the surface after forget_buffers()
+        struct wl_buffer *retired_buffer;
+        // with explicit sync every commit gets its own release
+        std::map<struct zwp_linux_buffer_release_v1*, ANativeWindowBuffer*> release_map;
+        renderer_t *renderer;
+};
+
+#endif
+